@@ -6,9 +6,11 @@ curl ?= 1
 debug ?= 0
 exif ?= 0
 help ?= 0
+jpeg ?= 1
 mkstemps ?= 1
 verscmp ?= 1
 xinerama ?= 1
+xshm ?= 1
 
 # Prefix for all installed files
 PREFIX ?= /usr/local
@@ -64,6 +66,14 @@ ifeq (${stat64},1)
 	CFLAGS += -D_FILE_OFFSET_BITS=64
 endif
 
+ifeq (${jpeg},1)
+	CFLAGS += -DHAVE_LIBJPEG
+	LDLIBS += -ljpeg
+	MAN_JPEG = enabled
+else
+	MAN_JPEG = disabled
+endif
+
 ifeq (${mkstemps},1)
 	CFLAGS += -DHAVE_MKSTEMPS
 endif
@@ -80,6 +90,11 @@ else
 	MAN_XINERAMA = disabled
 endif
 
+ifeq (${xshm},1)
+	CFLAGS += -DHAVE_XSHM
+	LDLIBS += -lXext
+endif
+
 ifeq (${exif},1)
 	CFLAGS += -DHAVE_LIBEXIF
 	LDLIBS += -lexif
@@ -88,6 +103,10 @@ else
 	MAN_EXIF = not available
 endif
 
+ifeq (${epoll},1)
+	CFLAGS += -DHAVE_EPOLL
+endif
+
 ifeq (${inotify},1)
 	CFLAGS += -DHAVE_INOTIFY
 	MAN_INOTIFY = enabled
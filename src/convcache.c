@@ -0,0 +1,329 @@
+/* convcache.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * Persistent conversion cache (--conversion-cache-size).
+ *
+ * The output of ImageMagick and dcraw is kept in
+ * $XDG_CACHE_HOME/feh/conversions across runs. The name of each entry is
+ * the MD5 sum of converter, source path, mtime and size, so a changed
+ * source file simply misses the cache. Every hit updates the entry's mtime,
+ * and once the directory grows beyond its size limit, the entries which
+ * have been used least recently are removed.
+ *
+ * Without it, converter output is only kept in memory for the current run
+ * (unless --no-conversion-cache is given), limited to --prefetch-memory.
+ * Nothing is written to the file system in that case.
+ */
+
+#include "feh.h"
+#include "options.h"
+#include "md5.h"
+#include <sys/stat.h>
+
+struct conv_cache_entry {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+/*
+ * Entries are written in one go once the conversion has finished. An
+ * incomplete one which is older than this has been left behind by a feh
+ * process which was killed or crashed while writing it.
+ */
+#define CONV_CACHE_STALE 3600
+
+struct conv_mem_entry {
+	char *filename;
+	unsigned char *data;
+	size_t len;
+};
+
+static char *conv_cache_dir = NULL;
+
+/* in-memory cache, most recently used entry first */
+static gib_list *conv_mem = NULL;
+static size_t conv_mem_size = 0;
+
+static char *feh_conversion_cache_get_dir(void)
+{
+	char *dir;
+
+	if (conv_cache_dir)
+		return(conv_cache_dir);
+	if (!(dir = feh_cache_dir()))
+		return(NULL);
+	conv_cache_dir = estrjoin("/", dir, "conversions", NULL);
+	free(dir);
+
+	if (mkdir(conv_cache_dir, 0700) == -1 && errno != EEXIST) {
+		weprintf("unable to create directory %s:", conv_cache_dir);
+		free(conv_cache_dir);
+		conv_cache_dir = NULL;
+	}
+	return(conv_cache_dir);
+}
+
+/* free the result please */
+static char *feh_conversion_cache_name(char *filename, char *converter)
+{
+	struct stat st;
+	char *path, *key, *name, *pos, mtime_size[64];
+	md5_state_t pms;
+	md5_byte_t digest[16];
+	int i;
+
+	if (!feh_conversion_cache_get_dir())
+		return(NULL);
+	if (stat(filename, &st) || !(path = realpath(filename, NULL)))
+		return(NULL);
+
+	snprintf(mtime_size, sizeof(mtime_size), "%lld:%lld",
+			(long long)st.st_mtime, (long long)st.st_size);
+	key = estrjoin(":", converter, mtime_size, path, NULL);
+	free(path);
+
+	md5_init(&pms);
+	md5_append(&pms, (unsigned char *)key, strlen(key));
+	md5_finish(&pms, digest);
+	free(key);
+
+	name = emalloc(32 + 1);
+	for (i = 0, pos = name; i < 16; i++, pos += 2)
+		sprintf(pos, "%02x", digest[i]);
+
+	path = estrjoin("/", conv_cache_dir, name, NULL);
+	free(name);
+	return(path);
+}
+
+/*
+ * Returns the cached conversion result of filename by converter (e.g.
+ * "convert" or "dcraw"), or NULL if there is none. Free the result please.
+ */
+char *feh_conversion_cache_get(char *filename, char *converter)
+{
+	char *path;
+
+	if (!opt.conversion_cache_size || path_is_url(filename))
+		return(NULL);
+	if (!(path = feh_conversion_cache_name(filename, converter)))
+		return(NULL);
+
+	/* a successful touch doubles as existence check */
+	if (utimensat(AT_FDCWD, path, NULL, 0) == -1) {
+		free(path);
+		return(NULL);
+	}
+	D(("conversion cache hit for %s: %s\n", filename, path));
+	return(path);
+}
+
+static int feh_conversion_cache_cmp(void *a, void *b)
+{
+	time_t ta = ((struct conv_cache_entry *)a)->mtime;
+	time_t tb = ((struct conv_cache_entry *)b)->mtime;
+
+	return((ta > tb) - (ta < tb));
+}
+
+/*
+ * Removes the least recently used entries (except for keep) until the cache
+ * is no larger than --conversion-cache-size, and any stale incomplete ones.
+ */
+static void feh_conversion_cache_evict(char *keep)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct stat st;
+	struct conv_cache_entry *entry;
+	gib_list *entries = NULL, *l;
+	off_t total = 0, limit = (off_t)opt.conversion_cache_size * 1024 * 1024;
+	char *path;
+	time_t stale = time(NULL) - CONV_CACHE_STALE;
+
+	if (!(dir = opendir(conv_cache_dir)))
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' && strncmp(de->d_name, ".incomplete_", 12))
+			continue;
+		path = estrjoin("/", conv_cache_dir, de->d_name, NULL);
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		if (de->d_name[0] == '.') {
+			if (st.st_mtime < stale) {
+				D(("removing stale %s\n", path));
+				unlink(path);
+			}
+			free(path);
+			continue;
+		}
+		entry = emalloc(sizeof(struct conv_cache_entry));
+		entry->path = path;
+		entry->mtime = st.st_mtime;
+		entry->size = st.st_size;
+		entries = gib_list_add_front(entries, entry);
+		total += st.st_size;
+	}
+	closedir(dir);
+
+	if (total > limit) {
+		entries = gib_list_sort(entries, feh_conversion_cache_cmp);
+		for (l = entries; l && total > limit; l = l->next) {
+			entry = l->data;
+			if (!strcmp(entry->path, keep))
+				continue;
+			D(("evicting %s\n", entry->path));
+			if (unlink(entry->path) == 0)
+				total -= entry->size;
+		}
+	}
+
+	for (l = entries; l; l = l->next) {
+		free(((struct conv_cache_entry *)l->data)->path);
+		free(l->data);
+	}
+	gib_list_free(entries);
+}
+
+/*
+ * Stores the conversion result of filename (len bytes of converter output in
+ * data) in the cache. Returns the path of the new entry (free it please), or
+ * NULL if it could not be stored.
+ */
+char *feh_conversion_cache_add(char *filename, char *converter,
+		unsigned char *data, size_t len)
+{
+	char *path, *tmppath;
+	ssize_t written = 0;
+	size_t done = 0;
+	int fd;
+
+	if (!opt.conversion_cache_size || path_is_url(filename))
+		return(NULL);
+	if (!(path = feh_conversion_cache_name(filename, converter)))
+		return(NULL);
+
+	/* readers must never see a partially written entry */
+	tmppath = estrjoin("/", conv_cache_dir, ".incomplete_XXXXXX", NULL);
+	if ((fd = mkstemp(tmppath)) != -1) {
+		while (done < len && (written = write(fd, data + done, len - done)) > 0)
+			done += written;
+		if (close(fd) || done < len || rename(tmppath, path)) {
+			unlink(tmppath);
+			fd = -1;
+		}
+	}
+	if (fd == -1) {
+		weprintf("unable to store %s in the conversion cache:", filename);
+		free(tmppath);
+		free(path);
+		return(NULL);
+	}
+	free(tmppath);
+
+	feh_conversion_cache_evict(path);
+	return(path);
+}
+
+static gib_list *feh_conversion_mem_find(char *filename)
+{
+	gib_list *l;
+
+	for (l = conv_mem; l; l = l->next)
+		if (!strcmp(((struct conv_mem_entry *)l->data)->filename, filename))
+			return(l);
+	return(NULL);
+}
+
+static void feh_conversion_mem_remove(gib_list * l)
+{
+	struct conv_mem_entry *entry = l->data;
+
+	conv_mem_size -= entry->len;
+	conv_mem = gib_list_remove(conv_mem, l);
+	free(entry->filename);
+	free(entry->data);
+	free(entry);
+}
+
+/*
+ * Returns the converter output for filename kept in memory by
+ * feh_conversion_mem_add and stores its size in len, or returns NULL if
+ * there is none. The data belongs to the cache and remains valid until the
+ * next call to feh_conversion_mem_add or feh_conversion_mem_forget.
+ */
+unsigned char *feh_conversion_mem_get(char *filename, size_t *len)
+{
+	struct conv_mem_entry *entry;
+	gib_list *l;
+
+	if (!(l = feh_conversion_mem_find(filename)))
+		return(NULL);
+	entry = l->data;
+	if (l != conv_mem) {
+		conv_mem = gib_list_remove(conv_mem, l);
+		conv_mem = gib_list_add_front(conv_mem, entry);
+	}
+	*len = entry->len;
+	return(entry->data);
+}
+
+/*
+ * Keeps len bytes of converter output for filename in memory. The cache
+ * takes over data. The least recently used entries are dropped to stay
+ * within --prefetch-memory.
+ */
+void feh_conversion_mem_add(char *filename, unsigned char *data, size_t len)
+{
+	struct conv_mem_entry *entry;
+	size_t limit = (size_t)opt.prefetch_memory * 1024 * 1024;
+
+	feh_conversion_mem_forget(filename);
+	if (len > limit) {
+		free(data);
+		return;
+	}
+	while (conv_mem && conv_mem_size + len > limit)
+		feh_conversion_mem_remove(gib_list_last(conv_mem));
+
+	entry = emalloc(sizeof(struct conv_mem_entry));
+	entry->filename = estrdup(filename);
+	entry->data = data;
+	entry->len = len;
+	conv_mem = gib_list_add_front(conv_mem, entry);
+	conv_mem_size += len;
+}
+
+void feh_conversion_mem_forget(char *filename)
+{
+	gib_list *l;
+
+	if ((l = feh_conversion_mem_find(filename)))
+		feh_conversion_mem_remove(l);
+}
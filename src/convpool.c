@@ -0,0 +1,202 @@
+/* convpool.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * Converter slots (--conversion-jobs).
+ *
+ * ImageMagick and dcraw are run by whichever process loads an image: the
+ * main process or one of the --jobs workers. To bound the number of
+ * converters running at once across all of them, the main process creates a
+ * pipe holding one byte per slot before any worker is forked, just like the
+ * GNU make jobserver. A converter may only be started after reading a byte
+ * from the pipe, and the byte is written back once it has exited.
+ *
+ * Each worker reports the slots it takes and returns to the parent through
+ * a pipe of its own. If a worker dies while holding a slot (e.g. on SIGSEGV
+ * in a decoder or SIGKILL), the parent returns the slot on its behalf.
+ */
+
+#include "feh.h"
+#include "options.h"
+#include "worker.h"
+#include "signals.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+static int slot_fds[2] = { -1, -1 };
+
+/* written by signal handlers, see feh_conversion_abort */
+static volatile sig_atomic_t slot_held = 0;
+
+/* workers only, see feh_conversion_slot_report */
+static int slot_report_fd = -1;
+
+void feh_conversion_pool_init(void)
+{
+	int i, slots = opt.conversion_jobs;
+	char token = '+';
+
+	if (slots <= 0)
+		slots = feh_job_count();
+
+	if (pipe(slot_fds) == -1) {
+		weprintf("pipe failed, not limiting concurrent conversions:");
+		slot_fds[0] = slot_fds[1] = -1;
+		return;
+	}
+	/* converters must not inherit the pipe */
+	fcntl(slot_fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(slot_fds[1], F_SETFD, FD_CLOEXEC);
+	/* several processes wait for the same byte, see feh_conversion_slot_get */
+	fcntl(slot_fds[0], F_SETFL, fcntl(slot_fds[0], F_GETFL) | O_NONBLOCK);
+
+	for (i = 0; i < slots; i++)
+		if (write(slot_fds[1], &token, 1) != 1)
+			break;
+
+	D(("%d conversion slots\n", i));
+}
+
+/*
+ * Returns the number of milliseconds left until deadline, or -1 if there is
+ * no deadline.
+ */
+int feh_conversion_ms_left(struct timespec *deadline)
+{
+	struct timespec now;
+	long ms;
+
+	if (!deadline->tv_sec && !deadline->tv_nsec)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000
+		+ (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	return (ms > 0) ? ms : 0;
+}
+
+/* async-signal-safe */
+static void feh_conversion_slot_note(char note)
+{
+	if (slot_report_fd == -1)
+		return;
+	/* there is nothing sensible left to do if this fails */
+	if (write(slot_report_fd, &note, 1) != 1)
+		return;
+}
+
+/*
+ * Called in a worker process: every slot it takes or returns from now on is
+ * noted in fd, see feh_conversion_slot_reclaim.
+ */
+void feh_conversion_slot_report(int fd)
+{
+	slot_report_fd = fd;
+}
+
+/*
+ * Waits until a converter may be started or deadline (see
+ * feh_conversion_ms_left) has passed. Returns 0 if the deadline has passed
+ * or feh is about to exit.
+ */
+int feh_conversion_slot_get(struct timespec *deadline)
+{
+	struct pollfd pfd;
+	char token;
+	ssize_t n;
+	int timeout;
+
+	if (slot_fds[0] == -1)
+		return(1);
+
+	pfd.fd = slot_fds[0];
+	pfd.events = POLLIN;
+
+	/* other processes may snatch the byte between poll and read */
+	while ((n = read(slot_fds[0], &token, 1)) != 1) {
+		if ((n == -1) && (errno != EAGAIN) && (errno != EINTR))
+			return(0);
+		if (sig_exit || ((timeout = feh_conversion_ms_left(deadline)) == 0))
+			return(0);
+		if ((poll(&pfd, 1, timeout) == -1) && (errno != EINTR))
+			return(0);
+	}
+	slot_held = 1;
+	feh_conversion_slot_note('T');
+	return(1);
+}
+
+void feh_conversion_slot_put(void)
+{
+	char token = '+';
+
+	if (!slot_held)
+		return;
+	slot_held = 0;
+	if (write(slot_fds[1], &token, 1) != 1)
+		weprintf("unable to release conversion slot:");
+	feh_conversion_slot_note('R');
+}
+
+/*
+ * Called in the parent once the worker whose slot notes (see
+ * feh_conversion_slot_report) arrive on fd has exited with status. If it
+ * died while holding a slot, the slot is returned.
+ */
+void feh_conversion_slot_reclaim(int fd, int status)
+{
+	char notes[64], held = 0, token = '+';
+	ssize_t n;
+
+	while ((n = read(fd, notes, sizeof(notes))) > 0)
+		held = (notes[n - 1] == 'T');
+
+	if (!held || (WIFEXITED(status) && !WEXITSTATUS(status)))
+		return;
+	D(("worker died with a conversion slot, returning it\n"));
+	if (write(slot_fds[1], &token, 1) != 1)
+		weprintf("unable to release conversion slot:");
+}
+
+/*
+ * Kills the running converter (if any) and releases its slot. Only uses
+ * async-signal-safe functions, so that workers can call it when they are
+ * cancelled.
+ */
+void feh_conversion_abort(void)
+{
+	char token = '+';
+
+	if (childpid > 0)
+		killpg(childpid, SIGKILL);
+	if (slot_held) {
+		slot_held = 0;
+		/* there is nothing sensible left to do if this fails */
+		if (write(slot_fds[1], &token, 1) != 1)
+			return;
+		feh_conversion_slot_note('R');
+	}
+}
@@ -630,7 +630,7 @@ static void feh_event_handle_MotionNotify(XEvent * ev)
 
 			if ((winwid->im_x != orig_x)
 					|| (winwid->im_y != orig_y))
-				winwidget_render_image(winwid, 0, 1);
+				winwidget_render_image_pan(winwid);
 		}
 	} else if (opt.mode == MODE_ROTATE) {
 		while (XCheckTypedWindowEvent(disp, ev->xmotion.window, MotionNotify, ev));
@@ -80,6 +80,13 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #define SLIDESHOW_RELOAD_MAX 4096
 
+/* Imlib2 1.8.0 and later can decode images from memory */
+#ifdef IMLIB2_VERSION
+#if IMLIB2_VERSION >= IMLIB2_VERSION_(1, 8, 0)
+#define HAVE_IMLIB_LOAD_MEM
+#endif
+#endif
+
 #ifndef TRUE
 #define FALSE	0
 #define TRUE	!FALSE
@@ -123,6 +130,13 @@ enum feh_load_error {
 	LOAD_ERROR_MAGICBYTES
 };
 
+/* receives an image one row at a time, e.g. from feh_pnm_decode_rows */
+struct feh_row_sink {
+	/* called before the first row, decoding is aborted if it returns 0 */
+	int (*start)(struct feh_row_sink *sink, int w, int h, int has_alpha);
+	void (*row)(struct feh_row_sink *sink, int y, DATA32 *pixels);
+};
+
 #define INPLACE_EDIT_FLIP   -1
 #define INPLACE_EDIT_MIRROR -2
 
@@ -148,6 +162,43 @@ void init_unloadables_mode(void);
 void feh_clean_exit(void);
 int feh_should_ignore_image(Imlib_Image * im);
 int feh_load_image(Imlib_Image * im, feh_file * file);
+Imlib_Image feh_imlib_load(char *filename, struct feh_mapped_file *mf,
+		Imlib_Load_Error * err);
+char *feh_conversion_cache_get(char *filename, char *converter);
+char *feh_conversion_cache_add(char *filename, char *converter,
+		unsigned char *data, size_t len);
+unsigned char *feh_conversion_mem_get(char *filename, size_t *len);
+void feh_conversion_mem_add(char *filename, unsigned char *data, size_t len);
+void feh_conversion_mem_forget(char *filename);
+Imlib_Image feh_pnm_load_mem(unsigned char *data, size_t len);
+size_t feh_pnm_size(unsigned char *data, size_t len);
+int feh_pnm_decode_rows(unsigned char *data, size_t len, struct feh_row_sink *sink);
+int feh_tile_cache_load(feh_file * file, struct feh_mapped_file *mf, Imlib_Image * im);
+void feh_tile_cache_free(struct feh_tile_cache *tiles);
+void feh_tile_cache_detach(feh_file * file);
+void feh_tile_cache_release(feh_file * file);
+void feh_tile_cache_disable(void);
+void feh_pyramid_reduce(DATA32 *dst, int dst_stride, int dst_x, int dst_y,
+		DATA32 *src, int src_stride, int w, int h);
+void feh_conversion_pool_init(void);
+int feh_conversion_ms_left(struct timespec *deadline);
+int feh_conversion_slot_get(struct timespec *deadline);
+void feh_conversion_slot_put(void);
+void feh_conversion_slot_report(int fd);
+void feh_conversion_slot_reclaim(int fd, int status);
+void feh_conversion_abort(void);
+int feh_load_image_scaled(Imlib_Image * im, feh_file * file, int w, int h,
+		int *orig_w, int *orig_h);
+#ifdef HAVE_LIBJPEG
+Imlib_Image feh_jpeg_load_scaled(char *filename, int min_w, int min_h,
+		int *orig_w, int *orig_h);
+Imlib_Image feh_jpeg_load_embedded(FILE * fp, long offset, int min_w, int min_h);
+Imlib_Image feh_jpeg_load_mem(unsigned char *data, size_t len);
+Imlib_Image feh_preview_load(char *filename, int w, int h,
+		int *orig_w, int *orig_h, int *orientation);
+Imlib_Image feh_preview_load_largest(char *filename,
+		struct feh_mapped_file *mf, int *orientation);
+#endif
 void show_mini_usage(void);
 void slideshow_change_image(winwidget winwid, int change, int render);
 void slideshow_pause_toggle(winwidget w);
@@ -165,6 +216,8 @@ char *feh_printf(char *str, feh_file * file, winwidget winwid);
 void im_weprintf(winwidget w, char *fmt, ...);
 void feh_draw_zoom(winwidget w);
 void feh_draw_checks(winwidget win);
+void feh_render_image_part(Drawable d, Imlib_Image im, int sx, int sy,
+		int sw, int sh, int dx, int dy, int dw, int dh, int blend, int alias);
 void cb_slide_timer(void *data);
 void cb_reload_timer(void *data);
 int feh_load_image_char(Imlib_Image * im, char *filename);
@@ -187,6 +240,10 @@ void feh_edit_inplace_lossless(winwidget w, int orientation);
 gib_list *feh_wrap_string(char *text, int wrap_width, Imlib_Font fn, gib_style * style);
 char *build_caption_filename(feh_file * file, short create_dir);
 gib_list *feh_list_jump(gib_list * root, gib_list * l, int direction, int num);
+void slideshow_prefetch(gib_list * current);
+int slideshow_prefetch_take(Imlib_Image * im, feh_file * file);
+void slideshow_prefetch_forget(feh_file * file);
+void slideshow_prefetch_clear(void);
 #ifdef HAVE_INOTIFY
 void feh_event_handle_inotify(void);
 #endif
@@ -218,7 +275,7 @@ extern feh_menu *menu_main;
 extern feh_menu *menu_close;
 extern char *mode;		/* label for the current mode */
 
-/* to terminate long-running children with SIGALRM */
+/* process group of the running converter, to terminate it on exit */
 extern int childpid;
 
 extern unsigned char control_via_stdin;
@@ -33,40 +33,30 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define FEH_PNG_COMPRESSION 3
 #define FEH_PNG_NUM_COMMENTS 4
 
-gib_hash *feh_png_read_comments(char *file)
+static gib_hash *feh_png_read_comments_fp(FILE * fp)
 {
-	FILE *fp;
 	int i, sig_bytes, comments = 0;
 
 	png_structp png_ptr;
 	png_infop info_ptr;
 	png_textp text_ptr;
 
-	if (!(fp = fopen(file, "rb")))
-		return NULL;
-
-	if (!(sig_bytes = feh_png_file_is_png(fp))) {
-		fclose(fp);
+	if (!(sig_bytes = feh_png_file_is_png(fp)))
 		return NULL;
-	}
 
 	/* initialize data structures */
 	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if (!png_ptr) {
-		fclose(fp);
+	if (!png_ptr)
 		return NULL;
-	}
 
 	info_ptr = png_create_info_struct(png_ptr);
 	if (!info_ptr) {
 		png_destroy_read_struct(&png_ptr, (png_infopp) NULL, (png_infopp) NULL);
-		fclose(fp);
 		return NULL;
 	}
 
 	if (setjmp(png_jmpbuf(png_ptr))) {
 		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		fclose(fp);
 		return NULL;
 	}
 
@@ -81,18 +71,102 @@ gib_hash *feh_png_read_comments(char *file)
 #ifdef PNG_TEXT_SUPPORTED
 	png_get_text(png_ptr, info_ptr, &text_ptr, &comments);
 	if (comments > 0) {
-		hash = gib_hash_new();
+		hash = gib_hash_new_nocase();
 		for (i = 0; i < comments; i++)
 			gib_hash_set(hash, text_ptr[i].key, estrdup(text_ptr[i].text));
 	}
 #endif				/* PNG_TEXT_SUPPORTED */
 
 	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-	fclose(fp);
 
 	return hash;
 }
 
+/* Reads the text chunks of a PNG file held in memory */
+gib_hash *feh_png_read_comments_mem(unsigned char *data, size_t len)
+{
+	gib_hash *hash;
+	FILE *fp;
+
+	if (!(fp = fmemopen(data, len, "rb")))
+		return NULL;
+	hash = feh_png_read_comments_fp(fp);
+	fclose(fp);
+	return hash;
+}
+
+/*
+ * Decodes the PNG image in fp and hands it to sink one row at a time, so
+ * that no more than a single row needs to be held in memory. Interlaced
+ * images cannot be decoded this way. Returns 1 on success.
+ */
+int feh_png_decode_rows(FILE * fp, struct feh_row_sink *sink)
+{
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_uint_32 w, h, y;
+	int sig_bytes, bit_depth, color_type, interlace, has_alpha;
+	DATA32 *volatile row = NULL;
+
+	if (!(sig_bytes = feh_png_file_is_png(fp)))
+		return 0;
+
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png_ptr)
+		return 0;
+
+	info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr) {
+		png_destroy_read_struct(&png_ptr, (png_infopp) NULL, (png_infopp) NULL);
+		return 0;
+	}
+
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		free(row);
+		return 0;
+	}
+
+	png_init_io(png_ptr, fp);
+	png_set_sig_bytes(png_ptr, sig_bytes);
+	png_read_info(png_ptr, info_ptr);
+	png_get_IHDR(png_ptr, info_ptr, &w, &h, &bit_depth, &color_type,
+			&interlace, NULL, NULL);
+
+	has_alpha = (color_type & PNG_COLOR_MASK_ALPHA)
+		|| png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS);
+
+	if ((interlace != PNG_INTERLACE_NONE)
+			|| !sink->start(sink, w, h, has_alpha)) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return 0;
+	}
+
+	/* whatever the input, produce 8 bit ARGB */
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	if (!(color_type & PNG_COLOR_MASK_COLOR))
+		png_set_gray_to_rgb(png_ptr);
+#ifdef WORDS_BIGENDIAN
+	png_set_swap_alpha(png_ptr);
+	png_set_filler(png_ptr, 0xff, PNG_FILLER_BEFORE);
+#else				/* !WORDS_BIGENDIAN */
+	png_set_bgr(png_ptr);
+	png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
+#endif				/* WORDS_BIGENDIAN */
+	png_read_update_info(png_ptr, info_ptr);
+
+	row = emalloc(w * sizeof(DATA32));
+	for (y = 0; y < h; y++) {
+		png_read_row(png_ptr, (png_bytep) row, NULL);
+		sink->row(sink, y, row);
+	}
+
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	free(row);
+	return 1;
+}
+
 /* grab image data from image and write info file with comments ... */
 int feh_png_write_png_fd(Imlib_Image image, int fd, ...)
 {
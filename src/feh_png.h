@@ -31,9 +31,10 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "feh.h"
 
-gib_hash *feh_png_read_comments(char *file);
+gib_hash *feh_png_read_comments_mem(unsigned char *data, size_t len);
 int feh_png_write_png_fd(Imlib_Image image, int fd, ...);
 
 int feh_png_file_is_png(FILE * fp);
+int feh_png_decode_rows(FILE * fp, struct feh_row_sink *sink);
 
 #endif				/* FEH_PNG_H */
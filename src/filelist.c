@@ -28,6 +28,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "filelist.h"
 #include "signals.h"
 #include "options.h"
+#include "worker.h"
+#include <stdint.h>
 
 #ifdef HAVE_LIBCURL
 #include <curl/curl.h>
@@ -41,6 +43,50 @@ extern int errno;
 
 static gib_list *rm_filelist = NULL;
 
+/*
+ * Position index of filelist: filelist_index[i] is its i-th node, and each
+ * file remembers its own position in list_pos. This makes length queries,
+ * "N of M" and jumps to arbitrary positions O(1) instead of walking the
+ * list. It is rebuilt on demand after the list has been reordered (see
+ * feh_filelist_changed) and updated in place when files are removed.
+ */
+static gib_list **filelist_index = NULL;
+static int filelist_index_size = 0;
+static int filelist_index_valid = 0;
+
+/*
+ * With --reload, directory listings are remembered so that a reload only
+ * needs to read the directories whose inode, mtime or ctime changed since.
+ * dir_cache holds the scans of the current generation, dir_cache_old those
+ * of the previous one while a reload is in progress.
+ */
+enum feh_entry_kind { ENTRY_NONE, ENTRY_FILE, ENTRY_DIR };
+
+struct feh_dir_entry {
+	char *name;
+	unsigned char kind;
+};
+
+struct feh_dir_scan {
+	ino_t ino;
+	time_t mtime;
+	time_t ctime;
+	int count;
+	struct feh_dir_entry *entries;
+};
+
+static gib_hash *dir_cache = NULL;
+static gib_hash *dir_cache_old = NULL;
+
+/*
+ * While reloading: filename -> node of the previous filelist for all files
+ * which have not been found again (yet), and the files which are new.
+ */
+static gib_hash *reload_index = NULL;
+static gib_list *reload_added = NULL;
+
+static int feh_filelist_add_path(char *origpath, unsigned char level);
+
 feh_file *feh_file_new(char *filename)
 {
 	feh_file *newfile;
@@ -55,6 +101,10 @@ feh_file *feh_file_new(char *filename)
 	else
 		newfile->name = estrdup(filename);
 	newfile->info = NULL;
+	newfile->data = NULL;
+	newfile->data_len = 0;
+	newfile->tiles = NULL;
+	newfile->list_pos = -1;
 #ifdef HAVE_LIBEXIF
 	newfile->ed = NULL;
 #endif
@@ -65,6 +115,8 @@ void feh_file_free(feh_file * file)
 {
 	if (!file)
 		return;
+	slideshow_prefetch_forget(file);
+	feh_stream_forget(file);
 	if (file->filename)
 		free(file->filename);
 	if (file->name)
@@ -73,6 +125,10 @@ void feh_file_free(feh_file * file)
 		free(file->caption);
 	if (file->info)
 		feh_file_info_free(file->info);
+	if (file->data)
+		free(file->data);
+	if (file->tiles)
+		feh_tile_cache_free(file->tiles);
 #ifdef HAVE_LIBEXIF
 	if (file->ed)
 		exif_data_unref(file->ed);
@@ -113,18 +169,94 @@ void feh_file_info_free(feh_file_info * info)
 
 gib_list *feh_file_rm_and_free(gib_list * list, gib_list * l)
 {
-	unlink(FEH_FILE(l->data)->filename);
+	/* the filename of memory-backed files (stdin) is not theirs to remove */
+	if (!FEH_FILE(l->data)->data)
+		unlink(FEH_FILE(l->data)->filename);
 	return(feh_file_remove_from_list(list, l));
 }
 
 gib_list *feh_file_remove_from_list(gib_list * list, gib_list * l)
 {
+	int pos, i;
+
+	if (filelist_index_valid && (list == filelist)
+			&& ((pos = feh_filelist_num(l)) != -1)) {
+		memmove(filelist_index + pos, filelist_index + pos + 1,
+				(filelist_len - pos - 1) * sizeof(gib_list *));
+		for (i = pos; i < filelist_len - 1; i++)
+			FEH_FILE(filelist_index[i]->data)->list_pos = i;
+	} else
+		filelist_index_valid = 0;
+
 	feh_file_free(FEH_FILE(l->data));
 	D(("filelist_len %d -> %d\n", filelist_len, filelist_len - 1));
 	filelist_len--;
 	return(gib_list_remove(list, l));
 }
 
+static void feh_filelist_index(void)
+{
+	gib_list *l;
+	int i = 0;
+
+	/* adding to the front of the list is common enough to catch it here */
+	if (filelist_index_valid
+			&& (filelist_len ? (filelist_index[0] == filelist) : !filelist))
+		return;
+
+	for (l = filelist; l; l = l->next, i++) {
+		if (i == filelist_index_size) {
+			filelist_index_size = filelist_index_size ? filelist_index_size * 2 : 1024;
+			filelist_index = erealloc(filelist_index,
+					filelist_index_size * sizeof(gib_list *));
+		}
+		filelist_index[i] = l;
+		FEH_FILE(l->data)->list_pos = i;
+	}
+	filelist_len = i;
+	filelist_index_valid = 1;
+}
+
+/*
+ * Must be called after filelist has been reordered or had files added, and
+ * updates filelist_len. Removing files with feh_file_remove_from_list takes
+ * care of itself.
+ */
+void feh_filelist_changed(void)
+{
+	filelist_index_valid = 0;
+	feh_filelist_index();
+}
+
+int feh_filelist_length(void)
+{
+	feh_filelist_index();
+	return(filelist_len);
+}
+
+/* Returns the position of l in filelist, or -1 if it is not part of it */
+int feh_filelist_num(gib_list * l)
+{
+	int pos;
+
+	if (!l || !l->data)
+		return(-1);
+	feh_filelist_index();
+	pos = FEH_FILE(l->data)->list_pos;
+	if ((pos < 0) || (pos >= filelist_len) || (filelist_index[pos] != l))
+		return(-1);
+	return(pos);
+}
+
+/* Returns the n-th node of filelist, or NULL if there is none */
+gib_list *feh_filelist_nth(int n)
+{
+	feh_filelist_index();
+	if ((n < 0) || (n >= filelist_len))
+		return(NULL);
+	return(filelist_index[n]);
+}
+
 int file_selector_all(const struct dirent *unused __attribute__((unused)))
 {
   return 1;
@@ -156,50 +288,174 @@ static void feh_print_stat_error(char *path)
 	}
 }
 
+/*
+ * Images read from stdin are decoded straight from memory, so they do not
+ * need a temporary file.
+ */
 static void add_stdin_to_filelist()
 {
-	char buf[1024];
-	size_t readsize;
-	char *sfn = estrjoin("_", "/tmp/feh_stdin", "XXXXXX", NULL);
-	int fd = mkstemp(sfn);
-	FILE *outfile;
+	feh_file *file;
+	unsigned char *data;
+	size_t len;
+
+	if (opt.stdin_stream) {
+		if ((file = feh_stream_open()))
+			filelist = gib_list_add_front(filelist, file);
+		return;
+	}
 
-	if (fd == -1) {
-		free(sfn);
-		weprintf("cannot read from stdin: mktemp:");
+	if (!(data = feh_read_fd(STDIN_FILENO, &len))) {
+		weprintf("cannot read from stdin:");
 		return;
 	}
 
-	outfile = fdopen(fd, "w");
+	file = feh_file_new("/dev/stdin");
+	file->data = data;
+	file->data_len = len;
+	filelist = gib_list_add_front(filelist, file);
+}
+
+
+/*
+ * Returns the feh_file for filename. While the filelist is being reloaded,
+ * this is the file's entry in the previous list (if any), so its file info
+ * survives the reload.
+ */
+static feh_file *feh_filelist_file(char *filename)
+{
+	gib_list *l;
+
+	if (reload_index && (l = gib_hash_get(reload_index, filename))) {
+		gib_hash_remove(reload_index, filename);
+		return(FEH_FILE(l->data));
+	}
+	if (!reload_index)
+		return(feh_file_new(filename));
+	reload_added = gib_list_add_front(reload_added, feh_file_new(filename));
+	return(FEH_FILE(reload_added->data));
+}
+
+/*
+ * Adds the files found by an earlier scan of the directory path, provided
+ * that it has not been modified since. Returns 1 on success.
+ */
+static int feh_filelist_add_cached_dir(char *path, struct stat *st)
+{
+	struct feh_dir_scan *scan;
+	char *newfile;
+	int i;
+
+	if (!dir_cache)
+		return(0);
+	if (!(scan = gib_hash_get(dir_cache, path)) && dir_cache_old)
+		scan = gib_hash_get(dir_cache_old, path);
+	if (!scan || (scan->ino != st->st_ino) || (scan->mtime != st->st_mtime)
+			|| (scan->ctime != st->st_ctime))
+		return(0);
+	if (!gib_hash_get(dir_cache, path)) {
+		gib_hash_remove(dir_cache_old, path);
+		gib_hash_set(dir_cache, path, scan);
+	}
+
+	D(("Directory %s is unchanged\n", path));
+	for (i = 0; i < scan->count; i++) {
+		newfile = estrjoin("", path, "/", scan->entries[i].name, NULL);
+		if (scan->entries[i].kind == ENTRY_FILE)
+			filelist = gib_list_add_front(filelist, feh_filelist_file(newfile));
+		else if (opt.recursive)
+			feh_filelist_add_path(newfile, FILELIST_CONTINUE);
+		free(newfile);
+	}
+	return(1);
+}
 
-	if (outfile == NULL) {
-		free(sfn);
-		weprintf("cannot read from stdin: fdopen:");
+static void feh_filelist_add_dir(char *path, struct stat *st)
+{
+	struct feh_dir_scan *scan = NULL;
+	struct dirent **de;
+	DIR *dir;
+	char *names = NULL;
+	size_t size;
+	int cnt, n, kind;
+
+	if ((dir = opendir(path)) == NULL) {
+		if (!opt.quiet)
+			weprintf("couldn't open directory %s:", path);
+		return;
+	}
+	n = scandir(path, &de, file_selector_all, alphasort);
+	if (n < 0) {
+		switch (errno) {
+		case ENOMEM:
+			weprintf("Insufficient memory to scan directory %s:", path);
+			break;
+		default:
+			weprintf("Failed to scan directory %s:", path);
+		}
+		closedir(dir);
 		return;
 	}
 
-	while ((readsize = fread(buf, sizeof(char), sizeof(buf), stdin)) > 0) {
-		if (fwrite(buf, sizeof(char), readsize, outfile) < readsize) {
-			free(sfn);
-			return;
+	/*
+	 * Only remember directories which were last changed a while ago, as
+	 * another change within the same second would go unnoticed otherwise.
+	 * The scan is a single allocation, so gib_hash_free_and_data can
+	 * dispose of it.
+	 */
+	if (dir_cache && !gib_hash_get(dir_cache, path)
+			&& (st->st_ctime < time(NULL) - 1)) {
+		size = sizeof(struct feh_dir_scan) + n * sizeof(struct feh_dir_entry);
+		for (cnt = 0; cnt < n; cnt++)
+			size += strlen(de[cnt]->d_name) + 1;
+		scan = emalloc(size);
+		scan->ino = st->st_ino;
+		scan->mtime = st->st_mtime;
+		scan->ctime = st->st_ctime;
+		scan->count = 0;
+		scan->entries = (struct feh_dir_entry *)(scan + 1);
+		names = (char *)(scan->entries + n);
+	}
+
+	for (cnt = 0; cnt < n; cnt++) {
+		if (strcmp(de[cnt]->d_name, ".")
+				&& strcmp(de[cnt]->d_name, "..")) {
+			char *newfile;
+
+			newfile = estrjoin("", path, "/", de[cnt]->d_name, NULL);
+
+			/* This ensures we go down one level even if not fully recursive
+			   - this way "feh some_dir" expands to some_dir's contents */
+			if (opt.recursive)
+				kind = feh_filelist_add_path(newfile, FILELIST_CONTINUE);
+			else
+				kind = feh_filelist_add_path(newfile, FILELIST_LAST);
+
+			if (scan && (kind != ENTRY_NONE)) {
+				scan->entries[scan->count].name = names;
+				scan->entries[scan->count++].kind = kind;
+				strcpy(names, de[cnt]->d_name);
+				names += strlen(names) + 1;
+			}
+			free(newfile);
 		}
+		free(de[cnt]);
 	}
-	fclose(outfile);
+	free(de);
+	closedir(dir);
 
-	filelist = gib_list_add_front(filelist, feh_file_new(sfn));
-	add_file_to_rm_filelist(sfn);
-	free(sfn);
+	if (scan)
+		gib_hash_set(dir_cache, path, scan);
 }
 
-
-/* Recursive */
-void add_file_to_filelist_recursively(char *origpath, unsigned char level)
+/* Recursive. Returns what kind of file origpath turned out to be. */
+static int feh_filelist_add_path(char *origpath, unsigned char level)
 {
 	struct stat st;
 	char *path;
+	int kind = ENTRY_NONE;
 
 	if (!origpath || *origpath == '\0')
-		return;
+		return(ENTRY_NONE);
 
 	path = estrdup(origpath);
 	D(("file is %s\n", path));
@@ -214,15 +470,20 @@ void add_file_to_filelist_recursively(char *origpath, unsigned char level)
 
 		if (path_is_url(path)) {
 			D(("Adding url %s to filelist\n", path));
-			filelist = gib_list_add_front(filelist, feh_file_new(path));
+			filelist = gib_list_add_front(filelist, feh_filelist_file(path));
 			/* We'll download it later... */
 			free(path);
-			return;
+			return(ENTRY_NONE);
 		} else if ((len == 1) && (path[0] == '-')) {
-			D(("Adding temporary file for stdin (-) to filelist\n"));
-			add_stdin_to_filelist();
+			D(("Adding stdin (-) to filelist\n"));
+			/* stdin has been consumed already, keep what we got from it */
+			if (!reload_index)
+				add_stdin_to_filelist();
+			else if (gib_hash_get(reload_index, "/dev/stdin"))
+				filelist = gib_list_add_front(filelist,
+						feh_filelist_file("/dev/stdin"));
 			free(path);
-			return;
+			return(ENTRY_NONE);
 		} else if (opt.filelistfile) {
 			char *newpath = feh_absolute_path(path);
 
@@ -235,58 +496,28 @@ void add_file_to_filelist_recursively(char *origpath, unsigned char level)
 	if (stat(path, &st)) {
 		feh_print_stat_error(path);
 		free(path);
-		return;
+		return(ENTRY_NONE);
 	}
 
-	if ((S_ISDIR(st.st_mode)) && (level != FILELIST_LAST)) {
-		struct dirent **de;
-		DIR *dir;
-		int cnt, n;
-
+	if (S_ISDIR(st.st_mode)) {
 		D(("It is a directory\n"));
-
-		if ((dir = opendir(path)) == NULL) {
-			if (!opt.quiet)
-				weprintf("couldn't open directory %s:", path);
-			free(path);
-			return;
-		}
-		n = scandir(path, &de, file_selector_all, alphasort);
-		if (n < 0) {
-			switch (errno) {
-			case ENOMEM:
-				weprintf("Insufficient memory to scan directory %s:", path);
-				break;
-			default:
-				weprintf("Failed to scan directory %s:", path);
-			}
-		} else {
-			for (cnt = 0; cnt < n; cnt++) {
-				if (strcmp(de[cnt]->d_name, ".")
-						&& strcmp(de[cnt]->d_name, "..")) {
-					char *newfile;
-
-					newfile = estrjoin("", path, "/", de[cnt]->d_name, NULL);
-
-					/* This ensures we go down one level even if not fully recursive
-					   - this way "feh some_dir" expands to some_dir's contents */
-					if (opt.recursive)
-						add_file_to_filelist_recursively(newfile, FILELIST_CONTINUE);
-					else
-						add_file_to_filelist_recursively(newfile, FILELIST_LAST);
-
-					free(newfile);
-				}
-				free(de[cnt]);
-			}
-			free(de);
-		}
-		closedir(dir);
+		kind = ENTRY_DIR;
+		if ((level != FILELIST_LAST) && !feh_filelist_add_cached_dir(path, &st))
+			feh_filelist_add_dir(path, &st);
 	} else if (S_ISREG(st.st_mode)) {
 		D(("Adding regular file %s to filelist\n", path));
-		filelist = gib_list_add_front(filelist, feh_file_new(path));
+		kind = ENTRY_FILE;
+		filelist = gib_list_add_front(filelist, feh_filelist_file(path));
 	}
 	free(path);
+	return(kind);
+}
+
+void add_file_to_filelist_recursively(char *origpath, unsigned char level)
+{
+	if (!dir_cache && (opt.reload > 0))
+		dir_cache = gib_hash_new();
+	feh_filelist_add_path(origpath, level);
 	return;
 }
 
@@ -305,16 +536,41 @@ void delete_rm_files(void)
 	return;
 }
 
+static int feh_file_info_preload_job(feh_file * file,
+		Imlib_Image * im __attribute__((unused)),
+		int *orig_w __attribute__((unused)), int *orig_h __attribute__((unused)))
+{
+	return(feh_file_info_load(file, NULL) == 0);
+}
+
 gib_list *feh_file_info_preload(gib_list * list)
 {
 	gib_list *l;
 	feh_file *file = NULL;
 	gib_list *remove_list = NULL;
+	feh_job_queue queue;
+	feh_job *job;
+	int loaded, batch;
+
+	/*
+	 * With --jobs, file infos are loaded by worker processes, each of which
+	 * handles a run of consecutive files. Results are still evaluated in
+	 * list order, so status output and filtering stay the same.
+	 */
+	batch = gib_list_length(list) / (feh_job_count() * 4);
+	if (batch > 64)
+		batch = 64;
 
-	for (l = list; l; l = l->next) {
+	feh_job_queue_init(&queue, list, feh_file_info_preload_job, batch);
+	while ((job = feh_job_queue_next(&queue))) {
+		l = job->node;
 		file = FEH_FILE(l->data);
+		loaded = (job->state == JOB_DONE) && file->info;
+		feh_job_free(job);
+		if (loaded)
+			feh_info_cache_add(file);
 		D(("file %p, file->next %p, file->name %s\n", l, l->next, file->name));
-		if (feh_file_info_load(file, NULL)) {
+		if (!loaded) {
 			D(("Failed to load file %p\n", file));
 			remove_list = gib_list_add_front(remove_list, l);
 			if (opt.verbose)
@@ -329,6 +585,7 @@ gib_list *feh_file_info_preload(gib_list * list)
 		} else if (opt.verbose)
 			feh_display_status('.');
 		if (sig_exit) {
+			feh_job_queue_cancel(&queue);
 			feh_display_status(0);
 			exit(sig_exit);
 		}
@@ -336,10 +593,12 @@ gib_list *feh_file_info_preload(gib_list * list)
 	if (opt.verbose)
 		feh_display_status(0);
 
+	feh_info_cache_save();
+
 	if (remove_list) {
 		for (l = remove_list; l; l = l->next) {
 			feh_file_free(FEH_FILE(((gib_list *) l->data)->data));
-			filelist = list = gib_list_remove(list, (gib_list *) l->data);
+			list = gib_list_remove(list, (gib_list *) l->data);
 		}
 
 		gib_list_free(remove_list);
@@ -348,6 +607,33 @@ gib_list *feh_file_info_preload(gib_list * list)
 	return(list);
 }
 
+#ifdef HAVE_LIBEXIF
+/*
+ * feh_load_image rotates images according to their EXIF orientation when
+ * --auto-rotate is set, so probed dimensions have to follow suit.
+ */
+static void feh_file_info_apply_orientation(feh_file * file)
+{
+	ExifData *ed = exif_data_new_from_file(file->filename);
+	ExifEntry *entry;
+	int orientation = 0, tmp;
+
+	if (!ed)
+		return;
+
+	if ((entry = exif_data_get_entry(ed, EXIF_TAG_ORIENTATION)))
+		orientation = exif_get_short(entry->data, exif_data_get_byte_order(ed));
+	exif_data_unref(ed);
+
+	if (orientation >= 5 && orientation <= 8) {
+		tmp = file->info->width;
+		file->info->width = file->info->height;
+		file->info->height = tmp;
+	}
+	return;
+}
+#endif
+
 int feh_file_info_load(feh_file * file, Imlib_Image im)
 {
 	struct stat st;
@@ -360,11 +646,35 @@ int feh_file_info_load(feh_file * file, Imlib_Image im)
 		need_free = 0;
 
 	errno = 0;
-	if (stat(file->filename, &st)) {
+	if (file->data) {
+		memset(&st, 0, sizeof(st));
+		st.st_size = file->data_len;
+	} else if (stat(file->filename, &st)) {
 		feh_print_stat_error(file->filename);
 		return(1);
 	}
 
+	if (!im && !file->data && feh_info_cache_lookup(file, &st))
+		return(0);
+
+	if (!im && !file->data) {
+		/*
+		 * Most formats carry all we need in their header, so there is no
+		 * need to decode the entire image.
+		 */
+		file->info = feh_file_info_new();
+		if (feh_file_info_probe(file, file->info)) {
+			file->info->size = st.st_size;
+#ifdef HAVE_LIBEXIF
+			if (opt.auto_rotate)
+				feh_file_info_apply_orientation(file);
+#endif
+			return(0);
+		}
+		feh_file_info_free(file->info);
+		file->info = NULL;
+	}
+
 	if (im)
 		im1 = im;
 	else if (!feh_load_image(&im1, file) || !im1)
@@ -379,12 +689,22 @@ int feh_file_info_load(feh_file * file, Imlib_Image im)
 
 	file->info->pixels = file->info->width * file->info->height;
 
-	file->info->format = estrdup(gib_imlib_image_format(im1));
+	/*
+	 * Imlib2 1.6 renamed its JPEG format from "jpeg" to "jpg". Stick to
+	 * the new name, so that the format does not depend on the Imlib2
+	 * version or on whether feh_file_info_probe filled in the info.
+	 */
+	if (!strcmp(gib_imlib_image_format(im1), "jpeg"))
+		file->info->format = estrdup("jpg");
+	else
+		file->info->format = estrdup(gib_imlib_image_format(im1));
 
 	file->info->size = st.st_size;
 
-	if (need_free)
+	if (need_free) {
 		gib_imlib_free_image_and_decache(im1);
+		feh_tile_cache_release(file);
+	}
 	return(0);
 }
 
@@ -475,19 +795,53 @@ int feh_cmp_format(void *file1, void *file2)
 	return(strcmp(FEH_FILE(file1)->info->format, FEH_FILE(file2)->info->format));
 }
 
+/*
+ * list and customlist mode as well as the somewhat more fancy sort modes
+ * need access to file infos. Preloading them is also useful for
+ * list/customlist as --min-dimension/--max-dimension may filter images
+ * which should not be processed.
+ * Finally, if --min-dimension/--max-dimension (-> opt.filter_by_dimensions)
+ * is set and we're in thumbnail mode, we need to filter images first so
+ * we can create a properly sized thumbnail list.
+ */
+static int feh_filelist_needs_preload(void)
+{
+	return(opt.list || opt.preload || opt.customlist || (opt.sort > SORT_MTIME)
+			|| (opt.filter_by_dimensions && (opt.index || opt.thumbs || opt.bgmode)));
+}
+
+/* Returns the comparison function for opt.sort, or NULL for SORT_NONE */
+static gib_compare_fn *feh_filelist_cmp(void)
+{
+	switch (opt.sort) {
+	case SORT_NAME:
+		return(feh_cmp_name);
+	case SORT_FILENAME:
+		return(feh_cmp_filename);
+	case SORT_DIRNAME:
+		return(feh_cmp_dirname);
+	case SORT_MTIME:
+		return(feh_cmp_mtime);
+	case SORT_WIDTH:
+		return(feh_cmp_width);
+	case SORT_HEIGHT:
+		return(feh_cmp_height);
+	case SORT_PIXELS:
+		return(feh_cmp_pixels);
+	case SORT_SIZE:
+		return(feh_cmp_size);
+	case SORT_FORMAT:
+		return(feh_cmp_format);
+	default:
+		return(NULL);
+	}
+}
+
 void feh_prepare_filelist(void)
 {
-	/*
-	 * list and customlist mode as well as the somewhat more fancy sort modes
-	 * need access to file infos. Preloading them is also useful for
-	 * list/customlist as --min-dimension/--max-dimension may filter images
-	 * which should not be processed.
-	 * Finally, if --min-dimension/--max-dimension (-> opt.filter_by_dimensions)
-	 * is set and we're in thumbnail mode, we need to filter images first so
-	 * we can create a properly sized thumbnail list.
-	 */
-	if (opt.list || opt.preload || opt.customlist || (opt.sort > SORT_MTIME)
-			|| (opt.filter_by_dimensions && (opt.index || opt.thumbs || opt.bgmode))) {
+	gib_compare_fn *cmp;
+
+	if (feh_filelist_needs_preload()) {
 		/* For these sort options, we have to preload images */
 		filelist = feh_file_info_preload(filelist);
 		if (!gib_list_length(filelist))
@@ -495,8 +849,7 @@ void feh_prepare_filelist(void)
 	}
 
 	D(("sort mode requested is: %d\n", opt.sort));
-	switch (opt.sort) {
-	case SORT_NONE:
+	if (opt.sort == SORT_NONE) {
 		if (opt.randomize) {
 			/* Randomize the filename order */
 			filelist = gib_list_randomize(filelist);
@@ -504,37 +857,8 @@ void feh_prepare_filelist(void)
 			/* Let's reverse the list. Its back-to-front right now ;) */
 			filelist = gib_list_reverse(filelist);
 		}
-		break;
-	case SORT_NAME:
-		filelist = gib_list_sort(filelist, feh_cmp_name);
-		break;
-	case SORT_FILENAME:
-		filelist = gib_list_sort(filelist, feh_cmp_filename);
-		break;
-	case SORT_DIRNAME:
-		filelist = gib_list_sort(filelist, feh_cmp_dirname);
-		break;
-	case SORT_MTIME:
-		filelist = gib_list_sort(filelist, feh_cmp_mtime);
-		break;
-	case SORT_WIDTH:
-		filelist = gib_list_sort(filelist, feh_cmp_width);
-		break;
-	case SORT_HEIGHT:
-		filelist = gib_list_sort(filelist, feh_cmp_height);
-		break;
-	case SORT_PIXELS:
-		filelist = gib_list_sort(filelist, feh_cmp_pixels);
-		break;
-	case SORT_SIZE:
-		filelist = gib_list_sort(filelist, feh_cmp_size);
-		break;
-	case SORT_FORMAT:
-		filelist = gib_list_sort(filelist, feh_cmp_format);
-		break;
-	default:
-		break;
-	}
+	} else if ((cmp = feh_filelist_cmp()))
+		filelist = gib_list_sort(filelist, cmp);
 
 	/* no point reversing a random list */
 	if (opt.reverse && (opt.sort != SORT_NONE)) {
@@ -542,9 +866,202 @@ void feh_prepare_filelist(void)
 		filelist = gib_list_reverse(filelist);
 	}
 
+	feh_filelist_changed();
 	return;
 }
 
+static void feh_filelist_append_node(gib_list ** head, gib_list ** tail, gib_list * l)
+{
+	l->prev = *tail;
+	l->next = NULL;
+	if (*tail)
+		(*tail)->next = l;
+	else
+		*head = l;
+	*tail = l;
+}
+
+/*
+ * Merges added into list, both of which are in the order established by
+ * feh_prepare_filelist. Insert positions are found by binary search, so
+ * cmp is called O(k log n) rather than O(n) times -- feh_cmp_mtime stat()s
+ * both of its files.
+ */
+static gib_list *feh_filelist_merge(gib_list * list, gib_list * added, gib_compare_fn * cmp)
+{
+	gib_list **nodes, *l, *next, *head = NULL, *tail = NULL;
+	int n, i, lo, hi, mid, c;
+
+	if (!list || !added)
+		return(list ? list : added);
+
+	n = gib_list_length(list);
+	nodes = emalloc(n * sizeof(gib_list *));
+	for (l = list, i = 0; l; l = l->next)
+		nodes[i++] = l;
+
+	for (l = added, i = 0; l; l = next) {
+		next = l->next;
+		lo = i;
+		hi = n;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			c = cmp(l->data, nodes[mid]->data);
+			if (opt.reverse ? (c > 0) : (c < 0))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		while (i < lo)
+			feh_filelist_append_node(&head, &tail, nodes[i++]);
+		feh_filelist_append_node(&head, &tail, l);
+	}
+	while (i < n)
+		feh_filelist_append_node(&head, &tail, nodes[i++]);
+
+	free(nodes);
+	return(head);
+}
+
+static int feh_filelist_cmp_ptr(const void *a, const void *b)
+{
+	uintptr_t pa = (uintptr_t) *(void * const *)a, pb = (uintptr_t) *(void * const *)b;
+
+	return((pa > pb) - (pa < pb));
+}
+
+/* Files from the previous filelist which were not found again */
+static int feh_filelist_vanished(gib_list * l)
+{
+	return(gib_hash_get(reload_index, FEH_FILE(l->data)->filename) == l);
+}
+
+/*
+ * Rebuilds filelist from original_file_items and the filelist file for
+ * --reload. Files which are still there keep their feh_file and thus their
+ * file info, and unchanged directories are not read again (see dir_cache).
+ * Only new files are preloaded, and they are merged into the existing order
+ * instead of sorting everything again.
+ * Returns the node to display instead of current: current itself or, if it
+ * has vanished, one of its neighbours.
+ */
+gib_list *feh_reload_filelist(gib_list * current)
+{
+	gib_list *old = filelist, *l, *next, *twin;
+	feh_file *keep = NULL, **added = NULL, **dropped = NULL;
+	gib_compare_fn *cmp;
+	int added_count = 0, dropped_count = 0, i;
+
+	/* remember the previous filelist; there is no use in keeping duplicates */
+	reload_index = gib_hash_new();
+	for (l = old; l; l = next) {
+		next = l->next;
+		if ((twin = gib_hash_get(reload_index, FEH_FILE(l->data)->filename))) {
+			if (current == l)
+				current = twin;
+			feh_file_free(FEH_FILE(l->data));
+			old = gib_list_remove(old, l);
+		} else
+			gib_hash_set(reload_index, FEH_FILE(l->data)->filename, l);
+	}
+
+	dir_cache_old = dir_cache;
+	dir_cache = gib_hash_new();
+
+	filelist = NULL;
+	if (gib_list_length(original_file_items) > 0)
+		for (l = gib_list_last(original_file_items); l; l = l->prev)
+			feh_filelist_add_path(l->data, FILELIST_FIRST);
+	else if (!opt.filelistfile && !opt.bgmode)
+		feh_filelist_add_path(".", FILELIST_FIRST);
+
+	if (opt.filelistfile)
+		filelist = gib_list_cat(filelist, feh_read_filelist(opt.filelistfile));
+
+	if (dir_cache_old) {
+		gib_hash_free_and_data(dir_cache_old);
+		dir_cache_old = NULL;
+	}
+
+	l = current;
+	while (l && feh_filelist_vanished(l))
+		l = l->next;
+	if (!l) {
+		l = current;
+		while (l && feh_filelist_vanished(l))
+			l = l->prev;
+	}
+	if (l)
+		keep = FEH_FILE(l->data);
+
+	if (reload_added && feh_filelist_needs_preload()) {
+		added_count = gib_list_length(reload_added);
+		added = emalloc(added_count * sizeof(feh_file *));
+		for (l = reload_added, i = 0; l; l = l->next)
+			added[i++] = FEH_FILE(l->data);
+
+		reload_added = feh_file_info_preload(reload_added);
+
+		/* preloading frees the files it fails on or filters out */
+		dropped = emalloc(added_count * sizeof(feh_file *));
+		for (l = reload_added, i = 0; i < added_count; i++) {
+			if (l && (l->data == added[i]))
+				l = l->next;
+			else
+				dropped[dropped_count++] = added[i];
+		}
+		qsort(dropped, dropped_count, sizeof(feh_file *), feh_filelist_cmp_ptr);
+		free(added);
+	}
+
+	if ((opt.sort == SORT_NONE) && !opt.randomize) {
+		/* keep the order in which the files were found */
+		for (l = filelist; dropped_count && l; l = next) {
+			next = l->next;
+			if (bsearch(&l->data, dropped, dropped_count, sizeof(feh_file *),
+						feh_filelist_cmp_ptr))
+				filelist = gib_list_remove(filelist, l);
+		}
+		if (!opt.reverse)
+			filelist = gib_list_reverse(filelist);
+		for (l = old; l; l = l->next)
+			if (feh_filelist_vanished(l))
+				feh_file_free(FEH_FILE(l->data));
+		gib_list_free(old);
+		gib_list_free(reload_added);
+	} else {
+		gib_list_free(filelist);
+		for (l = old; l; l = next) {
+			next = l->next;
+			if (feh_filelist_vanished(l)) {
+				feh_file_free(FEH_FILE(l->data));
+				old = gib_list_remove(old, l);
+			}
+		}
+		if ((cmp = feh_filelist_cmp())) {
+			reload_added = gib_list_sort(reload_added, cmp);
+			if (opt.reverse)
+				reload_added = gib_list_reverse(reload_added);
+			filelist = feh_filelist_merge(old, reload_added, cmp);
+		} else
+			filelist = gib_list_cat(old, gib_list_randomize(reload_added));
+	}
+
+	free(dropped);
+	gib_hash_free(reload_index);
+	reload_index = NULL;
+	reload_added = NULL;
+
+	feh_filelist_changed();
+	if (!feh_filelist_length())
+		eprintf("No files found to reload.");
+
+	for (l = filelist; keep && l; l = l->next)
+		if (l->data == keep)
+			return(l);
+	return(filelist);
+}
+
 int feh_write_filelist(gib_list * list, char *filename)
 {
 	FILE *fp;
@@ -618,7 +1135,7 @@ gib_list *feh_read_filelist(char *filename)
 			continue;
 		D(("Got filename %s from filelist file\n", s1));
 		/* Add it to the new list */
-		list = gib_list_add_front(list, feh_file_new(s1));
+		list = gib_list_add_front(list, feh_filelist_file(s1));
 	}
 	if (strcmp(filename, "/dev/stdin"))
 		fclose(fp);
@@ -35,6 +35,16 @@ struct __feh_file {
 	char *caption;
 	char *name;
 
+	/* contents of files without a name in the file system (stdin) */
+	unsigned char *data;
+	size_t data_len;
+
+	/* see tilecache.c, only set for --out-of-core images */
+	struct feh_tile_cache *tiles;
+
+	/* position in filelist, maintained by the filelist index */
+	int list_pos;
+
 	/* info stuff */
 	feh_file_info *info;	/* only set when needed */
 #ifdef HAVE_LIBEXIF
@@ -90,12 +100,23 @@ void add_file_to_rm_filelist(char *file);
 void delete_rm_files(void);
 gib_list *feh_file_info_preload(gib_list * list);
 int feh_file_info_load(feh_file * file, Imlib_Image im);
+int feh_file_info_probe(feh_file * file, feh_file_info * info);
+int feh_info_cache_lookup(feh_file * file, struct stat *st);
+void feh_info_cache_add(feh_file * file);
+void feh_info_cache_save(void);
+feh_file *feh_stream_open(void);
+void feh_stream_forget(feh_file * file);
 void feh_file_dirname(char *dst, feh_file * f, int maxlen);
 void feh_prepare_filelist(void);
+gib_list *feh_reload_filelist(gib_list * current);
 int feh_write_filelist(gib_list * list, char *filename);
 gib_list *feh_read_filelist(char *filename);
 char *feh_absolute_path(char *path);
 gib_list *feh_file_remove_from_list(gib_list * list, gib_list * l);
+void feh_filelist_changed(void);
+int feh_filelist_length(void);
+int feh_filelist_num(gib_list * l);
+gib_list *feh_filelist_nth(int n);
 void feh_save_filelist();
 char *feh_http_unescape(char * url);
 
@@ -22,128 +22,155 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 */
+#include <ctype.h>
 #include <strings.h>
 
 #include "gib_hash.h"
 #include "utils.h"
 #include "debug.h"
 
-gib_hash_node *gib_hash_node_new(char *key, void *data)
-{
-	gib_hash_node *node = emalloc(sizeof(gib_hash_node));
-	node->key = strdup(key);
-	GIB_LIST(node)->data = data;
-	GIB_LIST(node)->next = NULL;
-	GIB_LIST(node)->prev = NULL;
-	return node;
-
-}
+#define GIB_HASH_INITIAL_SIZE 16
 
-void           gib_hash_node_free(gib_hash_node *node)
+static gib_hash *gib_hash_alloc(unsigned char nocase)
 {
-	free(node->key);
-	free(node);
-	return;
+	gib_hash *hash = emalloc(sizeof(gib_hash));
+	hash->size = GIB_HASH_INITIAL_SIZE;
+	hash->count = 0;
+	hash->nocase = nocase;
+	hash->slots = emalloc(hash->size * sizeof(gib_hash_node));
+	memset(hash->slots, 0, hash->size * sizeof(gib_hash_node));
+	return hash;
 }
 
-void           gib_hash_node_free_and_data(gib_hash_node *node)
+/* keys are compared with strcmp */
+gib_hash *gib_hash_new()
 {
-	free(node->list.data);
-	gib_hash_node_free(node);
-	return;
+	return gib_hash_alloc(0);
 }
 
-gib_hash *gib_hash_new()
+/* keys are compared with strcasecmp */
+gib_hash *gib_hash_new_nocase()
 {
-	gib_hash *hash = emalloc(sizeof(gib_hash));
-	hash->base = gib_hash_node_new("__gib_hash_new",NULL);
-	return hash;
+	return gib_hash_alloc(1);
 }
 
 void      gib_hash_free(gib_hash *hash)
 {
-	/* free hash keys as it's not taken care of by gib_list_free */
-	gib_list *i;
-	for (i = GIB_LIST(hash->base); i; i = i->next)
-		free(GIB_HASH_NODE(i)->key);
+	unsigned int i;
 
-	gib_list_free(GIB_LIST(hash->base));
+	for (i = 0; i < hash->size; i++)
+		free(hash->slots[i].key);
+	free(hash->slots);
 	free(hash);
 	return;
 }
 
 void      gib_hash_free_and_data(gib_hash *hash)
 {
-	/* free hash keys as it's not taken care of by gib_list_free */
-	gib_list *i;
-	for (i = GIB_LIST(hash->base); i; i = i->next)
-		free(GIB_HASH_NODE(i)->key);
+	unsigned int i;
 
-	gib_list_free_and_data(GIB_LIST(hash->base));
-	free(hash);
+	for (i = 0; i < hash->size; i++)
+		if (hash->slots[i].key)
+			free(hash->slots[i].data);
+	gib_hash_free(hash);
 	return;
 }
 
-static unsigned char gib_hash_find_callback(gib_list *list, void *data)
+/* FNV-1a */
+static unsigned int gib_hash_string(gib_hash *hash, char *key)
 {
-	gib_hash_node *node = GIB_HASH_NODE(list);
-	char          *key  = (char*) data;
+	unsigned int h = 2166136261u;
+	unsigned char *p;
 
-	/* strncasecmp causes simliar keys like key1 and key11 clobber eachother */
-	return !strcasecmp(node->key, key);
+	for (p = (unsigned char *) key; *p; p++) {
+		h ^= hash->nocase ? (unsigned char) tolower(*p) : *p;
+		h *= 16777619u;
+	}
+	return h;
 }
 
-void      gib_hash_set(gib_hash *hash, char *key, void *data)
+/* returns the slot holding key, or the empty slot where it belongs */
+static gib_hash_node *gib_hash_lookup(gib_hash *hash, char *key, unsigned int h)
 {
-	gib_list *l;
+	unsigned int mask = hash->size - 1;
+	unsigned int i = h & mask;
 	gib_hash_node *n;
 
-	n = GIB_HASH_NODE(gib_list_find(GIB_LIST(hash->base),
-	                                gib_hash_find_callback,
-	                                key));
-	if (n)	{
-		GIB_LIST(n)->data = data;
-	} else {
-		/* not using gib_list_add_end here as that would nest the
-			 data one level, doing manual insert instead */
-		n = gib_hash_node_new(key,data);
-		l = gib_list_last(GIB_LIST(hash->base));
-
-		GIB_LIST(n)->next = NULL;
-		GIB_LIST(n)->prev = l;
-
-		if (l)
-			l->next = GIB_LIST(n);
+	for (;; i = (i + 1) & mask) {
+		n = &hash->slots[i];
+		if (!n->key)
+			return n;
+		/* strncasecmp causes simliar keys like key1 and key11 clobber eachother */
+		if ((n->hash == h) && !(hash->nocase ? strcasecmp(n->key, key)
+					: strcmp(n->key, key)))
+			return n;
 	}
 }
 
-void     *gib_hash_get(gib_hash *hash, char *key)
+static void gib_hash_grow(gib_hash *hash)
 {
-	gib_list *n = gib_list_find(GIB_LIST(hash->base),gib_hash_find_callback,key);
-	return n?n->data:NULL;
+	gib_hash_node *old = hash->slots, *n;
+	unsigned int old_size = hash->size, i;
+
+	hash->size *= 2;
+	hash->slots = emalloc(hash->size * sizeof(gib_hash_node));
+	memset(hash->slots, 0, hash->size * sizeof(gib_hash_node));
+
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].key)
+			continue;
+		n = gib_hash_lookup(hash, old[i].key, old[i].hash);
+		*n = old[i];
+	}
+	free(old);
 }
 
-/* unused
-
-void      gib_hash_remove(gib_hash *hash, char *key)
+void      gib_hash_set(gib_hash *hash, char *key, void *data)
 {
-	gib_list *n = gib_list_find(GIB_LIST(hash->base), gib_hash_find_callback, key);
-	if (n) {
-		gib_list_unlink(GIB_LIST(hash->base), n);
-    gib_hash_node_free(GIB_HASH_NODE(n->data));
-  }
+	unsigned int h = gib_hash_string(hash, key);
+	gib_hash_node *n = gib_hash_lookup(hash, key, h);
 
-	return;
+	if (n->key) {
+		n->data = data;
+		return;
+	}
+
+	n->key = estrdup(key);
+	n->hash = h;
+	n->data = data;
+
+	if (++hash->count * 2 > hash->size)
+		gib_hash_grow(hash);
 }
 
-void      gib_hash_foreach(gib_hash *hash, void (*foreach_cb)(gib_hash_node *node, void *data), void *data)
+void     *gib_hash_get(gib_hash *hash, char *key)
 {
-	gib_hash_node *i, *next;
-	for (i=hash->base; i; i=next) {
-		next = GIB_HASH_NODE(GIB_LIST(i)->next);
-		foreach_cb(i,data);
-	}
-	return;
+	gib_hash_node *n = gib_hash_lookup(hash, key, gib_hash_string(hash, key));
+	return n->key ? n->data : NULL;
 }
 
-*/
+void      gib_hash_remove(gib_hash *hash, char *key)
+{
+	unsigned int mask = hash->size - 1, i, j, home;
+	gib_hash_node *n = gib_hash_lookup(hash, key, gib_hash_string(hash, key));
+
+	if (!n->key)
+		return;
+	free(n->key);
+	hash->count--;
+
+	/*
+	 * No tombstones: move later entries of the same run into the hole
+	 * unless that would put them before their home slot.
+	 */
+	i = n - hash->slots;
+	for (j = (i + 1) & mask; hash->slots[j].key; j = (j + 1) & mask) {
+		home = hash->slots[j].hash & mask;
+		if ((i < j) ? ((home > i) && (home <= j)) : ((home > i) || (home <= j)))
+			continue;
+		hash->slots[i] = hash->slots[j];
+		i = j;
+	}
+	hash->slots[i].key = NULL;
+	hash->slots[i].data = NULL;
+}
@@ -27,23 +27,28 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef GIB_HASH_H
 #define GIB_HASH_H
 
-#include "gib_list.h"
-
 #define GIB_HASH(a) ((gib_hash*)a)
-#define GIB_HASH_NODE(a) ((gib_hash_node*)a)
 
 typedef struct __gib_hash      gib_hash;
 typedef struct __gib_hash_node gib_hash_node;
 
+/*
+ * Open addressing with linear probing. The number of slots is a power of
+ * two and at least twice the number of keys.
+ */
 struct __gib_hash
 {
-	gib_hash_node *base;
+	gib_hash_node *slots;
+	unsigned int   size;
+	unsigned int   count;
+	unsigned char  nocase;
 };
 
 struct __gib_hash_node
 {
-   gib_list  list;
-   char     *key;
+   char         *key;		/* NULL for an empty slot */
+   unsigned int  hash;
+   void         *data;
 };
 
 #ifdef __cplusplus
@@ -51,23 +56,15 @@ extern "C"
 {
 #endif
 
-gib_hash_node *gib_hash_node_new(char *key, void *data);
-void           gib_hash_node_free(gib_hash_node *node);
-void           gib_hash_node_free_and_data(gib_hash_node *node);
-
 gib_hash *gib_hash_new();
+gib_hash *gib_hash_new_nocase();
 void      gib_hash_free(gib_hash *hash);
 void      gib_hash_free_and_data(gib_hash *hash);
 
 void      gib_hash_set(gib_hash *hash, char *key, void *data);
 void     *gib_hash_get(gib_hash *hash, char *key);
-
-/* unused
 void      gib_hash_remove(gib_hash *hash, char *key);
 
-void      gib_hash_foreach(gib_hash *hash, void (*foreach_cb)(gib_hash_node *node, void *data), void *data);
-*/
-
 #ifdef __cplusplus
 }
 #endif
@@ -29,8 +29,13 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "signals.h"
 #include "winwidget.h"
 #include "options.h"
+#include "loop.h"
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <time.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -66,8 +71,11 @@ int childpid = 0;
 
 static int feh_file_is_raw(char *filename);
 static char *feh_http_load_image(char *url);
-static char *feh_dcraw_load_image(char *filename);
-static char *feh_magick_load_image(char *filename);
+static Imlib_Image feh_dcraw_load_image(feh_file * file);
+static Imlib_Image feh_magick_load_image(feh_file * file);
+static Imlib_Image feh_load_image_data(feh_file * file, unsigned char *data,
+		size_t len, char *path);
+static char *feh_conversion_save(char *filename, unsigned char *data, size_t len);
 
 #ifdef HAVE_LIBXINERAMA
 void init_xinerama(void)
@@ -246,110 +254,284 @@ void feh_print_load_error(char *file, winwidget w, Imlib_Load_Error err, enum fe
  * Note that this drops support for bz2-compressed files, unless
  * FEH_SKIP_MAGIC is set
  */
-int feh_is_image(feh_file * file)
+/*
+ * What the first few bytes of a file say about it. A file may have several
+ * of these properties, e.g. CR2 files are TIFF-based.
+ */
+#define MAGIC_IMLIB     0x01	/* Imlib2 may be able to load it */
+#define MAGIC_RAW       0x02	/* camera RAW file, dcraw can handle it */
+#define MAGIC_MAYBE_RAW 0x04	/* TIFF, which many RAW formats are based on */
+#define MAGIC_NO_IMAGE  0x08	/* not an image, don't try converting it */
+
+/*
+ * Returns 1 if filename has the extension of a sidecar file (text notes,
+ * XMP metadata, RawTherapee profiles) which is never an image.
+ */
+static int feh_magic_is_sidecar(char *filename)
 {
-	unsigned char buf[16];
-	FILE *fh = fopen(file->filename, "r");
-	if (!fh) {
+	static const char *sidecars[] = { "txt", "xmp", "pp3", NULL };
+	char *ext = strrchr(filename, '.');
+	int i;
+
+	if (!ext || strchr(ext, '/'))
 		return 0;
-	}
+	for (i = 0; sidecars[i]; i++)
+		if (!strcasecmp(ext + 1, sidecars[i]))
+			return 1;
+	return 0;
+}
+
+/*
+ * Determines the magic of filename based on its first len bytes (data).
+ */
+static int feh_file_magic_data(char *filename, unsigned char *data, size_t len)
+{
+	unsigned char buf[16];
+
 	// Files smaller than buf will be padded with zeroes
 	memset(buf, 0, sizeof(buf));
-	if (fread(buf, 1, 16, fh) <= 0) {
-		fclose(fh);
-		return 0;
+	if (len == 0) {
+		// empty file
+		return MAGIC_NO_IMAGE;
 	}
-	fclose(fh);
+	memcpy(buf, data, (len < sizeof(buf)) ? len : sizeof(buf));
 
 	if (buf[0] == 0xff && buf[1] == 0xd8) {
 		// JPEG
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (!memcmp(buf, "\x89PNG\x0d\x0a\x1a\x0a", 8)) {
 		// PNG
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (buf[0] == 'A' && buf[1] == 'R' && buf[2] == 'G' && buf[3] == 'B') {
 		// ARGB
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (buf[0] == 'B' && buf[1] == 'M') {
 		// BMP
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (!memcmp(buf, "farbfeld", 8)) {
 		// farbfeld
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (buf[0] == 'G' && buf[1] == 'I' && buf[2] == 'F') {
 		// GIF
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (buf[0] == 0x00 && buf[1] == 0x00 && buf[2] <= 0x02 && buf[3] == 0x00) {
 		// ICO
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (!memcmp(buf, "FORM", 4)) {
 		// Amiga IFF ILBM
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (buf[0] == 'P' && buf[1] >= '1' && buf[1] <= '7') {
 		// PNM et al.
-		return 1;
+		return MAGIC_IMLIB;
 	}
-	if (strstr(file->filename, ".tga")) {
+	if (strstr(filename, ".tga")) {
 		// TGA
-		return 1;
+		return MAGIC_IMLIB;
+	}
+	if (!memcmp(buf, "II\x2a\x00", 4) && buf[8] == 'C' && buf[9] == 'R') {
+		// Canon CR2
+		return MAGIC_IMLIB | MAGIC_RAW;
 	}
 	if (!memcmp(buf, "II\x2a\x00", 4) || !memcmp(buf, "MM\x00\x2a", 4)) {
-		// TIFF
-		return 1;
+		// TIFF, but also NEF, ARW, DNG, PEF and many other RAW formats
+		return MAGIC_IMLIB | MAGIC_MAYBE_RAW;
+	}
+	if (!memcmp(buf + 4, "ftypcrx ", 8)) {
+		// Canon CR3
+		return MAGIC_RAW;
+	}
+	if (!memcmp(buf, "FUJIFILMCCD-RAW", 15)) {
+		// Fujifilm RAF
+		return MAGIC_RAW;
+	}
+	if (!memcmp(buf, "IIRO", 4) || !memcmp(buf, "IIRS", 4) || !memcmp(buf, "MMOR", 4)) {
+		// Olympus ORF
+		return MAGIC_RAW;
+	}
+	if (!memcmp(buf, "IIU\x00", 4)) {
+		// Panasonic RW2
+		return MAGIC_RAW;
+	}
+	if (!memcmp(buf, "II\x1a\x00\x00\x00HEAPCCDR", 14)) {
+		// Canon CRW
+		return MAGIC_RAW;
+	}
+	if (!memcmp(buf, "\x00MRM", 4) || !memcmp(buf, "FOVb", 4) || !memcmp(buf, "IIII", 4)) {
+		// Minolta MRW, Sigma X3F, Phase One IIQ
+		return MAGIC_RAW;
 	}
 	if (!memcmp(buf, "RIFF", 4)) {
 		// might be webp
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if (!memcmp(buf + 4, "ftyphei", 7) || !memcmp(buf + 4, "ftypmif1", 8)) {
 		// HEIC/HEIF - note that this is only supported in imlib2-heic. Ordinary
 		// imlib2 releases do not support heic/heif images as of 2021-01.
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	if ((buf[0] == 0xff && buf[1] == 0x0a) || !memcmp(buf, "\x00\x00\x00\x0cJXL \x0d\x0a\x87\x0a", 12)) {
 		// JXL - note that this is only supported in imlib2-jxl. Ordinary
 		// imlib2 releases do not support JXL images as of 2021-06.
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	buf[15] = 0;
 	if (strstr((char *)buf, "XPM")) {
 		// XPM
-		return 1;
+		return MAGIC_IMLIB;
 	}
-	if (strstr(file->filename, ".bz2") || strstr(file->filename, ".gz")) {
+	if (strstr(filename, ".bz2") || strstr(filename, ".gz")) {
 		// Imlib2 supports compressed images. It relies on the filename to
 		// determine the appropriate loader and does not use magic bytes here.
-		return 1;
+		return MAGIC_IMLIB;
 	}
 	// moved to the end as this variable won't be set in most cases
 	if (getenv("FEH_SKIP_MAGIC")) {
-		return 1;
+		return MAGIC_IMLIB;
+	}
+	if (!memcmp(buf, "<?xpacket", 9) || !memcmp(buf, "<x:xmpmeta", 10)) {
+		// XMP sidecar files
+		return MAGIC_NO_IMAGE;
+	}
+	if (feh_magic_is_sidecar(filename)) {
+		// .txt, .xmp and .pp3 sidecar files
+		return MAGIC_NO_IMAGE;
+	}
+	if (!memcmp(buf, "\x7f" "ELF", 4) || !memcmp(buf, "#!", 2)
+			|| !memcmp(buf, "SQLite format 3", 15)
+			|| !memcmp(buf, "7z\xbc\xaf\x27\x1c", 6) || !memcmp(buf, "Rar!\x1a\x07", 6)) {
+		// executables, scripts, databases and archives
+		return MAGIC_NO_IMAGE;
+	}
+	if (!memcmp(buf, "ID3", 3) || !memcmp(buf, "OggS", 4) || !memcmp(buf, "fLaC", 4)
+			|| !memcmp(buf, "\x1a\x45\xdf\xa3", 4)) {
+		// MP3, Ogg, FLAC and Matroska media files
+		return MAGIC_NO_IMAGE;
 	}
 	return 0;
 }
 
+static int feh_file_magic(char *filename)
+{
+	unsigned char buf[16];
+	size_t len;
+	FILE *fh = fopen(filename, "r");
+	if (!fh) {
+		return 0;
+	}
+	len = fread(buf, 1, sizeof(buf), fh);
+	fclose(fh);
+	return feh_file_magic_data(filename, buf, len);
+}
+
+/*
+ * Loads filename with Imlib2. If mf is set, it holds the contents of
+ * filename, and Imlib2 decodes them from memory instead of opening the file
+ * once more (given that it is recent enough to support this).
+ */
+Imlib_Image feh_imlib_load(char *filename, struct feh_mapped_file *mf,
+		Imlib_Load_Error * err)
+{
+#ifdef HAVE_IMLIB_LOAD_MEM
+	Imlib_Image im;
+
+	if (mf) {
+		if ((im = imlib_load_image_mem(filename, mf->data, mf->size))) {
+			*err = IMLIB_LOAD_ERROR_NONE;
+			return im;
+		}
+		/*
+		 * The file exists and is readable, so it's most likely in a format
+		 * Imlib2 does not know.
+		 */
+		*err = IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT;
+		return NULL;
+	}
+#else
+	(void)mf;
+#endif
+	return imlib_load_image_with_error_return(filename, err);
+}
+
+#ifdef HAVE_LIBEXIF
+static void feh_image_orientate(Imlib_Image * im, int orientation)
+{
+	if (orientation == 2)
+		gib_imlib_image_flip_horizontal(*im);
+	else if (orientation == 3)
+		gib_imlib_image_orientate(*im, 2);
+	else if (orientation == 4)
+		gib_imlib_image_flip_vertical(*im);
+	else if (orientation == 5) {
+		gib_imlib_image_orientate(*im, 3);
+		gib_imlib_image_flip_vertical(*im);
+	}
+	else if (orientation == 6)
+		gib_imlib_image_orientate(*im, 1);
+	else if (orientation == 7) {
+		gib_imlib_image_orientate(*im, 3);
+		gib_imlib_image_flip_horizontal(*im);
+	}
+	else if (orientation == 8)
+		gib_imlib_image_orientate(*im, 3);
+}
+
+/*
+ * Applies the EXIF orientation of file (if --auto-rotate is set) to *im.
+ * Returns the orientation, which is 0 if the image was left alone.
+ */
+static int feh_image_auto_rotate(Imlib_Image * im, feh_file * file)
+{
+	int orientation = 0;
+	if (file->ed) {
+		ExifByteOrder byteOrder = exif_data_get_byte_order(file->ed);
+		ExifEntry *exifEntry = exif_data_get_entry(file->ed, EXIF_TAG_ORIENTATION);
+		if (exifEntry && opt.auto_rotate)
+			orientation = exif_get_short(exifEntry->data, byteOrder);
+	}
+
+	feh_image_orientate(im, orientation);
+	return(orientation);
+}
+#endif
+
 int feh_load_image(Imlib_Image * im, feh_file * file)
 {
 	Imlib_Load_Error err = IMLIB_LOAD_ERROR_NONE;
 	enum feh_load_error feh_err = LOAD_ERROR_IMLIB;
-	enum { SRC_IMLIB, SRC_HTTP, SRC_MAGICK, SRC_DCRAW } image_source = SRC_IMLIB;
+	enum { SRC_IMLIB, SRC_HTTP, SRC_MAGICK, SRC_DCRAW, SRC_PREVIEW, SRC_MEMORY } image_source = SRC_IMLIB;
 	char *tmpname = NULL;
 	char *real_filename = NULL;
+	char *stdin_copy = NULL;
+	int magic = 0, tiled;
+	struct feh_mapped_file mf, *mapped = NULL;
+#ifdef HAVE_LIBJPEG
+	int preview_orientation = 0;
+#endif
 
 	D(("filename is %s, image is %p\n", file->filename, im));
 
 	if (!file || !file->filename)
 		return 0;
 
-	if (path_is_url(file->filename)) {
+	if (file->data) {
+		image_source = SRC_MEMORY;
+		magic = feh_file_magic_data(file->filename, file->data, file->data_len);
+
+		if ((magic & MAGIC_NO_IMAGE) || !(*im = feh_load_image_data(file,
+						file->data, file->data_len, NULL))) {
+			feh_err = (magic & MAGIC_NO_IMAGE) ? LOAD_ERROR_MAGICBYTES : LOAD_ERROR_IMLIB;
+			err = IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT;
+		}
+	}
+	else if (path_is_url(file->filename)) {
 		image_source = SRC_HTTP;
 
 		if ((tmpname = feh_http_load_image(file->filename)) == NULL) {
@@ -358,31 +540,107 @@ int feh_load_image(Imlib_Image * im, feh_file * file)
 		}
 	}
 	else {
-		if (feh_is_image(file)) {
-			*im = imlib_load_image_with_error_return(file->filename, &err);
+		/*
+		 * Magic bytes, Imlib2 and libexif all read from the same buffer,
+		 * so the file is only opened once.
+		 */
+		if (feh_map_file(file->filename, &mf)) {
+			mapped = &mf;
+			magic = feh_file_magic_data(file->filename, mf.data, mf.size);
+		} else
+			magic = feh_file_magic(file->filename);
+		if (mapped && opt.out_of_core && (magic & MAGIC_IMLIB)
+				&& (tiled = feh_tile_cache_load(file, mapped, im))) {
+			feh_unmap_file(mapped);
+			/* prefetch workers leave these to the parent */
+			if (tiled < 0)
+				return(0);
+			if (!*im) {
+				feh_print_load_error(file->filename, NULL,
+						IMLIB_LOAD_ERROR_UNKNOWN, LOAD_ERROR_IMLIB);
+				return(0);
+			}
+			D(("Loaded tile cache preview\n"));
+			return(1);
+		}
+		if (magic & MAGIC_IMLIB) {
+			*im = feh_imlib_load(file->filename, mapped, &err);
 		} else {
 			feh_err = LOAD_ERROR_MAGICBYTES;
 			err = IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT;
 		}
 	}
 
-	if (opt.conversion_timeout >= 0 && (
+	/*
+	 * Converters can only read files, so images from stdin which need one
+	 * are the only ones that still get a temporary copy.
+	 */
+	if (opt.conversion_timeout >= 0 && !(magic & MAGIC_NO_IMAGE) && (
 			(err == IMLIB_LOAD_ERROR_UNKNOWN) ||
-			(err == IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT))) {
-		if (feh_file_is_raw(file->filename)) {
+			(err == IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT)) && (!file->data
+				|| (stdin_copy = feh_conversion_save(file->filename, file->data,
+						file->data_len)))) {
+		*im = NULL;
+		if (stdin_copy) {
+			real_filename = file->filename;
+			file->filename = stdin_copy;
+		}
+#ifdef HAVE_LIBJPEG
+		/*
+		 * Most RAW files are TIFF containers with an embedded JPEG preview.
+		 * Decoding it right here saves two dcraw invocations and a
+		 * temporary file.
+		 */
+		if ((magic & (MAGIC_RAW | MAGIC_MAYBE_RAW)) && (*im =
+					feh_preview_load_largest(file->filename, mapped,
+						&preview_orientation))) {
+			image_source = SRC_PREVIEW;
+			err = IMLIB_LOAD_ERROR_NONE;
+			feh_file_info_free(file->info);
+			feh_file_info_load(file, *im);
+		} else
+#endif
+		/*
+		 * Only plain TIFF files need to be checked with dcraw -i, all
+		 * other RAW formats have distinct magic bytes.
+		 */
+		if ((magic & MAGIC_RAW) || ((magic & MAGIC_MAYBE_RAW)
+					&& feh_file_is_raw(file->filename))) {
 			image_source = SRC_DCRAW;
-			tmpname = feh_dcraw_load_image(file->filename);
-			if (!tmpname) {
+			if ((*im = feh_dcraw_load_image(file)) == NULL) {
 				feh_err = LOAD_ERROR_DCRAW;
 			}
-		} else {
+		}
+		/*
+		 * Anything else goes to ImageMagick. So do RAW files dcraw failed
+		 * on, as ImageMagick may have its own RAW support (e.g. libraw).
+		 */
+		if (!*im) {
 			image_source = SRC_MAGICK;
-			feh_err = LOAD_ERROR_IMLIB;
-			tmpname = feh_magick_load_image(file->filename);
-			if (!tmpname) {
+			if ((*im = feh_magick_load_image(file)) == NULL) {
 				feh_err = LOAD_ERROR_IMAGEMAGICK;
 			}
 		}
+
+		/*
+		 * Converted images never touch the file system, so file_info is
+		 * taken from the decoded image. To avoid a memory leak when loading
+		 * a non-native file multiple times in a slideshow, the file_info
+		 * struct is freed first. If file->info is not set,
+		 * feh_file_info_free is a no-op.
+		 */
+		if (*im && (image_source != SRC_PREVIEW)) {
+			err = IMLIB_LOAD_ERROR_NONE;
+			feh_file_info_free(file->info);
+			feh_file_info_load(file, *im);
+		}
+
+		if (stdin_copy) {
+			unlink(stdin_copy);
+			free(stdin_copy);
+			file->filename = real_filename;
+			real_filename = NULL;
+		}
 	}
 
 	if (tmpname) {
@@ -424,7 +682,8 @@ int feh_load_image(Imlib_Image * im, feh_file * file)
 
 		if (!opt.use_conversion_cache)
 			free(tmpname);
-	} else if (im) {
+	} else if (im && (image_source != SRC_DCRAW) && (image_source != SRC_MAGICK)
+			&& (image_source != SRC_MEMORY)) {
 #ifdef HAVE_LIBEXIF
 		/*
 			* if we're called from within feh_reload_image, file->ed is already
@@ -433,10 +692,16 @@ int feh_load_image(Imlib_Image * im, feh_file * file)
 		if (file->ed) {
 			exif_data_unref(file->ed);
 		}
-		file->ed = exif_data_new_from_file(file->filename);
+		if (mapped && mf.size <= UINT_MAX)
+			file->ed = exif_data_new_from_data(mf.data, mf.size);
+		else
+			file->ed = exif_data_new_from_file(file->filename);
 #endif
 	}
 
+	if (mapped)
+		feh_unmap_file(mapped);
+
 	if ((err) || (!im)) {
 		if (opt.verbose && !opt.quiet) {
 			fputs("\n", stderr);
@@ -458,35 +723,72 @@ int feh_load_image(Imlib_Image * im, feh_file * file)
 	imlib_image_set_changes_on_disk();
 
 #ifdef HAVE_LIBEXIF
-	int orientation = 0;
-	if (file->ed) {
-		ExifByteOrder byteOrder = exif_data_get_byte_order(file->ed);
-		ExifEntry *exifEntry = exif_data_get_entry(file->ed, EXIF_TAG_ORIENTATION);
-		if (exifEntry && opt.auto_rotate)
-			orientation = exif_get_short(exifEntry->data, byteOrder);
-	}
+#ifdef HAVE_LIBJPEG
+	/* libexif does not understand RAW files, so fall back to our own parser */
+	if (!feh_image_auto_rotate(im, file) && opt.auto_rotate
+			&& (image_source == SRC_PREVIEW))
+		feh_image_orientate(im, preview_orientation);
+#else
+	feh_image_auto_rotate(im, file);
+#endif
+#endif
 
-	if (orientation == 2)
-		gib_imlib_image_flip_horizontal(*im);
-	else if (orientation == 3)
-		gib_imlib_image_orientate(*im, 2);
-	else if (orientation == 4)
-		gib_imlib_image_flip_vertical(*im);
-	else if (orientation == 5) {
-		gib_imlib_image_orientate(*im, 3);
-		gib_imlib_image_flip_vertical(*im);
+	D(("Loaded ok\n"));
+	return(1);
+}
+
+/*
+ * Like feh_load_image, but the resulting image only needs to be at least
+ * w x h pixels large (in either orientation). This allows for much faster
+ * decoding of large JPEG files when creating thumbnails. orig_w and orig_h
+ * are set to the dimensions of the image at its full size.
+ */
+int feh_load_image_scaled(Imlib_Image * im, feh_file * file,
+		int w __attribute__((unused)), int h __attribute__((unused)),
+		int *orig_w, int *orig_h)
+{
+#ifdef HAVE_LIBJPEG
+	int orientation = 0, tmp;
+	int local = file && file->filename && !path_is_url(file->filename)
+		&& !file->data;
+
+	if (local && opt.embedded_thumbnails
+			&& (*im = feh_preview_load(file->filename, w, h, orig_w, orig_h,
+					&orientation))) {
+#ifdef HAVE_LIBEXIF
+		if (opt.auto_rotate)
+			feh_image_orientate(im, orientation);
+		else
+			orientation = 0;
+#endif
+	} else if (local
+			&& (*im = feh_jpeg_load_scaled(file->filename, w, h, orig_w, orig_h))) {
+#ifdef HAVE_LIBEXIF
+		if (file->ed)
+			exif_data_unref(file->ed);
+		file->ed = exif_data_new_from_file(file->filename);
+		orientation = feh_image_auto_rotate(im, file);
+#endif
 	}
-	else if (orientation == 6)
-		gib_imlib_image_orientate(*im, 1);
-	else if (orientation == 7) {
-		gib_imlib_image_orientate(*im, 3);
-		gib_imlib_image_flip_horizontal(*im);
+
+	if (local && *im) {
+#ifndef HAVE_LIBEXIF
+		orientation = 0;
+#endif
+		if (orientation >= 5 && orientation <= 8) {
+			tmp = *orig_w;
+			*orig_w = *orig_h;
+			*orig_h = tmp;
+		}
+		return(1);
 	}
-	else if (orientation == 8)
-		gib_imlib_image_orientate(*im, 3);
 #endif
-
-	D(("Loaded ok\n"));
+	if (!feh_load_image(im, file))
+		return(0);
+	/* *im is the tile cache's preview at most, the cache itself is not needed */
+	feh_tile_cache_release(file);
+	*orig_w = gib_imlib_image_get_width(*im);
+	*orig_h = gib_imlib_image_get_height(*im);
 	return(1);
 }
 
@@ -532,6 +834,7 @@ void feh_reload_image(winwidget w, int resize, int force_new)
 		free(sfn);
 		gib_hash_set(conversion_cache, FEH_FILE(w->file->data)->filename, NULL);
 	}
+	feh_conversion_mem_forget(FEH_FILE(w->file->data)->filename);
 
 	if ((feh_load_image(&tmp, FEH_FILE(w->file->data))) == 0) {
 		if (force_new)
@@ -585,6 +888,7 @@ static int feh_file_is_raw(char *filename)
 		int devnull = open("/dev/null", O_WRONLY);
 		dup2(devnull, 1);
 		dup2(devnull, 2);
+		feh_loop_child_sigmask();
 		execlp("dcraw", "dcraw", "-i", filename, NULL);
 		_exit(1);
 	} else {
@@ -600,19 +904,15 @@ static int feh_file_is_raw(char *filename)
 	return 0;
 }
 
-static char *feh_dcraw_load_image(char *filename)
+/*
+ * Creates an empty temporary file for the conversion result of filename.
+ * Returns its name (free it please) and stores its descriptor in fd.
+ */
+static char *feh_conversion_tmpfile(char *filename, int *fd)
 {
 	char *basename;
 	char *tmpname;
 	char *sfn;
-	int fd = -1;
-
-	if (opt.use_conversion_cache) {
-		if (!conversion_cache)
-			conversion_cache = gib_hash_new();
-		if ((sfn = gib_hash_get(conversion_cache, filename)) != NULL)
-			return sfn;
-	}
 
 	basename = strrchr(filename, '/');
 
@@ -629,91 +929,105 @@ static char *feh_dcraw_load_image(char *filename)
 	sfn = estrjoin("_", tmpname, "XXXXXX", NULL);
 	free(tmpname);
 
-	fd = mkstemp(sfn);
-
-	if (fd == -1) {
+	if ((*fd = mkstemp(sfn)) == -1) {
 		free(sfn);
 		return NULL;
 	}
+	return sfn;
+}
 
-	childpid = fork();
-	if (childpid == -1) {
-		weprintf("%s: Can't load with dcraw. Fork failed:", filename);
-		unlink(sfn);
-		free(sfn);
-		close(fd);
+/*
+ * Writes len bytes of converter output to a new temporary file and returns
+ * its name (free it please), or NULL on failure.
+ */
+static char *feh_conversion_save(char *filename, unsigned char *data, size_t len)
+{
+	char *sfn;
+	size_t done = 0;
+	ssize_t written;
+	int fd;
+
+	if ((sfn = feh_conversion_tmpfile(filename, &fd)) == NULL)
 		return NULL;
-	} else if (childpid == 0) {
-		dup2(fd, STDOUT_FILENO);
-		close(fd);
 
-		alarm(opt.conversion_timeout);
-		execlp("dcraw", "dcraw", "-c", "-e", filename, NULL);
-		_exit(1);
-	}
+	while (done < len && (written = write(fd, data + done, len - done)) > 0)
+		done += written;
 
-	int status;
-	waitpid(-1, &status, 0);
-	if (WIFSIGNALED(status)) {
+	if (close(fd) || done < len) {
+		weprintf("%s: Cannot write temporary file %s:", filename, sfn);
 		unlink(sfn);
 		free(sfn);
-		sfn = NULL;
-		if (!opt.quiet)
-			weprintf("%s - Conversion took too long, skipping", filename);
+		return NULL;
 	}
-
-	if ((sfn != NULL) && opt.use_conversion_cache)
-		gib_hash_set(conversion_cache, filename, sfn);
-
 	return sfn;
 }
 
-static char *feh_magick_load_image(char *filename)
+/*
+ * Removes the temporary ImageMagick directory created by feh_conversion_run.
+ */
+static void feh_magick_remove_tempdir(char *filename, char *tempdir)
 {
-	char *argv_fn;
-	char *basename;
-	char *tmpname;
-	char *sfn;
+	DIR *dir;
+	struct dirent *de;
+	if ((dir = opendir(tempdir)) == NULL) {
+		weprintf("%s: Cannot remove temporary ImageMagick files from %s:", filename, tempdir);
+	} else {
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] != '.') {
+				char *temporary_file_name = estrjoin("/", tempdir, de->d_name, NULL);
+				/*
+				 * We assume that ImageMagick only creates temporary files and
+				 * not directories.
+				 */
+				if (unlink(temporary_file_name) == -1) {
+					weprintf("unlink %s:", temporary_file_name);
+				}
+				free(temporary_file_name);
+			}
+		}
+		if (rmdir(tempdir) == -1) {
+			weprintf("rmdir %s:", tempdir);
+		}
+		closedir(dir);
+	}
+}
+
+/*
+ * Runs the converter argv on filename and collects everything it writes to
+ * its standard output in a malloc()ed buffer. Returns NULL if the converter
+ * fails or runs into --conversion-timeout; otherwise, *len is set to the
+ * size of its output.
+ */
+static unsigned char *feh_conversion_run(char *filename, char *argv[],
+		int magick, size_t *len)
+{
+	unsigned char *data = NULL;
+	size_t size = 0, used = 0;
+	ssize_t got;
 	char tempdir[] = "/tmp/.feh-magick-tmp-XXXXXX";
-	int fd = -1, devnull = -1;
-	int status;
+	struct timespec deadline = { 0, 0 };
+	struct pollfd pfd;
+	int pipefd[2], devnull = -1;
+	int status = -1, timed_out = 0, timeout, ready;
 	char created_tempdir = 0;
 
-	if (opt.use_conversion_cache) {
-		if (!conversion_cache)
-			conversion_cache = gib_hash_new();
-		if ((sfn = gib_hash_get(conversion_cache, filename)) != NULL)
-			return sfn;
+	/* waiting for a conversion slot counts towards the timeout, too */
+	if (opt.conversion_timeout > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += opt.conversion_timeout;
 	}
 
-	basename = strrchr(filename, '/');
-
-	if (basename == NULL)
-		basename = filename;
-	else
-		basename++;
-
-	tmpname = feh_unique_filename("/tmp/", basename);
-
-	if (strlen(tmpname) > (NAME_MAX-6))
-		tmpname[NAME_MAX-7] = '\0';
-
-	sfn = estrjoin("_", tmpname, "XXXXXX", NULL);
-	free(tmpname);
-
-	fd = mkstemp(sfn);
-
-	if (fd == -1) {
-		free(sfn);
+	if (!feh_conversion_slot_get(&deadline)) {
+		if (!sig_exit && !opt.quiet)
+			weprintf("%s: Conversion took too long, skipping", filename);
 		return NULL;
 	}
 
-	/*
-	 * We could use png:fd:(whatever mkstemp returned) as target filename
-	 * for convert, but this seems to be broken in some ImageMagick versions.
-	 * So we resort to png:(sfn) instead.
-	 */
-	argv_fn = estrjoin(":", "png", sfn, NULL);
+	if (pipe(pipefd) == -1) {
+		weprintf("%s: Can't run %s. pipe failed:", filename, argv[0]);
+		feh_conversion_slot_put();
+		return NULL;
+	}
 
 	/*
 	 * By default, ImageMagick saves (occasionally lots of) temporary files
@@ -723,7 +1037,7 @@ static char *feh_magick_load_image(char *filename)
 	 * temporary directory for ImageMagick and remove its contents at the end of
 	 * this function.
 	 */
-	if (getenv("MAGICK_TMPDIR") == NULL) {
+	if (magick && getenv("MAGICK_TMPDIR") == NULL) {
 		if (mkdtemp(tempdir) == NULL) {
 			weprintf("%s: ImageMagick may leave temporary files in /tmp. mkdtemp failed:", filename);
 		} else {
@@ -732,18 +1046,20 @@ static char *feh_magick_load_image(char *filename)
 	}
 
 	if ((childpid = fork()) < 0) {
-		weprintf("%s: Can't load with imagemagick. Fork failed:", filename);
-		unlink(sfn);
-		free(sfn);
-		sfn = NULL;
+		weprintf("%s: Can't load with %s. Fork failed:", filename, argv[0]);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		childpid = 0;
 	}
 	else if (childpid == 0) {
+		close(pipefd[0]);
+		dup2(pipefd[1], STDOUT_FILENO);
+		close(pipefd[1]);
 
 		devnull = open("/dev/null", O_WRONLY);
 		dup2(devnull, 0);
 		if (opt.quiet) {
-			/* discard convert output */
-			dup2(devnull, 1);
+			/* discard converter messages */
 			dup2(devnull, 2);
 		}
 
@@ -757,58 +1073,245 @@ static char *feh_magick_load_image(char *filename)
 			setenv("MAGICK_TMPDIR", tempdir, 0);
 		}
 
-		execlp("convert", "convert", filename, argv_fn, NULL);
+		feh_loop_child_sigmask();
+		execvp(argv[0], argv);
 		_exit(1);
 	}
 	else {
-		alarm(opt.conversion_timeout);
-		waitpid(childpid, &status, 0);
-		kill(childpid, SIGKILL);
-		if (opt.conversion_timeout > 0 && !alarm(0)) {
-			unlink(sfn);
-			free(sfn);
-			sfn = NULL;
+		/* avoid racing against the child's setpgid call */
+		setpgid(childpid, childpid);
+		close(pipefd[1]);
+
+		pfd.fd = pipefd[0];
+		pfd.events = POLLIN;
+
+		/*
+		 * Once the deadline has passed, the converter gets one more second
+		 * to exit on SIGINT before it is killed for good.
+		 */
+		for (;;) {
+			if ((timeout = feh_conversion_ms_left(&deadline)) == 0) {
+				if (timed_out) {
+					killpg(childpid, SIGKILL);
+					break;
+				}
+				timed_out = 1;
+				killpg(childpid, SIGINT);
+				deadline.tv_sec++;
+				continue;
+			}
+			if ((ready = poll(&pfd, 1, timeout)) == 0
+					|| (ready == -1 && errno == EINTR))
+				continue;
+			if (ready == -1)
+				break;
 
-			if (!opt.quiet) {
-				weprintf("%s: Conversion took too long, skipping", filename);
+			if (used == size) {
+				size = size ? size * 2 : 65536;
+				data = erealloc(data, size);
 			}
+			got = read(pipefd[0], data + used, size - used);
+			if (got > 0)
+				used += got;
+			else if (got == 0 || errno != EINTR)
+				break;
 		}
-		close(fd);
+		close(pipefd[0]);
+
+		waitpid(childpid, &status, 0);
 		childpid = 0;
+
+		if (timed_out && !opt.quiet) {
+			weprintf("%s: Conversion took too long, skipping", filename);
+		}
 	}
 
-	if (created_tempdir) {
-		DIR *dir;
-		struct dirent *de;
-		if ((dir = opendir(tempdir)) == NULL) {
-			weprintf("%s: Cannot remove temporary ImageMagick files from %s:", filename, tempdir);
-		} else {
-			while ((de = readdir(dir)) != NULL) {
-				if (de->d_name[0] != '.') {
-					char *temporary_file_name = estrjoin("/", tempdir, de->d_name, NULL);
-					/*
-					 * We assume that ImageMagick only creates temporary files and
-					 * not directories.
-					 */
-					if (unlink(temporary_file_name) == -1) {
-						weprintf("unlink %s:", temporary_file_name);
-					}
-					free(temporary_file_name);
-				}
-			}
-			if (rmdir(tempdir) == -1) {
-				weprintf("rmdir %s:", tempdir);
-			}
+	feh_conversion_slot_put();
+
+	if (created_tempdir)
+		feh_magick_remove_tempdir(filename, tempdir);
+
+	if (timed_out || !used || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		free(data);
+		return NULL;
+	}
+
+	*len = used;
+	return data;
+}
+
+/*
+ * Turns converter output or an image read from stdin into an image.
+ * PAM / PNM and (with libjpeg) JPEG are decoded straight from memory, and so
+ * is anything else if Imlib2 supports it. Otherwise, data is handed to
+ * Imlib2 via path, or via a temporary file if path is NULL.
+ */
+static Imlib_Image feh_load_image_data(feh_file * file, unsigned char *data,
+		size_t len, char *path)
+{
+	Imlib_Image im = NULL;
+	Imlib_Load_Error err;
+	char *tmpname = NULL;
+	int is_jpeg = (len > 2 && data[0] == 0xff && data[1] == 0xd8);
+
+#ifdef HAVE_LIBEXIF
+	/*
+	 * if we're called from within feh_reload_image, file->ed is already
+	 * populated.
+	 */
+	if (file->ed) {
+		exif_data_unref(file->ed);
+		file->ed = NULL;
+	}
+	if (is_jpeg)
+		file->ed = exif_data_new_from_data(data, len);
+#endif
+
+	if ((im = feh_pnm_load_mem(data, len)) != NULL)
+		return im;
+#ifdef HAVE_LIBJPEG
+	if (is_jpeg && (im = feh_jpeg_load_mem(data, len)) != NULL)
+		return im;
+#else
+	(void)is_jpeg;
+#endif
+#ifdef HAVE_IMLIB_LOAD_MEM
+	if ((im = imlib_load_image_mem(file->filename, data, len)) != NULL) {
+		/*
+		 * Imlib2 caches images by name, but all frames of an --stdin-stream
+		 * share the same one. Keep a private copy instead.
+		 */
+		if (file->data) {
+			Imlib_Image cached = im;
+
+			imlib_context_set_image(cached);
+			im = imlib_clone_image();
+			imlib_context_set_image(cached);
+			imlib_free_image_and_decache();
 		}
-		closedir(dir);
+		return im;
 	}
+#endif
 
-	free(argv_fn);
+	if (!path && !(path = tmpname = feh_conversion_save(file->filename, data, len)))
+		return NULL;
+	im = imlib_load_image_with_error_return(path, &err);
+	if (im && !err) {
+		/* make sure that the pixels are in memory before the file is gone */
+		imlib_context_set_image(im);
+		imlib_image_get_data_for_reading_only();
+	} else
+		im = NULL;
+	if (tmpname) {
+		unlink(tmpname);
+		free(tmpname);
+	}
+	return im;
+}
 
-	if ((sfn != NULL) && opt.use_conversion_cache)
-		gib_hash_set(conversion_cache, filename, sfn);
+/*
+ * Loads a conversion result stored in the file path.
+ */
+static Imlib_Image feh_conversion_load_file(feh_file * file, char *path)
+{
+	Imlib_Image im;
+	struct stat st;
+	void *data;
+	int fd;
 
-	return sfn;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	im = feh_load_image_data(file, data, st.st_size, path);
+	munmap(data, st.st_size);
+	return im;
+}
+
+/*
+ * Loads file->filename through the converter argv, which writes the result
+ * to its standard output. argv[0] doubles as key for the conversion caches.
+ */
+static Imlib_Image feh_conversion_load(feh_file * file, char *argv[], int magick)
+{
+	Imlib_Image im;
+	unsigned char *data;
+	size_t len;
+	char *sfn;
+
+	/* a temporary copy of stdin is not worth caching */
+	if (file->data) {
+		if ((data = feh_conversion_run(file->filename, argv, magick, &len)) == NULL)
+			return NULL;
+		im = feh_load_image_data(file, data, len, NULL);
+		free(data);
+		return im;
+	}
+
+	if (opt.use_conversion_cache) {
+		if (!conversion_cache)
+			conversion_cache = gib_hash_new();
+		if ((sfn = gib_hash_get(conversion_cache, file->filename)) != NULL)
+			return feh_conversion_load_file(file, sfn);
+		if ((data = feh_conversion_mem_get(file->filename, &len)) != NULL)
+			return feh_load_image_data(file, data, len, NULL);
+	}
+
+	if ((sfn = feh_conversion_cache_get(file->filename, argv[0])) != NULL) {
+		if ((im = feh_conversion_load_file(file, sfn)) && opt.use_conversion_cache)
+			gib_hash_set(conversion_cache, file->filename, sfn);
+		else
+			free(sfn);
+		return im;
+	}
+
+	if ((data = feh_conversion_run(file->filename, argv, magick, &len)) == NULL)
+		return NULL;
+
+	if ((im = feh_load_image_data(file, data, len, NULL)) != NULL) {
+		/*
+		 * The raw converter output is kept for later passes over the
+		 * filelist: in the persistent cache if it is enabled, in memory
+		 * otherwise.
+		 */
+		sfn = feh_conversion_cache_add(file->filename, argv[0], data, len);
+		if (sfn && opt.use_conversion_cache)
+			gib_hash_set(conversion_cache, file->filename, sfn);
+		else if (sfn)
+			free(sfn);
+		else if (opt.use_conversion_cache) {
+			feh_conversion_mem_add(file->filename, data, len);
+			return im;
+		}
+	}
+
+	free(data);
+	return im;
+}
+
+static Imlib_Image feh_dcraw_load_image(feh_file * file)
+{
+	char *argv[] = { "dcraw", "-c", "-e", file->filename, NULL };
+
+	return feh_conversion_load(file, argv, 0);
+}
+
+static Imlib_Image feh_magick_load_image(feh_file * file)
+{
+	/*
+	 * PAM is uncompressed and supports alpha channels, so neither
+	 * ImageMagick nor feh spend any time on compression.
+	 */
+	char *argv[] = { "convert", file->filename, "-depth", "8", "pam:-", NULL };
+
+	return feh_conversion_load(file, argv, 1);
 }
 
 #ifdef HAVE_LIBCURL
@@ -1012,6 +1515,83 @@ static Imlib_Font feh_load_font(winwidget w)
 	return fn;
 }
 
+/*
+ * Rendered text overlays (file name, EXIF and info text, actions and
+ * caption). Redrawing a window, e.g. while scrolling or zooming, then only
+ * has to blend them onto the image instead of measuring and drawing all of
+ * their text again. Entries are keyed by text, font and --text-bg, and the
+ * least recently used ones are dropped once there are more than
+ * OVERLAY_CACHE_SIZE of them.
+ */
+#define OVERLAY_CACHE_SIZE 16
+
+struct feh_overlay {
+	char *key;
+	Imlib_Font fn;
+	unsigned char text_bg;
+	Imlib_Image im;
+};
+
+/* most recently used first */
+static gib_list *overlay_cache = NULL;
+
+/* joins type and the first n lines into a cache key. Free it please */
+static char *feh_overlay_key(char *type, char **lines, int n)
+{
+	size_t len = strlen(type) + 1;
+	char *key;
+	int i;
+
+	for (i = 0; i < n; i++)
+		len += strlen(lines[i]) + 1;
+	key = emalloc(len);
+	strcpy(key, type);
+	for (i = 0; i < n; i++) {
+		strcat(key, "\n");
+		strcat(key, lines[i]);
+	}
+	return(key);
+}
+
+static Imlib_Image feh_overlay_get(char *key, Imlib_Font fn)
+{
+	struct feh_overlay *o;
+	gib_list *l;
+
+	for (l = overlay_cache; l; l = l->next) {
+		o = l->data;
+		if ((o->fn == fn) && (o->text_bg == opt.text_bg) && !strcmp(o->key, key)) {
+			overlay_cache = gib_list_remove(overlay_cache, l);
+			overlay_cache = gib_list_add_front(overlay_cache, o);
+			return(o->im);
+		}
+	}
+	return(NULL);
+}
+
+/* stores im, which now belongs to the cache */
+static void feh_overlay_add(char *key, Imlib_Font fn, Imlib_Image im)
+{
+	struct feh_overlay *o;
+	gib_list *last;
+
+	o = emalloc(sizeof(struct feh_overlay));
+	o->key = estrdup(key);
+	o->fn = fn;
+	o->text_bg = opt.text_bg;
+	o->im = im;
+	overlay_cache = gib_list_add_front(overlay_cache, o);
+
+	if (gib_list_length(overlay_cache) > OVERLAY_CACHE_SIZE) {
+		last = gib_list_last(overlay_cache);
+		o = last->data;
+		gib_imlib_free_image_and_decache(o->im);
+		free(o->key);
+		free(o);
+		overlay_cache = gib_list_remove(overlay_cache, last);
+	}
+}
+
 
 void feh_draw_zoom(winwidget w)
 {
@@ -1105,7 +1685,7 @@ void feh_draw_filename(winwidget w)
 	static Imlib_Font fn = NULL;
 	int tw = 0, th = 0, nw = 0;
 	Imlib_Image im = NULL;
-	char *s = NULL;
+	char *s = NULL, *key;
 	int len = 0;
 
 	if ((!w->file) || (!FEH_FILE(w->file->data))
@@ -1114,49 +1694,57 @@ void feh_draw_filename(winwidget w)
 
 	fn = feh_load_font(w);
 
-	/* Work out how high the font is */
-	gib_imlib_get_text_size(fn, FEH_FILE(w->file->data)->filename, NULL, &tw,
-			&th, IMLIB_TEXT_TO_RIGHT);
-
-	if (gib_list_length(filelist) > 1) {
-		len = snprintf(NULL, 0, "%d of %d",  gib_list_length(filelist),
-				gib_list_length(filelist)) + 1;
+	if (feh_filelist_length() > 1) {
+		len = snprintf(NULL, 0, "%d of %d",  feh_filelist_length(),
+				feh_filelist_length()) + 1;
 		s = emalloc(len);
 		if (w->file)
-			snprintf(s, len, "%d of %d", gib_list_num(filelist, w->file) +
-					1, gib_list_length(filelist));
+			snprintf(s, len, "%d of %d", feh_filelist_num(w->file) +
+					1, feh_filelist_length());
 		else
-			snprintf(s, len, "%d of %d", gib_list_num(filelist, current_file) +
-					1, gib_list_length(filelist));
+			snprintf(s, len, "%d of %d", feh_filelist_num(current_file) +
+					1, feh_filelist_length());
+	}
 
-		gib_imlib_get_text_size(fn, s, NULL, &nw, NULL, IMLIB_TEXT_TO_RIGHT);
+	key = estrjoin("\n", "filename", FEH_FILE(w->file->data)->filename,
+			s ? s : "", NULL);
+	if (!(im = feh_overlay_get(key, fn))) {
+		/* Work out how high the font is */
+		gib_imlib_get_text_size(fn, FEH_FILE(w->file->data)->filename, NULL, &tw,
+				&th, IMLIB_TEXT_TO_RIGHT);
 
-		if (nw > tw)
-			tw = nw;
-	}
+		if (s) {
+			gib_imlib_get_text_size(fn, s, NULL, &nw, NULL, IMLIB_TEXT_TO_RIGHT);
 
-	tw += 3;
-	th += 3;
-	im = imlib_create_image(tw, 2 * th);
-	if (!im)
-		eprintf("Couldn't create image. Out of memory?");
+			if (nw > tw)
+				tw = nw;
+		}
 
-	feh_imlib_image_fill_text_bg(im, tw, 2 * th);
+		tw += 3;
+		th += 3;
+		im = imlib_create_image(tw, 2 * th);
+		if (!im)
+			eprintf("Couldn't create image. Out of memory?");
 
-	gib_imlib_text_draw(im, fn, NULL, 2, 2, FEH_FILE(w->file->data)->filename,
-			IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
-	gib_imlib_text_draw(im, fn, NULL, 1, 1, FEH_FILE(w->file->data)->filename,
-			IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+		feh_imlib_image_fill_text_bg(im, tw, 2 * th);
 
-	if (s) {
-		gib_imlib_text_draw(im, fn, NULL, 2, th + 1, s, IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
-		gib_imlib_text_draw(im, fn, NULL, 1, th, s, IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
-		free(s);
+		gib_imlib_text_draw(im, fn, NULL, 2, 2, FEH_FILE(w->file->data)->filename,
+				IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
+		gib_imlib_text_draw(im, fn, NULL, 1, 1, FEH_FILE(w->file->data)->filename,
+				IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+
+		if (s) {
+			gib_imlib_text_draw(im, fn, NULL, 2, th + 1, s, IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
+			gib_imlib_text_draw(im, fn, NULL, 1, th, s, IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+		}
+
+		feh_overlay_add(key, fn, im);
 	}
 
 	gib_imlib_render_image_on_drawable(w->bg_pmap, im, 0, 0, 1, 1, 0);
 
-	gib_imlib_free_image_and_decache(im);
+	free(key);
+	free(s);
 	return;
 }
 
@@ -1172,6 +1760,7 @@ void feh_draw_exif(winwidget w)
 	char info_line[256];
 	char *info_buf[128];
 	char buffer[EXIF_MAX_DATA];
+	char *key;
 
 	if ( (!w->file) || (!FEH_FILE(w->file->data))
 			 || (!FEH_FILE(w->file->data)->filename) )
@@ -1185,98 +1774,141 @@ void feh_draw_exif(winwidget w)
 
 	fn = feh_load_font(w);
 
-	if (buffer[0] == '\0')
-	{
-		snprintf(buffer, EXIF_MAX_DATA, "%s", "Failed to run exif command");
-		gib_imlib_get_text_size(fn, buffer, NULL, &width, &height, IMLIB_TEXT_TO_RIGHT);
-		info_buf[no_lines] = estrdup(buffer);
-		no_lines++;
-	}
-	else
-	{
-
-		while ( (no_lines < 128) && (pos < EXIF_MAX_DATA) )
+	key = estrjoin("\n", "exif", buffer, NULL);
+	if (!(im = feh_overlay_get(key, fn))) {
+		if (buffer[0] == '\0')
 		{
-			/* max 128 lines */
-			pos2 = 0;
-			while ( pos2 < 255 ) /* max 255 chars + 1 null byte per line */
+			snprintf(buffer, EXIF_MAX_DATA, "%s", "Failed to run exif command");
+			gib_imlib_get_text_size(fn, buffer, NULL, &width, &height, IMLIB_TEXT_TO_RIGHT);
+			info_buf[no_lines] = estrdup(buffer);
+			no_lines++;
+		}
+		else
+		{
+
+			while ( (no_lines < 128) && (pos < EXIF_MAX_DATA) )
 			{
-				if ( (buffer[pos] != '\n')
-				      && (buffer[pos] != '\0') )
-				{
-					info_line[pos2] = buffer[pos];
-				}
-				else if ( buffer[pos] == '\0' )
-				{
-					pos = EXIF_MAX_DATA; /* all data seen */
-					break;
-				}
-				else
+				/* max 128 lines */
+				pos2 = 0;
+				while ( pos2 < 255 ) /* max 255 chars + 1 null byte per line */
 				{
-					pos++; /* line finished, continue with next line*/
-					break;
+					if ( (buffer[pos] != '\n')
+					      && (buffer[pos] != '\0') )
+					{
+						info_line[pos2] = buffer[pos];
+					}
+					else if ( buffer[pos] == '\0' )
+					{
+						pos = EXIF_MAX_DATA; /* all data seen */
+						break;
+					}
+					else
+					{
+						pos++; /* line finished, continue with next line*/
+						break;
+					}
+
+					pos++;
+					pos2++;
 				}
+				info_line[pos2] = '\0';
 
-				pos++;
-				pos2++;
-			}
-			info_line[pos2] = '\0';
+				gib_imlib_get_text_size(fn, info_line, NULL, &line_width,
+	                              &line_height, IMLIB_TEXT_TO_RIGHT);
 
-			gib_imlib_get_text_size(fn, info_line, NULL, &line_width,
-                              &line_height, IMLIB_TEXT_TO_RIGHT);
+				if (line_height > height)
+					height = line_height;
+				if (line_width > width)
+					width = line_width;
+				info_buf[no_lines] = estrdup(info_line);
 
-			if (line_height > height)
-				height = line_height;
-			if (line_width > width)
-				width = line_width;
-			info_buf[no_lines] = estrdup(info_line);
+				no_lines++;
+			}
+		}
 
-			no_lines++;
+		if (no_lines == 0) {
+			free(key);
+			return;
 		}
-	}
 
-	if (no_lines == 0)
-		return;
+		height *= no_lines;
+		width += 4;
 
-	height *= no_lines;
-	width += 4;
+		im = imlib_create_image(width, height);
+		if (!im)
+		{
+			eprintf("Couldn't create image. Out of memory?");
+		}
 
-	im = imlib_create_image(width, height);
-	if (!im)
-	{
-		eprintf("Couldn't create image. Out of memory?");
-	}
+		feh_imlib_image_fill_text_bg(im, width, height);
 
-	feh_imlib_image_fill_text_bg(im, width, height);
+		for (i = 0; i < no_lines; i++)
+		{
+			gib_imlib_text_draw(im, fn, NULL, 2, (i * line_height) + 2,
+					info_buf[i], IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
+			gib_imlib_text_draw(im, fn, NULL, 1, (i * line_height) + 1,
+					info_buf[i], IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+			free(info_buf[i]);
 
-	for (i = 0; i < no_lines; i++)
-	{
-		gib_imlib_text_draw(im, fn, NULL, 2, (i * line_height) + 2,
-				info_buf[i], IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
-		gib_imlib_text_draw(im, fn, NULL, 1, (i * line_height) + 1,
-				info_buf[i], IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
-		free(info_buf[i]);
+		}
 
+		feh_overlay_add(key, fn, im);
 	}
 
-	gib_imlib_render_image_on_drawable(w->bg_pmap, im, 0, w->h - height, 1, 1, 0);
+	gib_imlib_render_image_on_drawable(w->bg_pmap, im, 0,
+			w->h - gib_imlib_image_get_height(im), 1, 1, 0);
 
-	gib_imlib_free_image_and_decache(im);
+	free(key);
 	return;
 
 }
 #endif
 
+/*
+ * Like popen(cmd, "r"), but the shell starts with the signal mask feh was
+ * started with instead of the one used by the main loop.
+ */
+static FILE *feh_info_popen(char *cmd, pid_t *pid)
+{
+	int pipefd[2];
+	FILE *fp;
+
+	if (pipe(pipefd) == -1)
+		return(NULL);
+
+	if ((*pid = fork()) < 0) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return(NULL);
+	}
+	else if (*pid == 0) {
+		close(pipefd[0]);
+		dup2(pipefd[1], STDOUT_FILENO);
+		close(pipefd[1]);
+		feh_loop_child_sigmask();
+		execl("/bin/sh", "sh", "-c", cmd, NULL);
+		_exit(127);
+	}
+
+	close(pipefd[1]);
+	if (!(fp = fdopen(pipefd[0], "r"))) {
+		close(pipefd[0]);
+		waitpid(*pid, NULL, 0);
+	}
+	return(fp);
+}
+
 void feh_draw_info(winwidget w)
 {
 	static Imlib_Font fn = NULL;
 	int width = 0, height = 0, line_width = 0, line_height = 0;
 	Imlib_Image im = NULL;
 	int no_lines = 0, i;
-	char *info_cmd;
+	char *info_cmd, *key;
 	char info_line[256];
 	char *info_buf[128];
 	FILE *info_pipe;
+	pid_t info_pid;
 
 	if ((!w->file) || (!FEH_FILE(w->file->data))
 			|| (!FEH_FILE(w->file->data)->filename))
@@ -1286,7 +1918,7 @@ void feh_draw_info(winwidget w)
 
 	info_cmd = feh_printf(opt.info_cmd, FEH_FILE(w->file->data), w);
 
-	info_pipe = popen(info_cmd, "r");
+	info_pipe = feh_info_popen(info_cmd, &info_pid);
 
 	if (!info_pipe) {
 		info_buf[0] = estrdup("Failed to run info command");
@@ -1310,34 +1942,41 @@ void feh_draw_info(winwidget w)
 
 			no_lines++;
 		}
-		pclose(info_pipe);
+		fclose(info_pipe);
+		while ((waitpid(info_pid, NULL, 0) == -1) && (errno == EINTR))
+			;
 	}
 
 	if (no_lines == 0)
 		return;
 
-	height *= no_lines;
-	width += 4;
+	key = feh_overlay_key("info", info_buf, no_lines);
+	if (!(im = feh_overlay_get(key, fn))) {
+		height *= no_lines;
+		width += 4;
 
-	im = imlib_create_image(width, height);
-	if (!im)
-		eprintf("Couldn't create image. Out of memory?");
+		im = imlib_create_image(width, height);
+		if (!im)
+			eprintf("Couldn't create image. Out of memory?");
+
+		feh_imlib_image_fill_text_bg(im, width, height);
 
-	feh_imlib_image_fill_text_bg(im, width, height);
+		for (i = 0; i < no_lines; i++) {
+			gib_imlib_text_draw(im, fn, NULL, 2, (i * line_height) + 2,
+					info_buf[i], IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
+			gib_imlib_text_draw(im, fn, NULL, 1, (i * line_height) + 1,
+					info_buf[i], IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+		}
 
-	for (i = 0; i < no_lines; i++) {
-		gib_imlib_text_draw(im, fn, NULL, 2, (i * line_height) + 2,
-				info_buf[i], IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
-		gib_imlib_text_draw(im, fn, NULL, 1, (i * line_height) + 1,
-				info_buf[i], IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+		feh_overlay_add(key, fn, im);
+	}
 
+	for (i = 0; i < no_lines; i++)
 		free(info_buf[i]);
-	}
+	free(key);
 
 	gib_imlib_render_image_on_drawable(w->bg_pmap, im, 0,
-			w->h - height, 1, 1, 0);
-
-	gib_imlib_free_image_and_decache(im);
+			w->h - gib_imlib_image_get_height(im), 1, 1, 0);
 	return;
 }
 
@@ -1381,7 +2020,7 @@ void feh_draw_caption(winwidget w)
 	int tw = 0, th = 0, ww, hh;
 	int x, y;
 	Imlib_Image im = NULL;
-	char *p;
+	char *p, *key, size[64];
 	gib_list *lines, *l;
 	static gib_style *caption_style = NULL;
 	feh_file *file;
@@ -1420,72 +2059,83 @@ void feh_draw_caption(winwidget w)
 	if (*(file->caption) == '\0' && !w->caption_entry)
 		return;
 
-	caption_style = gib_style_new("caption");
-	caption_style->bits = gib_list_add_front(caption_style->bits,
-		gib_style_bit_new(0, 0, 0, 0, 0, 0));
-	caption_style->bits = gib_list_add_front(caption_style->bits,
-		gib_style_bit_new(1, 1, 0, 0, 0, 255));
-
 	fn = feh_load_font(w);
 
-	if (*(file->caption) == '\0') {
-		p = estrdup("Caption entry mode - Hit ESC to cancel");
-		lines = feh_wrap_string(p, w->w, fn, NULL);
-		free(p);
-	} else
-		lines = feh_wrap_string(file->caption, w->w, fn, NULL);
+	/* the text is wrapped to fit, so the window size is part of the key */
+	snprintf(size, sizeof(size), "%dx%d %d", w->w, w->h, w->caption_entry);
+	key = estrjoin("\n", "caption", size, file->caption, NULL);
+	if (!(im = feh_overlay_get(key, fn))) {
+		caption_style = gib_style_new("caption");
+		caption_style->bits = gib_list_add_front(caption_style->bits,
+			gib_style_bit_new(0, 0, 0, 0, 0, 0));
+		caption_style->bits = gib_list_add_front(caption_style->bits,
+			gib_style_bit_new(1, 1, 0, 0, 0, 255));
+
+		if (*(file->caption) == '\0') {
+			p = estrdup("Caption entry mode - Hit ESC to cancel");
+			lines = feh_wrap_string(p, w->w, fn, NULL);
+			free(p);
+		} else
+			lines = feh_wrap_string(file->caption, w->w, fn, NULL);
+
+		if (!lines) {
+			free(key);
+			return;
+		}
 
-	if (!lines)
-		return;
+		/* Work out how high/wide the caption is */
+		l = lines;
+		while (l) {
+			p = (char *) l->data;
+			gib_imlib_get_text_size(fn, p, caption_style, &ww, &hh, IMLIB_TEXT_TO_RIGHT);
+			if (ww > tw)
+				tw = ww;
+			th += hh;
+			if (l->next)
+				th += 1;	/* line spacing */
+			l = l->next;
+		}
 
-	/* Work out how high/wide the caption is */
-	l = lines;
-	while (l) {
-		p = (char *) l->data;
-		gib_imlib_get_text_size(fn, p, caption_style, &ww, &hh, IMLIB_TEXT_TO_RIGHT);
-		if (ww > tw)
-			tw = ww;
-		th += hh;
-		if (l->next)
-			th += 1;	/* line spacing */
-		l = l->next;
-	}
-
-	/* we don't want the caption overlay larger than our window */
-	if (th > w->h)
-		th = w->h;
-	if (tw > w->w)
-		tw = w->w;
+		/* we don't want the caption overlay larger than our window */
+		if (th > w->h)
+			th = w->h;
+		if (tw > w->w)
+			tw = w->w;
 
-	im = imlib_create_image(tw, th);
-	if (!im)
-		eprintf("Couldn't create image. Out of memory?");
+		im = imlib_create_image(tw, th);
+		if (!im)
+			eprintf("Couldn't create image. Out of memory?");
 
-	feh_imlib_image_fill_text_bg(im, tw, th);
+		feh_imlib_image_fill_text_bg(im, tw, th);
 
-	l = lines;
-	y = 0;
-	while (l) {
-		p = (char *) l->data;
-		gib_imlib_get_text_size(fn, p, caption_style, &ww, &hh, IMLIB_TEXT_TO_RIGHT);
-		x = (tw - ww) / 2;
-		if (w->caption_entry && (*(file->caption) == '\0'))
-			gib_imlib_text_draw(im, fn, caption_style, x, y, p,
-				IMLIB_TEXT_TO_RIGHT, 255, 255, 127, 255);
-		else if (w->caption_entry)
-			gib_imlib_text_draw(im, fn, caption_style, x, y, p,
-				IMLIB_TEXT_TO_RIGHT, 255, 255, 0, 255);
-		else
-			gib_imlib_text_draw(im, fn, caption_style, x, y, p,
-				IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+		l = lines;
+		y = 0;
+		while (l) {
+			p = (char *) l->data;
+			gib_imlib_get_text_size(fn, p, caption_style, &ww, &hh, IMLIB_TEXT_TO_RIGHT);
+			x = (tw - ww) / 2;
+			if (w->caption_entry && (*(file->caption) == '\0'))
+				gib_imlib_text_draw(im, fn, caption_style, x, y, p,
+					IMLIB_TEXT_TO_RIGHT, 255, 255, 127, 255);
+			else if (w->caption_entry)
+				gib_imlib_text_draw(im, fn, caption_style, x, y, p,
+					IMLIB_TEXT_TO_RIGHT, 255, 255, 0, 255);
+			else
+				gib_imlib_text_draw(im, fn, caption_style, x, y, p,
+					IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+
+			y += hh + 1;	/* line spacing */
+			l = l->next;
+		}
 
-		y += hh + 1;	/* line spacing */
-		l = l->next;
+		feh_overlay_add(key, fn, im);
+		gib_list_free_and_data(lines);
 	}
 
-	gib_imlib_render_image_on_drawable(w->bg_pmap, im, (w->w - tw) / 2, w->h - th, 1, 1, 0);
-	gib_imlib_free_image_and_decache(im);
-	gib_list_free_and_data(lines);
+	gib_imlib_render_image_on_drawable(w->bg_pmap, im,
+			(w->w - gib_imlib_image_get_width(im)) / 2,
+			w->h - gib_imlib_image_get_height(im), 1, 1, 0);
+	free(key);
 	return;
 }
 
@@ -1543,7 +2193,16 @@ void feh_edit_inplace(winwidget w, int op)
 	if (!w->file || !w->file->data || !FEH_FILE(w->file->data)->filename)
 		return;
 
-	if (!opt.edit) {
+	/* the pyramid's tiles are copies of the unmodified image */
+	feh_pyramid_free(w);
+	/* and so are those of the tile cache */
+	feh_tile_cache_detach(FEH_FILE(w->file->data));
+
+	/*
+	 * Memory-backed files (stdin) have no file of their own to write the
+	 * result to, so they are only edited in memory.
+	 */
+	if (!opt.edit || FEH_FILE(w->file->data)->data) {
 		imlib_context_set_image(w->im);
 		if (op == INPLACE_EDIT_FLIP)
 			imlib_image_flip_vertical();
@@ -1743,6 +2402,7 @@ void feh_edit_inplace_lossless(winwidget w, int op)
 	}
 	else if (pid == 0) {
 
+		feh_loop_child_sigmask();
 		execlp("jpegtran", "jpegtran", "-copy", "all", op_op, op_value,
 				"-outfile", file_str, file_str, NULL);
 
@@ -1771,6 +2431,7 @@ void feh_edit_inplace_lossless(winwidget w, int op)
 		devnull = open("/dev/null", O_WRONLY);
 		dup2(devnull, 1);
 
+		feh_loop_child_sigmask();
 		execlp("jpegexiforient", "jpegexiforient", "-1", file_str, NULL);
 		weprintf("lossless %s: Failed to exec jpegexiforient:", op_name);
 		_exit(1);
@@ -1820,64 +2481,67 @@ void feh_draw_actions(winwidget w)
 
 	fn = feh_load_font(w);
 
-	gib_imlib_get_text_size(fn, "defined actions:", NULL, &tw, &th, IMLIB_TEXT_TO_RIGHT);
-/* Check for the widest line */
-	max_tw = tw;
+	if (!(im = feh_overlay_get("actions", fn))) {
+		gib_imlib_get_text_size(fn, "defined actions:", NULL, &tw, &th, IMLIB_TEXT_TO_RIGHT);
+		/* Check for the widest line */
+		max_tw = tw;
+
+		for (i = 0; i < 10; i++) {
+			if (opt.actions[i]) {
+				line = emalloc(strlen(opt.action_titles[i]) + 5);
+				strcpy(line, "0: ");
+				line = strcat(line, opt.action_titles[i]);
+				gib_imlib_get_text_size(fn, line, NULL, &tw, &th, IMLIB_TEXT_TO_RIGHT);
+				free(line);
+				if (tw > max_tw)
+					max_tw = tw;
+			}
+		}
 
-	for (i = 0; i < 10; i++) {
-		if (opt.actions[i]) {
-			line = emalloc(strlen(opt.action_titles[i]) + 5);
-			strcpy(line, "0: ");
-			line = strcat(line, opt.action_titles[i]);
-			gib_imlib_get_text_size(fn, line, NULL, &tw, &th, IMLIB_TEXT_TO_RIGHT);
-			free(line);
-			if (tw > max_tw)
-				max_tw = tw;
+		tw = max_tw;
+		tw += 3;
+		th += 3;
+		line_th = th;
+		th = (th * num_actions) + line_th;
+
+		im = imlib_create_image(tw, th);
+		if (!im)
+			eprintf("Couldn't create image. Out of memory?");
+
+		feh_imlib_image_fill_text_bg(im, tw, th);
+
+		gib_imlib_text_draw(im, fn, NULL, 2, 2, "defined actions:", IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
+		gib_imlib_text_draw(im, fn, NULL, 1, 1, "defined actions:", IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+
+		for (i = 0; i < 10; i++) {
+			if (opt.action_titles[i]) {
+				cur_action++;
+				line = emalloc(strlen(opt.action_titles[i]) + 5);
+				sprintf(index, "%d", i);
+				strcpy(line, index);
+				strcat(line, ": ");
+				strcat(line, opt.action_titles[i]);
+
+				gib_imlib_text_draw(im, fn, NULL, 2,
+						(cur_action * line_th) + 2, line,
+						IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
+				gib_imlib_text_draw(im, fn, NULL, 1,
+						(cur_action * line_th) + 1, line,
+						IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+				free(line);
+			}
 		}
-	}
 
-	tw = max_tw;
-	tw += 3;
-	th += 3;
-	line_th = th;
-	th = (th * num_actions) + line_th;
+		feh_overlay_add("actions", fn, im);
+	}
 
 	/* This depends on feh_draw_filename internals...
 	 * should be fixed some time
 	 */
+	line_th = gib_imlib_image_get_height(im) / (num_actions + 1);
 	if (opt.draw_filename)
 		th_offset = line_th * 2;
 
-	im = imlib_create_image(tw, th);
-	if (!im)
-		eprintf("Couldn't create image. Out of memory?");
-
-	feh_imlib_image_fill_text_bg(im, tw, th);
-
-	gib_imlib_text_draw(im, fn, NULL, 2, 2, "defined actions:", IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
-	gib_imlib_text_draw(im, fn, NULL, 1, 1, "defined actions:", IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
-
-	for (i = 0; i < 10; i++) {
-		if (opt.action_titles[i]) {
-			cur_action++;
-			line = emalloc(strlen(opt.action_titles[i]) + 5);
-			sprintf(index, "%d", i);
-			strcpy(line, index);
-			strcat(line, ": ");
-			strcat(line, opt.action_titles[i]);
-
-			gib_imlib_text_draw(im, fn, NULL, 2,
-					(cur_action * line_th) + 2, line,
-					IMLIB_TEXT_TO_RIGHT, 0, 0, 0, 255);
-			gib_imlib_text_draw(im, fn, NULL, 1,
-					(cur_action * line_th) + 1, line,
-					IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
-			free(line);
-		}
-	}
-
 	gib_imlib_render_image_on_drawable(w->bg_pmap, im, 0, 0 + th_offset, 1, 1, 0);
-
-	gib_imlib_free_image_and_decache(im);
 	return;
 }
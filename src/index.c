@@ -29,7 +29,60 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "winwidget.h"
 #include "options.h"
 #include "index.h"
+#include "worker.h"
 
+/*
+ * Loads and scales a single index entry. Runs in a worker process when
+ * --jobs is not 1.
+ */
+static int index_job(feh_file * file, Imlib_Image * im, int *orig_w, int *orig_h)
+{
+	Imlib_Image im_temp;
+	int ww, hh, www, hhh;
+
+	D(("About to load image %s\n", file->filename));
+	if (feh_load_image_scaled(&im_temp, file, opt.thumb_w, opt.thumb_h,
+				orig_w, orig_h) == 0)
+		return(0);
+
+	www = opt.thumb_w;
+	hhh = opt.thumb_h;
+	ww = gib_imlib_image_get_width(im_temp);
+	hh = gib_imlib_image_get_height(im_temp);
+
+	if (opt.aspect) {
+		double ratio = 0.0;
+
+		/* Keep the aspect ratio for the thumbnail */
+		ratio = ((double) ww / hh) / ((double) www / hhh);
+
+		if (ratio > 1.0)
+			hhh = opt.thumb_h / ratio;
+		else if (ratio != 1.0)
+			www = opt.thumb_w * ratio;
+	}
+
+	if ((!opt.stretch) && ((www > ww) || (hhh > hh))) {
+		/* Don't make the image larger unless stretch is specified */
+		www = ww;
+		hhh = hh;
+	}
+
+	*im = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0, ww, hh, www, hhh, 1);
+	gib_imlib_free_image_and_decache(im_temp);
+
+	if (opt.alpha) {
+		DATA8 atab[256];
+
+		D(("Applying alpha options\n"));
+		gib_imlib_image_set_has_alpha(*im, 1);
+		memset(atab, opt.alpha_level, sizeof(atab));
+		gib_imlib_apply_color_modifier_to_rectangle
+		    (*im, 0, 0, www, hhh, NULL, NULL, NULL, atab);
+	}
+
+	return(*im != NULL);
+}
 
 /* TODO Break this up a bit ;) */
 /* TODO s/bit/lot */
@@ -37,8 +90,7 @@ void init_index_mode(void)
 {
 	Imlib_Load_Error err;
 	Imlib_Image im_main;
-	Imlib_Image im_temp;
-	int w = 800, h = 600, ww = 0, hh = 0, www, hhh, xxx, yyy;
+	int w = 800, h = 600, www, hhh, xxx, yyy;
 	int x = 0, y = 0;
 	int bg_w = 0, bg_h = 0;
 	winwidget winwid = NULL;
@@ -60,6 +112,8 @@ void init_index_mode(void)
 	unsigned char trans_bg = 0;
 	int index_image_width, index_image_height;
 	gib_list *line, *lines;
+	feh_job_queue queue;
+	feh_job *job;
 
 	if (opt.montage) {
 		mode = "montage";
@@ -176,54 +230,29 @@ void init_index_mode(void)
 		winwidget_show(winwid);
 	}
 
-	for (l = filelist; l; l = l->next) {
+	/*
+	 * Decoding and scaling runs in up to --jobs workers, with at most that
+	 * many images in flight. Entries are composited in filelist order, so
+	 * the result does not depend on the number of workers.
+	 */
+	feh_job_queue_init(&queue, filelist, index_job, 1);
+	while ((job = feh_job_queue_next(&queue))) {
+		l = job->node;
 		file = FEH_FILE(l->data);
 		if (last) {
 			filelist = feh_file_remove_from_list(filelist, last);
 			last = NULL;
 		}
-		D(("About to load image %s\n", file->filename));
-		if (feh_load_image(&im_temp, file) != 0) {
+		im_thumb = feh_job_take_image(job, NULL, NULL);
+		feh_job_free(job);
+		if (im_thumb) {
 			if (opt.verbose)
 				feh_display_status('.');
 			D(("Successfully loaded %s\n", file->filename));
-			www = opt.thumb_w;
-			hhh = opt.thumb_h;
-			ww = gib_imlib_image_get_width(im_temp);
-			hh = gib_imlib_image_get_height(im_temp);
+			www = gib_imlib_image_get_width(im_thumb);
+			hhh = gib_imlib_image_get_height(im_thumb);
 			thumbnailcount++;
 
-			if (opt.aspect) {
-				double ratio = 0.0;
-
-				/* Keep the aspect ratio for the thumbnail */
-				ratio = ((double) ww / hh) / ((double) www / hhh);
-
-				if (ratio > 1.0)
-					hhh = opt.thumb_h / ratio;
-				else if (ratio != 1.0)
-					www = opt.thumb_w * ratio;
-			}
-
-			if ((!opt.stretch) && ((www > ww) || (hhh > hh))) {
-				/* Don't make the image larger unless stretch is specified */
-				www = ww;
-				hhh = hh;
-			}
-
-			im_thumb = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0, ww, hh, www, hhh, 1);
-			gib_imlib_free_image_and_decache(im_temp);
-
-			if (opt.alpha) {
-				DATA8 atab[256];
-
-				D(("Applying alpha options\n"));
-				gib_imlib_image_set_has_alpha(im_thumb, 1);
-				memset(atab, opt.alpha_level, sizeof(atab));
-				gib_imlib_apply_color_modifier_to_rectangle
-				    (im_thumb, 0, 0, www, hhh, NULL, NULL, NULL, atab);
-			}
-
 			text_area_w = opt.thumb_w;
 			/* Now draw on the info text */
 			if (opt.index_info) {
@@ -242,15 +271,21 @@ void init_index_mode(void)
 					x += max_column_w;
 					max_column_w = 0;
 				}
-				if (x > w - text_area_w)
+				if (x > w - text_area_w) {
+					gib_imlib_free_image_and_decache(im_thumb);
+					feh_job_queue_cancel(&queue);
 					break;
+				}
 			} else {
 				if (x > w - text_area_w) {
 					x = 0;
 					y += tot_thumb_h;
 				}
-				if (y > h - tot_thumb_h)
+				if (y > h - tot_thumb_h) {
+					gib_imlib_free_image_and_decache(im_thumb);
+					feh_job_queue_cancel(&queue);
 					break;
+				}
 			}
 
 			/* center image relative to the text below it (if any) */
@@ -0,0 +1,372 @@
+/* infocache.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * Persistent file info cache (--info-cache).
+ *
+ * The cache file consists of a header, an array of fixed-size records sorted
+ * by absolute path, and a string table holding the paths. It is mmap()ed
+ * and searched in place, so startup cost does not depend on its size.
+ * A record is only used if inode, size and mtime of the file still match
+ * and it was created with the same --auto-rotate setting.
+ * New records are collected in memory and merged into a fresh copy of the
+ * file by feh_info_cache_save.
+ */
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define INFO_CACHE_MAGIC "fehinfo2"
+
+#ifdef HAVE_LIBEXIF
+#define INFO_CACHE_ROTATED opt.auto_rotate
+#else
+#define INFO_CACHE_ROTATED 0
+#endif
+
+struct info_cache_header {
+	char magic[8];
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct info_cache_record {
+	uint64_t ino;
+	int64_t mtime;
+	int64_t size;
+	uint32_t path;		/* offset into the string table */
+	int32_t width;
+	int32_t height;
+	uint8_t has_alpha;
+	uint8_t rotated;	/* width/height reflect EXIF orientation */
+	char format[10];
+};
+
+static int cache_loaded = 0;
+static char *cache_file = NULL;
+static char *cache_map = NULL;
+static size_t cache_map_size = 0;
+static struct info_cache_record *cache_records = NULL;
+static uint32_t cache_count = 0;
+static char *cache_strings = NULL;
+static size_t cache_strings_size = 0;
+
+/* records added during this run, as malloc()ed info_cache_record with path */
+struct info_cache_new {
+	struct info_cache_record rec;
+	char *path;
+};
+static gib_list *cache_new = NULL;
+
+static void feh_info_cache_open(void)
+{
+	struct info_cache_header *header;
+	struct stat st;
+	char *dir;
+	int fd;
+
+	cache_loaded = 1;
+
+	if (!(dir = feh_cache_dir()))
+		return;
+	cache_file = estrjoin("/", dir, "fileinfo", NULL);
+	free(dir);
+
+	if ((fd = open(cache_file, O_RDONLY)) == -1)
+		return;
+
+	if (fstat(fd, &st) || (st.st_size < (off_t)sizeof(struct info_cache_header))) {
+		close(fd);
+		return;
+	}
+
+	cache_map_size = st.st_size;
+	cache_map = mmap(NULL, cache_map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (cache_map == MAP_FAILED) {
+		cache_map = NULL;
+		return;
+	}
+
+	header = (struct info_cache_header *)cache_map;
+	if (memcmp(header->magic, INFO_CACHE_MAGIC, 8)
+			|| (header->count > (cache_map_size - sizeof(*header))
+				/ sizeof(struct info_cache_record))
+			|| (cache_map[cache_map_size - 1] != '\0')) {
+		weprintf("ignoring invalid info cache %s", cache_file);
+		munmap(cache_map, cache_map_size);
+		cache_map = NULL;
+		return;
+	}
+
+	cache_count = header->count;
+	cache_records = (struct info_cache_record *)(cache_map + sizeof(*header));
+	cache_strings = (char *)(cache_records + cache_count);
+	cache_strings_size = cache_map + cache_map_size - cache_strings;
+}
+
+static void feh_info_cache_close(void)
+{
+	if (cache_map)
+		munmap(cache_map, cache_map_size);
+	cache_map = NULL;
+	cache_records = NULL;
+	cache_count = 0;
+	cache_strings = NULL;
+	cache_strings_size = 0;
+	cache_loaded = 0;
+}
+
+static char *feh_info_cache_path(struct info_cache_record *rec)
+{
+	if (rec->path >= cache_strings_size)
+		return("");
+	return(cache_strings + rec->path);
+}
+
+/* free the result please */
+static char *feh_info_cache_abspath(char *filename)
+{
+	static char *cwd = NULL;
+
+	if (filename[0] == '/')
+		return(estrdup(filename));
+	if (!cwd && !(cwd = getcwd(NULL, 0)))
+		return(NULL);
+	return(estrjoin("/", cwd, filename, NULL));
+}
+
+static struct info_cache_record *feh_info_cache_find(char *path)
+{
+	uint32_t lo = 0, hi = cache_count, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(path, feh_info_cache_path(&cache_records[mid]));
+		if (!cmp)
+			return(&cache_records[mid]);
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return(NULL);
+}
+
+/*
+ * Sets file->info from the cache if it holds an up-to-date entry for the
+ * file described by st. Returns 1 on success.
+ */
+int feh_info_cache_lookup(feh_file * file, struct stat *st)
+{
+	struct info_cache_record *rec;
+	char *path;
+
+	if (!opt.info_cache || path_is_url(file->filename))
+		return(0);
+	if (!cache_loaded)
+		feh_info_cache_open();
+	if (!cache_count)
+		return(0);
+	if (!(path = feh_info_cache_abspath(file->filename)))
+		return(0);
+
+	rec = feh_info_cache_find(path);
+	free(path);
+
+	if (!rec || (rec->ino != (uint64_t)st->st_ino)
+			|| (rec->mtime != (int64_t)st->st_mtime)
+			|| (rec->size != (int64_t)st->st_size)
+			|| (rec->rotated != INFO_CACHE_ROTATED))
+		return(0);
+
+	file->info = feh_file_info_new();
+	file->info->width = rec->width;
+	file->info->height = rec->height;
+	file->info->pixels = rec->width * rec->height;
+	file->info->has_alpha = rec->has_alpha;
+	file->info->size = st->st_size;
+	file->info->format = estrdup(rec->format[0] ? rec->format : "");
+	return(1);
+}
+
+/*
+ * Remembers file->info for the next feh_info_cache_save, unless the cache
+ * already has an up-to-date entry.
+ */
+void feh_info_cache_add(feh_file * file)
+{
+	struct info_cache_new *new;
+	struct info_cache_record *rec;
+	struct stat st;
+	char *path;
+
+	if (!opt.info_cache || !file->info || path_is_url(file->filename))
+		return;
+	if (!cache_loaded)
+		feh_info_cache_open();
+	if (!cache_file || stat(file->filename, &st) || !S_ISREG(st.st_mode))
+		return;
+	if (!(path = feh_info_cache_abspath(file->filename)))
+		return;
+
+	rec = feh_info_cache_find(path);
+	if (rec && (rec->ino == (uint64_t)st.st_ino)
+			&& (rec->mtime == (int64_t)st.st_mtime)
+			&& (rec->size == (int64_t)st.st_size)
+			&& (rec->rotated == INFO_CACHE_ROTATED)) {
+		free(path);
+		return;
+	}
+
+	new = emalloc(sizeof(struct info_cache_new));
+	memset(new, 0, sizeof(struct info_cache_new));
+	new->path = path;
+	new->rec.ino = st.st_ino;
+	new->rec.mtime = st.st_mtime;
+	new->rec.size = st.st_size;
+	new->rec.width = file->info->width;
+	new->rec.height = file->info->height;
+	new->rec.has_alpha = file->info->has_alpha;
+	new->rec.rotated = INFO_CACHE_ROTATED;
+	if (file->info->format)
+		strncpy(new->rec.format, file->info->format, sizeof(new->rec.format) - 1);
+	cache_new = gib_list_add_front(cache_new, new);
+}
+
+static int feh_info_cache_cmp_new(void *a, void *b)
+{
+	return(strcmp(((struct info_cache_new *)a)->path,
+				((struct info_cache_new *)b)->path));
+}
+
+static int feh_info_cache_write(FILE * fp, struct info_cache_record *rec,
+		char *path, uint32_t *count, uint32_t *strings_size, gib_list ** strings)
+{
+	struct info_cache_record out = *rec;
+
+	out.path = *strings_size;
+	*strings_size += strlen(path) + 1;
+	*strings = gib_list_add_front(*strings, path);
+	(*count)++;
+	return(fwrite(&out, sizeof(out), 1, fp) == 1);
+}
+
+/*
+ * Writes the cache file: existing records merged with the ones added during
+ * this run. New records replace old ones for the same path.
+ */
+void feh_info_cache_save(void)
+{
+	struct info_cache_header header;
+	gib_list *l, *strings = NULL;
+	struct info_cache_new *new;
+	uint32_t i = 0, count = 0, strings_size = 0;
+	char *tmpname, *path;
+	int fd, ok = 1, cmp;
+	FILE *fp;
+
+	if (!cache_new || !cache_file)
+		return;
+
+	cache_new = gib_list_sort(cache_new, feh_info_cache_cmp_new);
+
+	tmpname = estrjoin("", cache_file, ".XXXXXX", NULL);
+	if ((fd = mkstemp(tmpname)) == -1 || !(fp = fdopen(fd, "w"))) {
+		weprintf("unable to write info cache %s:", tmpname);
+		if (fd != -1) {
+			close(fd);
+			unlink(tmpname);
+		}
+		free(tmpname);
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INFO_CACHE_MAGIC, 8);
+	ok &= fwrite(&header, sizeof(header), 1, fp) == 1;
+
+	/* merge old and new records, both of which are sorted by path */
+	for (l = cache_new; ok && (l || i < cache_count); ) {
+		new = l ? l->data : NULL;
+		path = (i < cache_count) ? feh_info_cache_path(&cache_records[i]) : NULL;
+		cmp = !new ? -1 : !path ? 1 : strcmp(path, new->path);
+
+		if (cmp < 0) {
+			ok &= feh_info_cache_write(fp, &cache_records[i], path,
+					&count, &strings_size, &strings);
+			i++;
+		} else {
+			/* a file may occur several times in the filelist */
+			while (l->next && !strcmp(new->path,
+						((struct info_cache_new *)l->next->data)->path))
+				l = l->next;
+			ok &= feh_info_cache_write(fp, &new->rec, new->path,
+					&count, &strings_size, &strings);
+			if (cmp == 0)
+				i++;
+			l = l->next;
+		}
+	}
+
+	/* the string table, in the same order (strings was built in reverse) */
+	strings = gib_list_reverse(strings);
+	for (l = strings; ok && l; l = l->next)
+		ok &= fwrite(l->data, strlen(l->data) + 1, 1, fp) == 1;
+	gib_list_free(strings);
+
+	/* the reader relies on the file ending with a NUL byte */
+	if (!strings_size)
+		ok &= fputc('\0', fp) != EOF;
+
+	header.count = count;
+	ok &= fseek(fp, 0, SEEK_SET) == 0;
+	ok &= fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok &= fclose(fp) == 0;
+
+	if (!ok || rename(tmpname, cache_file)) {
+		weprintf("unable to write info cache %s:", cache_file);
+		unlink(tmpname);
+	}
+	free(tmpname);
+
+	for (l = cache_new; l; l = l->next) {
+		free(((struct info_cache_new *)l->data)->path);
+		free(l->data);
+	}
+	gib_list_free(cache_new);
+	cache_new = NULL;
+
+	/* pick up the new file on the next lookup */
+	path = cache_file;
+	feh_info_cache_close();
+	free(path);
+	cache_file = NULL;
+}
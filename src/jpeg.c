@@ -0,0 +1,220 @@
+/* jpeg.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * Reduced-size JPEG decoding for thumbnails. libjpeg can skip most of the
+ * IDCT work and decode straight to 1/2, 1/4 or 1/8 of the original size,
+ * which is a lot cheaper than having Imlib2 decode the full image only to
+ * scale it down afterwards.
+ */
+
+#include "feh.h"
+#include <setjmp.h>
+#include <jpeglib.h>
+
+struct feh_jpeg_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf env;
+};
+
+static void feh_jpeg_error_exit(j_common_ptr cinfo)
+{
+	longjmp(((struct feh_jpeg_error *)cinfo->err)->env, 1);
+}
+
+static void feh_jpeg_output_message(j_common_ptr cinfo __attribute__((unused)))
+{
+	/* Warnings about corrupt data are Imlib2's business, keep quiet */
+	return;
+}
+
+/*
+ * Returns the largest IDCT scaling denominator which still yields an image
+ * of at least min_w x min_h pixels, in either orientation.
+ */
+static int feh_jpeg_scale_denom(int w, int h, int min_w, int min_h)
+{
+	int denom, small = (w < h) ? w : h, large = (min_w > min_h) ? min_w : min_h;
+
+	if (large <= 0)
+		return(1);
+	for (denom = 8; denom > 1; denom /= 2)
+		if (small / denom >= large)
+			break;
+	return(denom);
+}
+
+/*
+ * Decodes the JPEG stream at the current position of fp at a reduced size
+ * which is at least min_w x min_h. Unless any_scale is set, NULL is returned
+ * if no size reduction is possible. orig_w / orig_h are set to the size
+ * of the image at scale 1.
+ */
+static Imlib_Image feh_jpeg_decode(FILE * fp, int min_w, int min_h,
+		int any_scale, int *orig_w, int *orig_h)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct feh_jpeg_error jerr;
+	Imlib_Image volatile im = NULL;
+	JSAMPLE *volatile row = NULL;
+	DATA32 *data, *pixel;
+	unsigned int x;
+	int gray;
+
+	cinfo.err = jpeg_std_error(&jerr.mgr);
+	jerr.mgr.error_exit = feh_jpeg_error_exit;
+	jerr.mgr.output_message = feh_jpeg_output_message;
+
+	if (setjmp(jerr.env)) {
+		jpeg_destroy_decompress(&cinfo);
+		free(row);
+		if (im) {
+			imlib_context_set_image(im);
+			imlib_free_image();
+		}
+		return(NULL);
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, fp);
+	jpeg_read_header(&cinfo, TRUE);
+
+	/* CMYK and friends are left to Imlib2 */
+	if ((cinfo.jpeg_color_space != JCS_GRAYSCALE)
+			&& (cinfo.jpeg_color_space != JCS_YCbCr)
+			&& (cinfo.jpeg_color_space != JCS_RGB))
+		longjmp(jerr.env, 1);
+
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = feh_jpeg_scale_denom(cinfo.image_width,
+			cinfo.image_height, min_w, min_h);
+	if ((cinfo.scale_denom == 1) && !any_scale)
+		longjmp(jerr.env, 1);
+
+	gray = (cinfo.jpeg_color_space == JCS_GRAYSCALE);
+	cinfo.out_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+	if (cinfo.scale_denom > 1) {
+		/* precision is wasted on thumbnails, but not on full-size images */
+		cinfo.dct_method = JDCT_IFAST;
+		cinfo.do_fancy_upsampling = FALSE;
+	}
+
+	jpeg_start_decompress(&cinfo);
+
+	if (!(im = imlib_create_image(cinfo.output_width, cinfo.output_height)))
+		longjmp(jerr.env, 1);
+	row = emalloc(cinfo.output_width * cinfo.output_components);
+
+	imlib_context_set_image(im);
+	data = imlib_image_get_data();
+	pixel = data;
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		jpeg_read_scanlines(&cinfo, (JSAMPARRAY) &row, 1);
+		for (x = 0; x < cinfo.output_width; x++) {
+			if (gray)
+				*pixel++ = 0xff000000 | (row[x] << 16) | (row[x] << 8) | row[x];
+			else
+				*pixel++ = 0xff000000 | (row[3 * x] << 16)
+					| (row[3 * x + 1] << 8) | row[3 * x + 2];
+		}
+	}
+
+	imlib_context_set_image(im);
+	imlib_image_put_back_data(data);
+	imlib_image_set_has_alpha(0);
+	imlib_image_set_format("jpeg");
+
+	*orig_w = cinfo.image_width;
+	*orig_h = cinfo.image_height;
+
+	D(("Decoded %dx%d JPEG at 1/%d scale\n", *orig_w, *orig_h,
+				cinfo.scale_denom));
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	free(row);
+
+	return(im);
+}
+
+/*
+ * Loads the JPEG file filename at a reduced size which is at least
+ * min_w x min_h, and stores the original image size in orig_w / orig_h.
+ * Returns NULL if filename is not a JPEG file, if it cannot be decoded by
+ * libjpeg, or if it is too small to benefit from reduced-size decoding.
+ * The caller should use feh_load_image in that case.
+ */
+Imlib_Image feh_jpeg_load_scaled(char *filename, int min_w, int min_h,
+		int *orig_w, int *orig_h)
+{
+	unsigned char magic[3];
+	Imlib_Image im;
+	FILE *fp;
+
+	if (!(fp = fopen(filename, "rb")))
+		return(NULL);
+
+	if ((fread(magic, 1, 3, fp) != 3) || (magic[0] != 0xff)
+			|| (magic[1] != 0xd8) || (magic[2] != 0xff)) {
+		fclose(fp);
+		return(NULL);
+	}
+	rewind(fp);
+
+	im = feh_jpeg_decode(fp, min_w, min_h, 0, orig_w, orig_h);
+	fclose(fp);
+	return(im);
+}
+
+/*
+ * Loads a JPEG stream embedded in another file (such as an EXIF thumbnail)
+ * at offset, reduced to at least min_w x min_h if possible.
+ */
+Imlib_Image feh_jpeg_load_embedded(FILE * fp, long offset, int min_w, int min_h)
+{
+	int w, h;
+
+	if (fseek(fp, offset, SEEK_SET) != 0)
+		return(NULL);
+	return(feh_jpeg_decode(fp, min_w, min_h, 1, &w, &h));
+}
+
+/*
+ * Decodes the JPEG image held in data at full size, e.g. the output of
+ * dcraw -e.
+ */
+Imlib_Image feh_jpeg_load_mem(unsigned char *data, size_t len)
+{
+	Imlib_Image im;
+	FILE *fp;
+	int w, h;
+
+	if (!(fp = fmemopen(data, len, "rb")))
+		return(NULL);
+	im = feh_jpeg_decode(fp, 0, 0, 1, &w, &h);
+	fclose(fp);
+	return(im);
+}
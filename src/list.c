@@ -101,6 +101,7 @@ void real_loadables_mode(int loadable)
 				ret = 1;
 			}
 			gib_imlib_free_image_and_decache(im);
+			feh_tile_cache_release(file);
 		} else {
 			/* Oh dear. */
 			if (!loadable) {
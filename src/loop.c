@@ -0,0 +1,305 @@
+/* loop.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+
+/*
+ * File descriptor sources of the main loop.
+ *
+ * Every file descriptor feh waits for (X connection, stdin, inotify,
+ * workers, ...) is registered with feh_loop_watch. feh_loop_wait blocks
+ * until at least one of them is readable or a deadline has passed, and
+ * then calls the handlers of all sources which are ready, not just the
+ * first one.
+ *
+ * With HAVE_EPOLL, this uses epoll, a timerfd for the deadline of the next
+ * timer, a signalfd for SIGUSR1 / SIGUSR2 (so that their handlers no longer
+ * run inside a signal handler) and an eventfd for feh_loop_wakeup.
+ * Otherwise, select() and a self-pipe are used.
+ */
+
+#include "feh.h"
+#include "loop.h"
+#include "signals.h"
+#include "timers.h"
+#include <fcntl.h>
+#include <stdint.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#define LOOP_MAX_EVENTS 32
+#endif
+
+struct feh_loop_watch {
+	feh_loop_func func;	/* may be NULL if the source only has to wake us */
+	void *data;
+	char active;
+};
+
+/* indexed by file descriptor */
+static struct feh_loop_watch *watches = NULL;
+static int watches_size = 0;
+
+static int loop_initialized = 0;
+static int wakeup_rfd = -1;
+static int wakeup_wfd = -1;
+
+#ifdef HAVE_EPOLL
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int signal_fd = -1;
+static sigset_t saved_sigmask;
+static int sigmask_changed = 0;
+#endif
+
+static void feh_loop_drain(void *data __attribute__((unused)))
+{
+	uint64_t buf[8];
+
+	while (read(wakeup_rfd, buf, sizeof(buf)) > 0)
+		;
+}
+
+#ifdef HAVE_EPOLL
+static void feh_loop_read_signals(void *data __attribute__((unused)))
+{
+	struct signalfd_siginfo si;
+
+	while (read(signal_fd, &si, sizeof(si)) == sizeof(si))
+		feh_handle_signal(si.ssi_signo);
+}
+#endif
+
+void feh_loop_init(void)
+{
+#ifdef HAVE_EPOLL
+	sigset_t ss;
+#else
+	int fds[2];
+#endif
+
+	if (loop_initialized)
+		return;
+	loop_initialized = 1;
+
+#ifdef HAVE_EPOLL
+	if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		eprintf("epoll_create1 failed:");
+	if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+		eprintf("timerfd_create failed:");
+	feh_loop_watch(timer_fd, NULL, NULL);
+
+	if ((wakeup_rfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		eprintf("eventfd failed:");
+	wakeup_wfd = wakeup_rfd;
+
+	/*
+	 * SIGUSR1 / SIGUSR2 change slides, which is far too much work for a
+	 * signal handler. Block them and read them from the signalfd instead.
+	 * Exit signals keep their handler: they also have to interrupt work
+	 * done outside of the main loop, such as preloading.
+	 */
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGUSR1);
+	sigaddset(&ss, SIGUSR2);
+	if ((signal_fd = signalfd(-1, &ss, SFD_CLOEXEC | SFD_NONBLOCK)) == -1)
+		weprintf("signalfd failed:");
+	else if (sigprocmask(SIG_BLOCK, &ss, &saved_sigmask) == -1) {
+		weprintf("sigprocmask failed:");
+		close(signal_fd);
+		signal_fd = -1;
+	} else {
+		sigmask_changed = 1;
+		feh_loop_watch(signal_fd, feh_loop_read_signals, NULL);
+	}
+#else
+	if (pipe(fds) == -1)
+		eprintf("pipe failed:");
+	wakeup_rfd = fds[0];
+	wakeup_wfd = fds[1];
+	fcntl(wakeup_rfd, F_SETFL, fcntl(wakeup_rfd, F_GETFL) | O_NONBLOCK);
+	fcntl(wakeup_wfd, F_SETFL, fcntl(wakeup_wfd, F_GETFL) | O_NONBLOCK);
+	fcntl(wakeup_rfd, F_SETFD, FD_CLOEXEC);
+	fcntl(wakeup_wfd, F_SETFD, FD_CLOEXEC);
+#endif
+	feh_loop_watch(wakeup_rfd, feh_loop_drain, NULL);
+}
+
+/*
+ * The signal mask survives fork and exec. Forked children call this before
+ * running another program, so that it does not start with SIGUSR1 and
+ * SIGUSR2 blocked.
+ */
+void feh_loop_child_sigmask(void)
+{
+#ifdef HAVE_EPOLL
+	if (sigmask_changed)
+		sigprocmask(SIG_SETMASK, &saved_sigmask, NULL);
+#endif
+}
+
+void feh_loop_watch(int fd, feh_loop_func func, void *data)
+{
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+#endif
+	int i;
+
+	feh_loop_init();
+
+	if (fd >= watches_size) {
+		i = watches_size;
+		watches_size = MAX(fd + 1, watches_size ? watches_size * 2 : 32);
+		watches = erealloc(watches, watches_size * sizeof(struct feh_loop_watch));
+		memset(watches + i, 0, (watches_size - i) * sizeof(struct feh_loop_watch));
+	}
+
+#ifdef HAVE_EPOLL
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, watches[fd].active ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+				fd, &ev) == -1) {
+		weprintf("cannot watch file descriptor %d:", fd);
+		return;
+	}
+#endif
+
+	watches[fd].func = func;
+	watches[fd].data = data;
+	watches[fd].active = 1;
+}
+
+/*
+ * Must be called before fd is closed. With epoll, a forked worker may still
+ * hold a copy of fd, which would keep it registered otherwise.
+ */
+void feh_loop_unwatch(int fd)
+{
+	if ((fd < 0) || (fd >= watches_size) || !watches[fd].active)
+		return;
+#ifdef HAVE_EPOLL
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+	watches[fd].active = 0;
+}
+
+/* Makes feh_loop_wait return. This is async-signal-safe */
+void feh_loop_wakeup(void)
+{
+	int saved_errno = errno;
+	uint64_t one = 1;
+
+	if ((wakeup_wfd != -1) && (write(wakeup_wfd, &one, sizeof(one)) == -1)) {
+		/* a full pipe will wake up the loop all the same */
+	}
+	errno = saved_errno;
+}
+
+static void feh_loop_dispatch(int fd)
+{
+	/* an earlier handler in the same wakeup may have removed it */
+	if ((fd < watches_size) && watches[fd].active && watches[fd].func)
+		watches[fd].func(watches[fd].data);
+}
+
+/*
+ * Waits until a watched file descriptor becomes readable or deadline (in
+ * feh_get_time seconds, 0 for none) has passed, and calls the handlers of
+ * all sources which are ready. Signals may cause an early return.
+ */
+void feh_loop_wait(double deadline)
+{
+#ifdef HAVE_EPOLL
+	struct epoll_event events[LOOP_MAX_EVENTS];
+	struct itimerspec its;
+	uint64_t expirations;
+	int i, n;
+
+	feh_loop_init();
+
+	memset(&its, 0, sizeof(its));
+	if (deadline > 0.0) {
+		its.it_value.tv_sec = (time_t) deadline;
+		its.it_value.tv_nsec = (long) ((deadline - its.it_value.tv_sec) * 1000000000);
+		/* all zero would disarm the timer */
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+	if ((n = epoll_wait(epoll_fd, events, LOOP_MAX_EVENTS, -1)) == -1) {
+		if (errno != EINTR)
+			eprintf("epoll_wait failed:");
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		if (events[i].data.fd == timer_fd) {
+			if (read(timer_fd, &expirations, sizeof(expirations)) == -1) {
+				/* only the readiness matters */
+			}
+		} else
+			feh_loop_dispatch(events[i].data.fd);
+	}
+#else
+	struct timeval tval, *timeout = NULL;
+	fd_set fdset;
+	double t;
+	int fd, fdsize = 0, count;
+
+	feh_loop_init();
+
+	FD_ZERO(&fdset);
+	for (fd = 0; fd < watches_size; fd++) {
+		if (watches[fd].active) {
+			FD_SET(fd, &fdset);
+			fdsize = fd + 1;
+		}
+	}
+
+	if (deadline > 0.0) {
+		t = MAX(deadline - feh_get_time(), 0.0);
+		tval.tv_sec = (long) t;
+		tval.tv_usec = (long) ((t - ((double) tval.tv_sec)) * 1000000);
+		timeout = &tval;
+	}
+
+	errno = 0;
+	count = select(fdsize, &fdset, NULL, NULL, timeout);
+	if ((count < 0)
+			&& ((errno == ENOMEM) || (errno == EINVAL)
+				|| (errno == EBADF)))
+		eprintf("Connection to X display lost");
+
+	for (fd = 0; (count > 0) && (fd < fdsize); fd++) {
+		if (FD_ISSET(fd, &fdset)) {
+			feh_loop_dispatch(fd);
+			count--;
+		}
+	}
+#endif
+}
@@ -32,6 +32,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "events.h"
 #include "signals.h"
 #include "wallpaper.h"
+#include "worker.h"
+#include "loop.h"
 #include <termios.h>
 #include <stdbool.h>
 
@@ -67,8 +69,12 @@ int main(int argc, char **argv)
 	srandom(getpid() * time(NULL) % ((unsigned int) -1));
 
 	setup_signal_handlers();
+	feh_loop_init();
 	init_parse_options(argc, argv);
 
+	/* before any worker is forked, see convpool.c */
+	if (opt.conversion_timeout >= 0)
+		feh_conversion_pool_init();
 
 	init_imlib_fonts();
 
@@ -121,18 +127,30 @@ int main(int argc, char **argv)
 	return(sig_exit);
 }
 
+static void feh_main_handle_stdin(void *data __attribute__((unused)))
+{
+	feh_event_handle_stdin();
+}
+
+#ifdef HAVE_INOTIFY
+static void feh_main_handle_inotify(void *data __attribute__((unused)))
+{
+	feh_event_handle_inotify();
+}
+#endif
+
+/* Don't do timers if we're zooming/panning/etc or if we are paused */
+static int feh_main_timers_active(void)
+{
+	return((opt.mode == MODE_NORMAL) && !opt.paused);
+}
+
 /* Return 0 to stop iterating, 1 if ok to continue. */
 int feh_main_iteration(int block)
 {
 	static int first = 1;
-	static int xfd = 0;
-	static int fdsize = 0;
-	static double pt = 0.0;
+	static int stdin_watched = 0;
 	XEvent ev;
-	struct timeval tval;
-	fd_set fdset;
-	int count = 0;
-	double t1 = 0.0, t2 = 0.0;
 	fehtimer ft;
 
 	if (window_num == 0 || sig_exit != 0)
@@ -140,29 +158,33 @@ int feh_main_iteration(int block)
 
 	if (first) {
 		/* Only need to set these up the first time */
-		xfd = ConnectionNumber(disp);
-		fdsize = xfd + 1;
-		pt = feh_get_time();
+		feh_loop_watch(ConnectionNumber(disp), NULL, NULL);
 		first = 0;
 		/*
 		 * Only accept commands from stdin if
 		 * - stdin is a terminal (otherwise it's probably used as an image / filelist)
 		 * - we aren't running in multiwindow mode (cause it's not clear which
 		 *   window commands should be applied to in that case)
+		 * - stdin does not carry an --stdin-stream
 		 * - we're in the same process group as stdin, AKA we're not running
 		 *   in the background. Background processes are stopped with SIGTTOU
 		 *   if they try to write to stdout or change terminal attributes. They
 		 *   also don't get input from stdin anyway.
 		 */
-		if (isatty(STDIN_FILENO) && !opt.multiwindow && getpgrp() == (tcgetpgrp(STDIN_FILENO))) {
+		if (isatty(STDIN_FILENO) && !opt.multiwindow && !opt.stdin_stream
+				&& getpgrp() == (tcgetpgrp(STDIN_FILENO))) {
 			setup_stdin();
 		}
+		if (control_via_stdin) {
+			feh_loop_watch(STDIN_FILENO, feh_main_handle_stdin, NULL);
+			stdin_watched = 1;
+		}
+#ifdef HAVE_INOTIFY
+		if (opt.auto_reload)
+			feh_loop_watch(opt.inotify_fd, feh_main_handle_inotify, NULL);
+#endif
 	}
 
-	/* Timers */
-	t1 = feh_get_time();
-	t2 = t1 - pt;
-	pt = t1;
 	while (XPending(disp)) {
 		XNextEvent(disp, &ev);
 		if (ev_handler[ev.type])
@@ -175,90 +197,37 @@ int feh_main_iteration(int block)
 
 	feh_redraw_menus();
 
-	FD_ZERO(&fdset);
-	FD_SET(xfd, &fdset);
-	if (control_via_stdin) {
-		FD_SET(STDIN_FILENO, &fdset);
+	/* SIGTTIN: we were backgrounded and lost stdin */
+	if (stdin_watched && !control_via_stdin) {
+		feh_loop_unwatch(STDIN_FILENO);
+		stdin_watched = 0;
 	}
-#ifdef HAVE_INOTIFY
-    if (opt.auto_reload) {
-        FD_SET(opt.inotify_fd, &fdset);
-        if (opt.inotify_fd >= fdsize)
-            fdsize = opt.inotify_fd + 1;
-    }
-#endif
 
 	/* Timers */
-	ft = first_timer;
-	/* Don't do timers if we're zooming/panning/etc or if we are paused */
-	if (ft && (opt.mode == MODE_NORMAL) && !opt.paused) {
-		D(("There are timers in the queue\n"));
-		if (ft->just_added) {
-			D(("The first timer has just been added\n"));
-			D(("ft->in = %f\n", ft->in));
-			ft->just_added = 0;
-			t1 = ft->in;
-		} else {
-			D(("The first timer was not just added\n"));
-			t1 = ft->in - t2;
-			if (t1 < 0.0)
-				t1 = 0.0;
-			ft->in = t1;
-		}
+	if (feh_main_timers_active()) {
+		feh_resume_timers();
+		ft = feh_next_timer();
+	} else {
+		feh_suspend_timers();
+		ft = NULL;
+	}
 
+	if (ft) {
 		XSync(disp, False);
-		D(("I next need to action a timer in %f seconds\n", t1));
-		/* Only do a blocking select if there's a timer due, or no events
-		   waiting */
-		if (t1 == 0.0 || (block && !XPending(disp))) {
-			tval.tv_sec = (long) t1;
-			tval.tv_usec = (long) ((t1 - ((double) tval.tv_sec)) * 1000000);
-			if (tval.tv_sec < 0)
-				tval.tv_sec = 0;
-			if (tval.tv_usec <= 1000)
-				tval.tv_usec = 1000;
-			errno = 0;
-			D(("Performing blocking select - waiting for timer or event\n"));
-			count = select(fdsize, &fdset, NULL, NULL, &tval);
-			if ((count < 0)
-					&& ((errno == ENOMEM) || (errno == EINVAL)
-						|| (errno == EBADF)))
-				eprintf("Connection to X display lost");
-			if (count == 0) {
-				/* This means the timer is due to be executed. If count was > 0,
-				   that would mean an X event had woken us, we're not interested
-				   in that */
-				feh_handle_timer();
-			}
-			/*
-			 * Beware: If stdin is not connected, we may end up with xfd == 0.
-			 * However, STDIN_FILENO == 0 holds as well in most cases. So we must
-			 * check control_via_stdin to avoid mistaking an X11 event for stdin.
-			 */
-			else if ((count > 0) && control_via_stdin && (FD_ISSET(STDIN_FILENO, &fdset)))
-				feh_event_handle_stdin();
-#ifdef HAVE_INOTIFY
-			else if ((count > 0) && (FD_ISSET(opt.inotify_fd, &fdset)))
-                feh_event_handle_inotify();
-#endif
-		}
-	} else {
-		/* Don't block if there are events in the queue. That's a bit rude ;-) */
-		if (block && !XPending(disp)) {
-			errno = 0;
-			D(("Performing blocking select - no timers, or zooming\n"));
-			count = select(fdsize, &fdset, NULL, NULL, NULL);
-			if ((count < 0)
-					&& ((errno == ENOMEM) || (errno == EINVAL)
-						|| (errno == EBADF)))
-				eprintf("Connection to X display lost");
-			else if ((count > 0) && control_via_stdin && (FD_ISSET(STDIN_FILENO, &fdset)))
-				feh_event_handle_stdin();
-#ifdef HAVE_INOTIFY
-			else if ((count > 0) && (FD_ISSET(opt.inotify_fd, &fdset)))
-                feh_event_handle_inotify();
-#endif
-		}
+		D(("I next need to action a timer in %f seconds\n",
+					ft->when - feh_get_time()));
+	}
+
+	/* Only wait if there's a timer due, or no events waiting */
+	if ((ft && (ft->when <= feh_get_time())) || (block && !XPending(disp))) {
+		feh_loop_wait(ft ? ft->when : 0.0);
+		/*
+		 * The handlers which just ran may have replaced the timer or
+		 * paused the slideshow, so check again.
+		 */
+		if (feh_main_timers_active() && (ft = feh_next_timer())
+				&& (ft->when <= feh_get_time()))
+			feh_handle_timer();
 	}
 	if (window_num == 0 || sig_exit != 0)
 		return(0);
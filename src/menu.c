@@ -1278,36 +1278,42 @@ void feh_menu_cb(feh_menu * m, feh_menu_item * i, int action, unsigned short dat
 			break;
 		case CB_SORT_FILENAME:
 			filelist = gib_list_sort(filelist, feh_cmp_filename);
+			feh_filelist_changed();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_IMAGENAME:
 			filelist = gib_list_sort(filelist, feh_cmp_name);
+			feh_filelist_changed();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_DIRNAME:
 			filelist = gib_list_sort(filelist, feh_cmp_dirname);
+			feh_filelist_changed();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_MTIME:
 			filelist = gib_list_sort(filelist, feh_cmp_mtime);
+			feh_filelist_changed();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_FILESIZE:
 			filelist = gib_list_sort(filelist, feh_cmp_size);
+			feh_filelist_changed();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_RANDOMIZE:
 			filelist = gib_list_randomize(filelist);
+			feh_filelist_changed();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
@@ -70,6 +70,9 @@ void init_parse_options(int argc, char **argv)
 
 	opt.screen_clip = 1;
 	opt.cache_size = 4;
+	opt.prefetch_memory = 256;
+	opt.jobs = 1;
+	opt.pyramid_threshold = 64;
 #ifdef HAVE_LIBXINERAMA
 	/* if we're using xinerama, then enable it by default */
 	opt.xinerama = 1;
@@ -100,8 +103,8 @@ void init_parse_options(int argc, char **argv)
 
 	D(("Options parsed\n"));
 
-	filelist_len = gib_list_length(filelist);
-	if (!filelist_len)
+	feh_filelist_changed();
+	if (!feh_filelist_length())
 		show_mini_usage();
 
 	check_options();
@@ -437,6 +440,18 @@ static void feh_parse_option_array(int argc, char **argv, int finalrun)
 		{"class"         , 1, 0, OPTION_class},
 		{"no-conversion-cache", 0, 0, OPTION_no_conversion_cache},
 		{"window-id", 1, 0, OPTION_window_id},
+		{"prefetch"      , 1, 0, OPTION_prefetch},
+		{"prefetch-memory", 1, 0, OPTION_prefetch_memory},
+		{"jobs"          , 1, 0, OPTION_jobs},
+		{"info-cache"    , 0, 0, OPTION_info_cache},
+		{"conversion-cache-size", 1, 0, OPTION_conversion_cache_size},
+		{"conversion-jobs", 1, 0, OPTION_conversion_jobs},
+		{"stdin-stream"  , 0, 0, OPTION_stdin_stream},
+		{"pyramid-threshold", 1, 0, OPTION_pyramid_threshold},
+		{"out-of-core"   , 1, 0, OPTION_out_of_core},
+#ifdef HAVE_LIBJPEG
+		{"embedded-thumbnails", 0, 0, OPTION_embedded_thumbnails},
+#endif
 		{0, 0, 0, 0}
 	};
 	int optch = 0, cmdx = 0;
@@ -849,6 +864,57 @@ static void feh_parse_option_array(int argc, char **argv, int finalrun)
 				opt.zoom_rate = 1 + ((float)opt.zoom_rate / 100);
 			}
 			break;
+		case OPTION_prefetch:
+			opt.prefetch_behind = 0;
+			if (sscanf(optarg, "%d,%d", &opt.prefetch_ahead,
+						&opt.prefetch_behind) < 1)
+				weprintf("Unrecognized prefetch depth \"%s\"\n", optarg);
+			if (opt.prefetch_ahead < 0)
+				opt.prefetch_ahead = 0;
+			if (opt.prefetch_behind < 0)
+				opt.prefetch_behind = 0;
+			break;
+		case OPTION_prefetch_memory:
+			opt.prefetch_memory = atoi(optarg);
+			if (opt.prefetch_memory < 0)
+				opt.prefetch_memory = 0;
+			break;
+		case OPTION_jobs:
+			opt.jobs = atoi(optarg);
+			if (opt.jobs < 0)
+				opt.jobs = 0;
+			break;
+		case OPTION_info_cache:
+			opt.info_cache = 1;
+			break;
+		case OPTION_conversion_cache_size:
+			opt.conversion_cache_size = atoi(optarg);
+			if (opt.conversion_cache_size < 0)
+				opt.conversion_cache_size = 0;
+			break;
+		case OPTION_conversion_jobs:
+			opt.conversion_jobs = atoi(optarg);
+			if (opt.conversion_jobs < 0)
+				opt.conversion_jobs = 0;
+			break;
+		case OPTION_stdin_stream:
+			opt.stdin_stream = 1;
+			break;
+		case OPTION_pyramid_threshold:
+			opt.pyramid_threshold = atoi(optarg);
+			if (opt.pyramid_threshold < 0)
+				opt.pyramid_threshold = 0;
+			break;
+		case OPTION_out_of_core:
+			opt.out_of_core = atoi(optarg);
+			if (opt.out_of_core < 0)
+				opt.out_of_core = 0;
+			break;
+#ifdef HAVE_LIBJPEG
+		case OPTION_embedded_thumbnails:
+			opt.embedded_thumbnails = 1;
+			break;
+#endif
 		default:
 			break;
 		}
@@ -865,11 +931,14 @@ static void feh_parse_option_array(int argc, char **argv, int finalrun)
 		}
 	}
 	else if (finalrun && !opt.filelistfile && !opt.bgmode) {
+		/* --stdin-stream implies "feh -" */
+		if (opt.stdin_stream) {
+			add_file_to_filelist_recursively("-", FILELIST_FIRST);
 		/*
 		 * if --start-at is a non-local URL (i.e., does not start with file:///),
 		 * behave as if "feh URL" was called (there is no directory we can load)
 		 */
-		if (opt.start_list_at && path_is_url(opt.start_list_at) && (strlen(opt.start_list_at) <= 8 || strncmp(opt.start_list_at, "file:///", 8) != 0)) {
+		} else if (opt.start_list_at && path_is_url(opt.start_list_at) && (strlen(opt.start_list_at) <= 8 || strncmp(opt.start_list_at, "file:///", 8) != 0)) {
 			add_file_to_filelist_recursively(opt.start_list_at, FILELIST_FIRST);
 		/*
 		 * Otherwise, make "feh --start-at dir/file.jpg" behave like
@@ -959,6 +1028,10 @@ static void show_version(void)
 		"debug "
 #endif
 
+#ifdef HAVE_EPOLL
+		"epoll "
+#endif
+
 #ifdef HAVE_LIBEXIF
 		"exif "
 #endif
@@ -971,6 +1044,10 @@ static void show_version(void)
 		"help "
 #endif
 
+#ifdef HAVE_LIBJPEG
+		"jpeg "
+#endif
+
 #if _FILE_OFFSET_BITS == 64
 		"stat64 "
 #endif
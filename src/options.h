@@ -86,6 +86,12 @@ struct __fehoptions {
 	unsigned char insecure_ssl;
 	unsigned char filter_by_dimensions;
 	unsigned char edit;
+	unsigned char info_cache;
+	int conversion_cache_size;
+#ifdef HAVE_LIBJPEG
+	unsigned char embedded_thumbnails;
+#endif
+	unsigned char stdin_stream;
 
 	char *output_file;
 	char *output_dir;
@@ -139,6 +145,26 @@ struct __fehoptions {
 	// imlib cache size in mebibytes
 	int cache_size;
 
+	// slideshow decode-ahead: entries after / before the current one
+	int prefetch_ahead;
+	int prefetch_behind;
+	// memory available to decoded look-ahead images in mebibytes
+	int prefetch_memory;
+
+	// number of worker processes for index/montage/thumbnail mode and
+	// preloading, 0 = auto
+	int jobs;
+
+	// maximum number of concurrent ImageMagick / dcraw processes,
+	// 0 = same as jobs
+	int conversion_jobs;
+
+	// minimum image size in megapixels for the tile pyramid, 0 = never
+	int pyramid_threshold;
+
+	// minimum image size in megapixels for the on-disk tile cache, 0 = never
+	int out_of_core;
+
 	unsigned int min_width, min_height, max_width, max_height;
 
 	unsigned char mode;
@@ -254,6 +280,16 @@ OPTION_auto_reload,
 OPTION_class,
 OPTION_no_conversion_cache,
 OPTION_window_id,
+OPTION_prefetch,
+OPTION_prefetch_memory,
+OPTION_jobs,
+OPTION_info_cache,
+OPTION_embedded_thumbnails,
+OPTION_conversion_cache_size,
+OPTION_conversion_jobs,
+OPTION_stdin_stream,
+OPTION_pyramid_threshold,
+OPTION_out_of_core,
 };
 
 //typedef enum __fehoption fehoption;
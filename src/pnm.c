@@ -0,0 +1,269 @@
+/* pnm.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * Decoder for the uncompressed PAM (P7) and binary PGM / PPM (P5 / P6)
+ * formats. ImageMagick and dcraw hand their results to feh in one of these,
+ * which can be turned into an Imlib2 image without any intermediate file.
+ */
+
+#include "feh.h"
+
+struct pnm_header {
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	unsigned int maxval;
+	int has_alpha;
+};
+
+/* Skips whitespace and comments, then reads an unsigned decimal number */
+static int pnm_read_uint(unsigned char **pos, unsigned char *end, unsigned int *value)
+{
+	unsigned char *p = *pos;
+	unsigned long v = 0;
+
+	while (p < end && (isspace(*p) || *p == '#')) {
+		if (*p == '#')
+			while (p < end && *p != '\n')
+				p++;
+		else
+			p++;
+	}
+	if (p == end || !isdigit(*p))
+		return(0);
+	while (p < end && isdigit(*p)) {
+		v = v * 10 + (*p++ - '0');
+		if (v > 0xffffffffUL)
+			return(0);
+	}
+	*value = v;
+	*pos = p;
+	return(1);
+}
+
+/* Parses a P5 / P6 header. Exactly one whitespace byte precedes the raster */
+static unsigned char *pnm_parse_pnm(unsigned char *p, unsigned char *end,
+		struct pnm_header *hdr, int color)
+{
+	hdr->depth = color ? 3 : 1;
+	hdr->has_alpha = 0;
+	if (!pnm_read_uint(&p, end, &hdr->width)
+			|| !pnm_read_uint(&p, end, &hdr->height)
+			|| !pnm_read_uint(&p, end, &hdr->maxval)
+			|| p == end || !isspace(*p))
+		return(NULL);
+	return(p + 1);
+}
+
+/* Parses a P7 header, which consists of "KEY value" lines up to ENDHDR */
+static unsigned char *pnm_parse_pam(unsigned char *p, unsigned char *end,
+		struct pnm_header *hdr)
+{
+	unsigned char *eol;
+	char line[64];
+	size_t len;
+
+	hdr->width = hdr->height = hdr->depth = hdr->maxval = 0;
+	hdr->has_alpha = 0;
+
+	while (p < end) {
+		if (!(eol = memchr(p, '\n', end - p)))
+			return(NULL);
+		len = eol - p;
+		if (len >= sizeof(line))
+			len = sizeof(line) - 1;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		p = eol + 1;
+
+		if (!strcmp(line, "ENDHDR"))
+			return(p);
+		else if (!strncmp(line, "WIDTH ", 6))
+			hdr->width = atoi(line + 6);
+		else if (!strncmp(line, "HEIGHT ", 7))
+			hdr->height = atoi(line + 7);
+		else if (!strncmp(line, "DEPTH ", 6))
+			hdr->depth = atoi(line + 6);
+		else if (!strncmp(line, "MAXVAL ", 7))
+			hdr->maxval = atoi(line + 7);
+		else if (!strncmp(line, "TUPLTYPE ", 9))
+			hdr->has_alpha = (strstr(line, "_ALPHA") != NULL);
+	}
+	return(NULL);
+}
+
+/*
+ * Parses the PAM / PGM / PPM header at the start of data. Returns a pointer
+ * to the raster, whose size is stored in raster_size, or NULL if data does
+ * not start with a complete and supported header.
+ */
+static unsigned char *pnm_parse(unsigned char *data, size_t len,
+		struct pnm_header *hdr, size_t *raster_size)
+{
+	unsigned char *end = data + len, *p;
+
+	if (len < 3 || data[0] != 'P')
+		return(NULL);
+
+	if (data[1] == '7' && data[2] == '\n')
+		p = pnm_parse_pam(data + 3, end, hdr);
+	else if (data[1] == '5' || data[1] == '6')
+		p = pnm_parse_pnm(data + 2, end, hdr, data[1] == '6');
+	else
+		return(NULL);
+
+	if (!p || !hdr->width || !hdr->height || hdr->width > 1000000 || hdr->height > 1000000
+			|| !hdr->maxval || hdr->maxval > 65535
+			|| hdr->depth < 1 || hdr->depth > 4)
+		return(NULL);
+
+	/* GRAYSCALE and RGB only have alpha when extended by one channel */
+	if (hdr->has_alpha && hdr->depth != 2 && hdr->depth != 4)
+		hdr->has_alpha = 0;
+
+	*raster_size = (size_t)hdr->width * hdr->height * hdr->depth
+		* ((hdr->maxval > 255) ? 2 : 1);
+	return(p);
+}
+
+/*
+ * Returns the total size (header and raster) of the PAM / PGM / PPM image
+ * at the start of data, or 0 if data does not start with a complete header.
+ * The raster itself may still be incomplete.
+ */
+size_t feh_pnm_size(unsigned char *data, size_t len)
+{
+	struct pnm_header hdr;
+	size_t raster_size;
+	unsigned char *p;
+
+	if (!(p = pnm_parse(data, len, &hdr, &raster_size)))
+		return(0);
+	return((p - data) + raster_size);
+}
+
+/* Converts the row of samples at p to ARGB pixels. Returns the next row */
+static unsigned char *pnm_convert_row(struct pnm_header *hdr, unsigned char *p,
+		DATA32 *pixel)
+{
+	unsigned int x, c, bps = (hdr->maxval > 255) ? 2 : 1, samples[4];
+
+	for (x = 0; x < hdr->width; x++) {
+		for (c = 0; c < hdr->depth; c++) {
+			samples[c] = (bps == 2) ? (p[0] << 8 | p[1]) : p[0];
+			p += bps;
+			if (hdr->maxval != 255)
+				samples[c] = samples[c] * 255 / hdr->maxval;
+		}
+		if (hdr->depth <= 2)
+			*pixel++ = (hdr->has_alpha ? samples[1] << 24 : 0xff000000)
+				| (samples[0] << 16) | (samples[0] << 8) | samples[0];
+		else
+			*pixel++ = (hdr->has_alpha ? samples[3] << 24 : 0xff000000)
+				| (samples[0] << 16) | (samples[1] << 8) | samples[2];
+	}
+	return(p);
+}
+
+/*
+ * Returns the header of the PAM / PGM / PPM image in data and a pointer to
+ * its raster, or NULL if data is not in one of these formats or truncated.
+ */
+static unsigned char *pnm_parse_complete(unsigned char *data, size_t len,
+		struct pnm_header *hdr)
+{
+	unsigned char *p;
+	size_t raster_size;
+
+	if (!(p = pnm_parse(data, len, hdr, &raster_size)))
+		return(NULL);
+	if ((size_t)(data + len - p) < raster_size) {
+		D(("PNM raster truncated: %zu of %zu bytes\n", (size_t)(data + len - p), raster_size));
+		return(NULL);
+	}
+	return(p);
+}
+
+/*
+ * Decodes the PAM / PGM / PPM image in data. Returns NULL if data is not in
+ * one of these formats or is truncated.
+ */
+Imlib_Image feh_pnm_load_mem(unsigned char *data, size_t len)
+{
+	struct pnm_header hdr;
+	unsigned char *p;
+	unsigned int y;
+	DATA32 *pixels;
+	Imlib_Image im;
+
+	if (!(p = pnm_parse_complete(data, len, &hdr)))
+		return(NULL);
+	if (hdr.width > 32767 || hdr.height > 32767)
+		return(NULL);
+
+	if (!(im = imlib_create_image(hdr.width, hdr.height)))
+		return(NULL);
+	imlib_context_set_image(im);
+	pixels = imlib_image_get_data();
+
+	for (y = 0; y < hdr.height; y++)
+		p = pnm_convert_row(&hdr, p, pixels + y * hdr.width);
+
+	imlib_context_set_image(im);
+	imlib_image_put_back_data(pixels);
+	imlib_image_set_has_alpha(hdr.has_alpha);
+	imlib_image_set_format("pnm");
+
+	D(("Decoded %ux%u PNM with depth %u, maxval %u\n", hdr.width, hdr.height,
+				hdr.depth, hdr.maxval));
+
+	return(im);
+}
+
+/*
+ * Like feh_pnm_load_mem, but hands the image to sink one row at a time.
+ * Returns 1 on success.
+ */
+int feh_pnm_decode_rows(unsigned char *data, size_t len, struct feh_row_sink *sink)
+{
+	struct pnm_header hdr;
+	unsigned char *p;
+	unsigned int y;
+	DATA32 *row;
+
+	if (!(p = pnm_parse_complete(data, len, &hdr)))
+		return(0);
+	if (!sink->start(sink, hdr.width, hdr.height, hdr.has_alpha))
+		return(0);
+
+	row = emalloc(hdr.width * sizeof(DATA32));
+	for (y = 0; y < hdr.height; y++) {
+		p = pnm_convert_row(&hdr, p, row);
+		sink->row(sink, y, row);
+	}
+	free(row);
+	return(1);
+}
@@ -0,0 +1,345 @@
+/* preview.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * Embedded preview images, used for --embedded-thumbnails and for viewing
+ * RAW files without dcraw.
+ *
+ * Digital cameras store a small JPEG thumbnail in the EXIF data of their
+ * JPEG files, and TIFF-based RAW formats (NEF, CR2, DNG, ARW, PEF, ...)
+ * usually contain one or more JPEG previews next to the sensor data. Both
+ * live in TIFF IFDs, so one IFD walker finds all of them. Only baseline and
+ * progressive JPEG streams are considered, since lossless JPEG is used for
+ * the RAW data itself.
+ */
+
+#include "feh.h"
+#include "probe.h"
+
+#define PREVIEW_MAX 8
+
+struct preview_candidate {
+	long offset;
+	int width;
+	int height;
+};
+
+struct preview_scan {
+	FILE *fh;
+	long size;
+	long base;		/* offset of the TIFF header in the file */
+	int be;
+	int ifds;		/* IFDs visited so far, to stop on loops */
+	int orientation;
+	int width;		/* largest image size mentioned in any IFD */
+	int height;
+	int count;
+	struct preview_candidate cand[PREVIEW_MAX];
+};
+
+static void preview_add(struct preview_scan *scan, unsigned int offset)
+{
+	struct preview_candidate *cand;
+	int sof;
+
+	if (scan->count == PREVIEW_MAX || scan->base + (long)offset >= scan->size)
+		return;
+
+	cand = &scan->cand[scan->count];
+	cand->offset = scan->base + offset;
+	sof = feh_probe_jpeg_sof(scan->fh, cand->offset, &cand->width, &cand->height);
+
+	/* baseline, extended sequential or progressive, Huffman coded */
+	if ((sof >= 0xc0 && sof <= 0xc2) && cand->width && cand->height)
+		scan->count++;
+}
+
+static void preview_tiff_ifd(struct preview_scan *scan, unsigned int offset, int depth);
+
+static void preview_tiff_subifds(struct preview_scan *scan, unsigned int count,
+		unsigned int value, int depth)
+{
+	unsigned char buf[4];
+	unsigned int i;
+
+	if (count == 1) {
+		preview_tiff_ifd(scan, value, depth + 1);
+		return;
+	}
+	for (i = 0; i < count && i < PREVIEW_MAX; i++)
+		if (feh_probe_read_at(scan->fh, scan->base + value + 4 * i, buf, 4))
+			preview_tiff_ifd(scan, feh_probe_get32(buf, scan->be), depth + 1);
+}
+
+static void preview_tiff_ifd(struct preview_scan *scan, unsigned int offset, int depth)
+{
+	unsigned char entry[12];
+	unsigned int tag, type, count, value, i, n;
+	unsigned int width = 0, height = 0, compression = 0, subfile = 0;
+	unsigned int strip = 0, strips = 0, jpeg = 0, jpeg_len = 0;
+	unsigned int subifd_count = 0, subifd = 0;
+
+	for (;;) {
+		if (!offset || depth > 3 || ++scan->ifds > 32
+				|| !feh_probe_read_at(scan->fh, scan->base + offset, entry, 2))
+			return;
+
+		n = feh_probe_get16(entry, scan->be);
+		for (i = 0; i < n; i++) {
+			if (!feh_probe_read_at(scan->fh, scan->base + offset + 2 + 12 * i, entry, 12))
+				return;
+			tag = feh_probe_get16(entry, scan->be);
+			type = feh_probe_get16(entry + 2, scan->be);
+			count = feh_probe_get32(entry + 4, scan->be);
+			/* SHORT values are left-aligned in the value field */
+			value = (type == 3) ? feh_probe_get16(entry + 8, scan->be) : feh_probe_get32(entry + 8, scan->be);
+			switch (tag) {
+			case 254:
+				subfile = value;
+				break;
+			case 256:
+				width = value;
+				break;
+			case 257:
+				height = value;
+				break;
+			case 259:
+				compression = value;
+				break;
+			case 273:
+				strip = value;
+				strips = count;
+				break;
+			case 274:
+				if (!scan->orientation)
+					scan->orientation = value;
+				break;
+			case 330:
+				subifd = value;
+				subifd_count = count;
+				break;
+			case 513:
+				jpeg = value;
+				break;
+			case 514:
+				jpeg_len = value;
+				break;
+			}
+		}
+
+		if (width * height > (unsigned int)(scan->width * scan->height)) {
+			scan->width = width;
+			scan->height = height;
+		}
+
+		if (jpeg && jpeg_len)
+			preview_add(scan, jpeg);
+		/* old-style JPEG, or new-style JPEG in a reduced-resolution IFD */
+		else if (strip && strips == 1
+				&& (compression == 6 || (compression == 7 && (subfile & 1))))
+			preview_add(scan, strip);
+
+		if (subifd_count)
+			preview_tiff_subifds(scan, subifd_count, subifd, depth);
+
+		if (!feh_probe_read_at(scan->fh, scan->base + offset + 2 + 12 * n, entry, 4))
+			return;
+		offset = feh_probe_get32(entry, scan->be);
+		width = height = compression = subfile = 0;
+		strip = strips = jpeg = jpeg_len = subifd_count = subifd = 0;
+	}
+}
+
+static void preview_tiff(struct preview_scan *scan)
+{
+	unsigned char buf[8];
+
+	if (!feh_probe_read_at(scan->fh, scan->base, buf, 8))
+		return;
+	if (!memcmp(buf, "II", 2))
+		scan->be = 0;
+	else if (!memcmp(buf, "MM", 2))
+		scan->be = 1;
+	else
+		return;
+
+	preview_tiff_ifd(scan, feh_probe_get32(buf + 4, scan->be), 0);
+}
+
+/*
+ * JPEG files carry their EXIF data in an APP1 segment, which is a complete
+ * TIFF structure. The thumbnail is referenced from its second IFD.
+ */
+static void preview_jpeg(struct preview_scan *scan)
+{
+	unsigned char seg[8];
+	long offset = 2;
+	int c, width, height;
+
+	if (!feh_probe_jpeg_sof(scan->fh, 0, &width, &height))
+		return;
+
+	while ((c = feh_probe_jpeg_next(scan->fh, &offset, seg, 8))) {
+		if (c == 0xe1 && !memcmp(seg + 2, "Exif\0\0", 6)) {
+			scan->base = ftell(scan->fh);
+			preview_tiff(scan);
+			break;
+		}
+	}
+
+	/* the SOF is authoritative, EXIF sizes are often bogus */
+	scan->width = width;
+	scan->height = height;
+}
+
+/*
+ * Opens filename (or reads it from mf, if it has been read already) and
+ * collects its embedded previews. With tiff_only, JPEG files are ignored.
+ * Returns 0 (with scan->fh closed) if there are none.
+ */
+static int preview_scan_file(struct preview_scan *scan, char *filename,
+		struct feh_mapped_file *mf, int tiff_only)
+{
+	unsigned char magic[4];
+
+	memset(scan, 0, sizeof(struct preview_scan));
+
+	if (mf)
+		scan->fh = fmemopen(mf->data, mf->size, "rb");
+	else
+		scan->fh = fopen(filename, "rb");
+	if (!scan->fh)
+		return(0);
+
+	if (fseek(scan->fh, 0, SEEK_END) == 0)
+		scan->size = ftell(scan->fh);
+
+	if (feh_probe_read_at(scan->fh, 0, magic, 4)) {
+		if (magic[0] == 0xff && magic[1] == 0xd8 && !tiff_only)
+			preview_jpeg(scan);
+		/* TIFF and TIFF-based RAW formats, including ORF ("IIRO") */
+		else if (!memcmp(magic, "II*\0", 4) || !memcmp(magic, "MM\0*", 4)
+				|| !memcmp(magic, "IIRO", 4) || !memcmp(magic, "IIRS", 4))
+			preview_tiff(scan);
+	}
+
+	if (!scan->count) {
+		fclose(scan->fh);
+		return(0);
+	}
+	return(1);
+}
+
+/*
+ * Loads the smallest embedded preview of filename which is large enough for
+ * a w x h thumbnail and has the same aspect ratio as the image itself.
+ * orig_w / orig_h are set to the size of the full image, orientation to its
+ * EXIF orientation (or 0). Returns NULL if there is no suitable preview.
+ */
+Imlib_Image feh_preview_load(char *filename, int w, int h,
+		int *orig_w, int *orig_h, int *orientation)
+{
+	struct preview_scan scan;
+	struct preview_candidate *best = NULL, *cand;
+	double aspect;
+	int i, box, need_w, need_h;
+	Imlib_Image im = NULL;
+
+	if (!preview_scan_file(&scan, filename, NULL, 0))
+		return(NULL);
+
+	/*
+	 * The thumbnail fits into a box of max(w, h) in either orientation.
+	 * Previews with a different aspect ratio are letterboxed, those are
+	 * no good either.
+	 */
+	if (!scan.width || !scan.height) {
+		scan.width = scan.cand[0].width;
+		scan.height = scan.cand[0].height;
+	}
+	box = (w > h) ? w : h;
+	if (scan.width >= scan.height) {
+		need_w = (scan.width < box) ? scan.width : box;
+		need_h = (long)need_w * scan.height / scan.width;
+	} else {
+		need_h = (scan.height < box) ? scan.height : box;
+		need_w = (long)need_h * scan.width / scan.height;
+	}
+
+	for (i = 0; i < scan.count; i++) {
+		cand = &scan.cand[i];
+		aspect = ((double) cand->width / cand->height)
+			/ ((double) scan.width / scan.height);
+		if (aspect < 0.97 || aspect > 1.03)
+			continue;
+		if (cand->width < need_w || cand->height < need_h)
+			continue;
+		if (!best || cand->width * cand->height < best->width * best->height)
+			best = cand;
+	}
+
+	if (best) {
+		D(("Using %dx%d preview at %ld for %s\n", best->width, best->height,
+					best->offset, filename));
+		im = feh_jpeg_load_embedded(scan.fh, best->offset, need_w, need_h);
+	}
+	fclose(scan.fh);
+
+	if (im) {
+		*orig_w = scan.width;
+		*orig_h = scan.height;
+		*orientation = scan.orientation;
+	}
+	return(im);
+}
+
+/*
+ * Loads the largest JPEG preview embedded in a TIFF-based RAW file at its
+ * full size, like dcraw -e does. orientation is set as in feh_preview_load.
+ * mf may hold the contents of filename.
+ */
+Imlib_Image feh_preview_load_largest(char *filename,
+		struct feh_mapped_file *mf, int *orientation)
+{
+	struct preview_scan scan;
+	struct preview_candidate *best;
+	Imlib_Image im;
+	int i;
+
+	if (!preview_scan_file(&scan, filename, mf, 1))
+		return(NULL);
+
+	best = &scan.cand[0];
+	for (i = 1; i < scan.count; i++)
+		if (scan.cand[i].width * scan.cand[i].height > best->width * best->height)
+			best = &scan.cand[i];
+
+	im = feh_jpeg_load_embedded(scan.fh, best->offset, 0, 0);
+	fclose(scan.fh);
+
+	if (im)
+		*orientation = scan.orientation;
+	return(im);
+}
@@ -0,0 +1,401 @@
+/* probe.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * Header-only image probing: determine dimensions, alpha and format of the
+ * most common image formats without decoding any pixel data. The results
+ * must match what Imlib2 reports after a full load, so anything unusual
+ * (where its loaders might behave differently) is left to feh_load_image.
+ */
+
+#include "feh.h"
+#include "filelist.h"
+#include "probe.h"
+
+struct probe_result {
+	int width;
+	int height;
+	int has_alpha;
+	char *format;
+};
+
+unsigned int feh_probe_get16(unsigned char *p, int big_endian)
+{
+	if (big_endian)
+		return((p[0] << 8) | p[1]);
+	return((p[1] << 8) | p[0]);
+}
+
+unsigned int feh_probe_get32(unsigned char *p, int big_endian)
+{
+	if (big_endian)
+		return(((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+	return(((unsigned int)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]);
+}
+
+int feh_probe_read_at(FILE * fh, long offset, unsigned char *buf, size_t len)
+{
+	if (fseek(fh, offset, SEEK_SET) != 0)
+		return(0);
+	return(fread(buf, 1, len, fh) == len);
+}
+
+/*
+ * Reads the JPEG marker segment at *offset. Returns its marker and stores
+ * the first len bytes of the segment (starting with its length) in seg.
+ * *offset is advanced to the next marker, and the file position is left
+ * right behind the bytes read. Returns 0 at the start of the image data,
+ * at its end, or on error.
+ */
+int feh_probe_jpeg_next(FILE * fh, long *offset, unsigned char *seg, size_t len)
+{
+	int c;
+
+	for (;;) {
+		if (fseek(fh, *offset, SEEK_SET) != 0 || fgetc(fh) != 0xff)
+			return(0);
+		while ((c = fgetc(fh)) == 0xff)
+			;
+		if (c == EOF || c == 0xd9 || c == 0xda)
+			return(0);
+		*offset = ftell(fh);
+		/* standalone markers */
+		if (c == 0x01 || (c >= 0xd0 && c <= 0xd8))
+			continue;
+		if (fread(seg, 1, len, fh) != len)
+			return(0);
+		*offset += feh_probe_get16(seg, 1);
+		return(c);
+	}
+}
+
+/*
+ * Finds the SOF marker of the JPEG stream at offset. Returns the marker
+ * (0xc0 .. 0xcf) and sets width / height, or returns 0 on error.
+ */
+int feh_probe_jpeg_sof(FILE * fh, long offset, int *width, int *height)
+{
+	unsigned char seg[7];
+	int c;
+
+	if (!feh_probe_read_at(fh, offset, seg, 2) || seg[0] != 0xff || seg[1] != 0xd8)
+		return(0);
+	offset += 2;
+
+	while ((c = feh_probe_jpeg_next(fh, &offset, seg, 7))) {
+		/* SOF0 .. SOF15, except DHT, JPG and DAC */
+		if (c >= 0xc0 && c <= 0xcf && c != 0xc4 && c != 0xc8 && c != 0xcc) {
+			*height = feh_probe_get16(seg + 3, 1);
+			*width = feh_probe_get16(seg + 5, 1);
+			return(c);
+		}
+	}
+	return(0);
+}
+
+static int probe_png(FILE * fh, unsigned char *buf, struct probe_result *res)
+{
+	unsigned char chunk[8];
+	long offset;
+	unsigned int len;
+
+	if (memcmp(buf + 12, "IHDR", 4))
+		return(0);
+
+	res->width = feh_probe_get32(buf + 16, 1);
+	res->height = feh_probe_get32(buf + 20, 1);
+	/* colour types 4 and 6 carry an alpha channel */
+	res->has_alpha = (buf[25] & 4) ? 1 : 0;
+	res->format = "png";
+
+	/* Imlib2 also treats a tRNS chunk (which precedes IDAT) as alpha */
+	offset = 8 + 8 + feh_probe_get32(buf + 8, 1) + 4;
+	while (!res->has_alpha && feh_probe_read_at(fh, offset, chunk, 8)) {
+		len = feh_probe_get32(chunk, 1);
+		if (!memcmp(chunk + 4, "tRNS", 4))
+			res->has_alpha = 1;
+		else if (!memcmp(chunk + 4, "IDAT", 4) || !memcmp(chunk + 4, "IEND", 4))
+			break;
+		if (len > 0x7fffffff - 12 - offset)
+			return(0);
+		offset += 8 + len + 4;
+	}
+	return(1);
+}
+
+static int probe_jpeg(FILE * fh, struct probe_result *res)
+{
+	if (!feh_probe_jpeg_sof(fh, 0, &res->width, &res->height))
+		return(0);
+	res->has_alpha = 0;
+	/* the name used by Imlib2 1.6 and later, see feh_file_info_load */
+	res->format = "jpg";
+	return(1);
+}
+
+static int probe_gif(FILE * fh, unsigned char *buf, struct probe_result *res)
+{
+	unsigned char block[9];
+	long offset = 13;
+	int c = -1;
+
+	/* global colour table */
+	if (buf[10] & 0x80)
+		offset += 3 << ((buf[10] & 7) + 1);
+
+	res->has_alpha = 0;
+	res->format = "gif";
+
+	/*
+	 * Imlib2 uses the dimensions of the first frame and enables alpha if the
+	 * graphic control extension preceding it has a transparent colour.
+	 */
+	for (;;) {
+		if (!feh_probe_read_at(fh, offset, block, 2))
+			return(0);
+		if (block[0] == 0x2c) {
+			if (!feh_probe_read_at(fh, offset + 1, block, 8))
+				return(0);
+			res->width = feh_probe_get16(block + 4, 0);
+			res->height = feh_probe_get16(block + 6, 0);
+			/* be conservative about frames smaller than the screen */
+			return((res->width == (int)feh_probe_get16(buf + 6, 0))
+				&& (res->height == (int)feh_probe_get16(buf + 8, 0)));
+		}
+		if (block[0] != 0x21)
+			return(0);
+		offset += 2;
+		if (block[1] == 0xf9) {
+			if (!feh_probe_read_at(fh, offset, block, 2))
+				return(0);
+			if (block[1] & 1)
+				res->has_alpha = 1;
+		}
+		/* skip data sub-blocks */
+		while ((fseek(fh, offset, SEEK_SET) == 0) && ((c = fgetc(fh)) > 0))
+			offset += c + 1;
+		if (c != 0)
+			return(0);
+		offset++;
+	}
+}
+
+static int probe_bmp(unsigned char *buf, struct probe_result *res)
+{
+	unsigned int hdr_size = feh_probe_get32(buf + 14, 0);
+	int bpp;
+
+	if (hdr_size == 12) {
+		res->width = feh_probe_get16(buf + 18, 0);
+		res->height = feh_probe_get16(buf + 20, 0);
+		bpp = feh_probe_get16(buf + 24, 0);
+	} else if (hdr_size >= 40) {
+		res->width = (int)feh_probe_get32(buf + 18, 0);
+		res->height = abs((int)feh_probe_get32(buf + 22, 0));
+		bpp = feh_probe_get16(buf + 28, 0);
+	} else
+		return(0);
+
+	/* 32bpp bitmaps may or may not have alpha, depending on the loader */
+	if (bpp > 24)
+		return(0);
+
+	res->has_alpha = 0;
+	res->format = "bmp";
+	return(1);
+}
+
+static int probe_pnm_int(FILE * fh, int *value)
+{
+	int c;
+
+	do {
+		c = fgetc(fh);
+		if (c == '#')
+			while ((c = fgetc(fh)) != EOF && c != '\n')
+				;
+	} while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+	if (c < '0' || c > '9')
+		return(0);
+
+	*value = 0;
+	while (c >= '0' && c <= '9') {
+		if (*value > 0xfffffff)
+			return(0);
+		*value = *value * 10 + (c - '0');
+		c = fgetc(fh);
+	}
+	return(1);
+}
+
+static int probe_pnm(FILE * fh, struct probe_result *res)
+{
+	if (fseek(fh, 2, SEEK_SET) != 0)
+		return(0);
+	if (!probe_pnm_int(fh, &res->width) || !probe_pnm_int(fh, &res->height))
+		return(0);
+	res->has_alpha = 0;
+	res->format = "pnm";
+	return(1);
+}
+
+static int probe_tiff(FILE * fh, unsigned char *buf, struct probe_result *res)
+{
+	int be = (buf[0] == 'M');
+	unsigned char entry[12];
+	unsigned int tag, type, value, count, i;
+	unsigned int photometric = 0, spp = 1, orientation = 1;
+	unsigned int extra = 0, extra_count = 0;
+	long offset = feh_probe_get32(buf + 4, be);
+
+	res->width = res->height = 0;
+
+	if (!feh_probe_read_at(fh, offset, entry, 2))
+		return(0);
+	count = feh_probe_get16(entry, be);
+
+	for (i = 0; i < count; i++) {
+		if (!feh_probe_read_at(fh, offset + 2 + 12 * i, entry, 12))
+			return(0);
+		tag = feh_probe_get16(entry, be);
+		type = feh_probe_get16(entry + 2, be);
+		/* SHORT values are left-aligned in the value field */
+		value = (type == 3) ? feh_probe_get16(entry + 8, be) : feh_probe_get32(entry + 8, be);
+		switch (tag) {
+		case 256:
+			res->width = value;
+			break;
+		case 257:
+			res->height = value;
+			break;
+		case 262:
+			photometric = value;
+			break;
+		case 274:
+			orientation = value;
+			break;
+		case 277:
+			spp = value;
+			break;
+		case 338:
+			extra_count = feh_probe_get32(entry + 4, be);
+			extra = (extra_count == 1) ? value : 0;
+			break;
+		}
+	}
+
+	if (!res->width || !res->height)
+		return(0);
+
+	/* libtiff's RGBA interface, which Imlib2 uses, rotates for us */
+	if (orientation >= 5 && orientation <= 8) {
+		i = res->width;
+		res->width = res->height;
+		res->height = i;
+	}
+
+	/* associated or unassociated alpha; RGB with 4 samples counts as well */
+	res->has_alpha = (extra == 1 || extra == 2)
+		|| (photometric == 2 && spp == 4 && !extra_count);
+	res->format = "tiff";
+	return(1);
+}
+
+static int probe_webp(unsigned char *buf, struct probe_result *res)
+{
+	if (memcmp(buf + 8, "WEBP", 4))
+		return(0);
+
+	if (!memcmp(buf + 12, "VP8X", 4)) {
+		res->has_alpha = (buf[20] & 0x10) ? 1 : 0;
+		res->width = 1 + (buf[24] | (buf[25] << 8) | (buf[26] << 16));
+		res->height = 1 + (buf[27] | (buf[28] << 8) | (buf[29] << 16));
+	} else if (!memcmp(buf + 12, "VP8L", 4) && buf[20] == 0x2f) {
+		res->width = 1 + (buf[21] | ((buf[22] & 0x3f) << 8));
+		res->height = 1 + ((buf[22] >> 6) | (buf[23] << 2) | ((buf[24] & 0x0f) << 10));
+		res->has_alpha = (buf[24] & 0x10) ? 1 : 0;
+	} else if (!memcmp(buf + 12, "VP8 ", 4) && !memcmp(buf + 23, "\x9d\x01\x2a", 3)) {
+		res->width = feh_probe_get16(buf + 26, 0) & 0x3fff;
+		res->height = feh_probe_get16(buf + 28, 0) & 0x3fff;
+		res->has_alpha = 0;
+	} else
+		return(0);
+
+	res->format = "webp";
+	return(1);
+}
+
+/*
+ * Fills in width, height, pixels, has_alpha and format of info by looking
+ * at the file header. Returns 1 on success, 0 if the format is not
+ * supported or the header looks odd. In that case, the caller should fall
+ * back to loading the image.
+ */
+int feh_file_info_probe(feh_file * file, feh_file_info * info)
+{
+	unsigned char buf[32];
+	struct probe_result res;
+	FILE *fh;
+	int ok = 0;
+
+	if (!(fh = fopen(file->filename, "r")))
+		return(0);
+
+	memset(buf, 0, sizeof(buf));
+	if (fread(buf, 1, sizeof(buf), fh) < 8) {
+		fclose(fh);
+		return(0);
+	}
+
+	memset(&res, 0, sizeof(res));
+
+	if (!memcmp(buf, "\x89PNG\x0d\x0a\x1a\x0a", 8))
+		ok = probe_png(fh, buf, &res);
+	else if (buf[0] == 0xff && buf[1] == 0xd8)
+		ok = probe_jpeg(fh, &res);
+	else if (!memcmp(buf, "GIF87a", 6) || !memcmp(buf, "GIF89a", 6))
+		ok = probe_gif(fh, buf, &res);
+	else if (buf[0] == 'B' && buf[1] == 'M')
+		ok = probe_bmp(buf, &res);
+	else if (buf[0] == 'P' && buf[1] >= '1' && buf[1] <= '6')
+		ok = probe_pnm(fh, &res);
+	else if (!memcmp(buf, "II\x2a\x00", 4) || !memcmp(buf, "MM\x00\x2a", 4))
+		ok = probe_tiff(fh, buf, &res);
+	else if (!memcmp(buf, "RIFF", 4))
+		ok = probe_webp(buf, &res);
+
+	fclose(fh);
+
+	if (!ok || res.width <= 0 || res.height <= 0)
+		return(0);
+
+	info->width = res.width;
+	info->height = res.height;
+	info->pixels = res.width * res.height;
+	info->has_alpha = res.has_alpha;
+	info->format = estrdup(res.format);
+	return(1);
+}
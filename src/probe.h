@@ -0,0 +1,40 @@
+/* probe.h
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef PROBE_H
+#define PROBE_H
+
+/*
+ * Helpers for parsing image headers, shared by probe.c and preview.c.
+ * Offsets are absolute file positions.
+ */
+
+unsigned int feh_probe_get16(unsigned char *p, int big_endian);
+unsigned int feh_probe_get32(unsigned char *p, int big_endian);
+int feh_probe_read_at(FILE * fh, long offset, unsigned char *buf, size_t len);
+int feh_probe_jpeg_next(FILE * fh, long *offset, unsigned char *seg, size_t len);
+int feh_probe_jpeg_sof(FILE * fh, long offset, int *width, int *height);
+
+#endif
@@ -0,0 +1,302 @@
+/* pyramid.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+
+/*
+ * Tile pyramid for zoomed-out views of very large images
+ * (--pyramid-threshold).
+ *
+ * Level n of the pyramid is the image reduced to 1/2^n of its size, split
+ * into FEH_TILE_SIZE x FEH_TILE_SIZE tiles. A tile is only created when it is
+ * first shown, by averaging 2x2 pixel blocks of the four tiles below it
+ * (or of the image itself for level 1). Rendering at a zoom of less than
+ * 1/2 uses the level closest to, but no smaller than, the displayed size,
+ * and only touches the tiles which are visible. So once a level has been
+ * built, Imlib2 never has to scale down more than twice the visible area.
+ * Zooms of 1/2 and up do not benefit from this, as Imlib2 already renders
+ * only the visible part of the image.
+ */
+
+#include "feh.h"
+#include "options.h"
+#include "winwidget.h"
+
+struct feh_pyramid_level {
+	int w, h;
+	int cols, rows;
+	Imlib_Image *tiles;
+};
+
+struct feh_pyramid {
+	Imlib_Image im;		/* the image this pyramid was built for */
+	int has_alpha;
+	int num_levels;		/* including level 0, the image itself */
+	struct feh_pyramid_level *levels;
+};
+
+struct feh_pyramid_pos {
+	struct feh_pyramid *p;
+	int level;
+};
+
+/*
+ * Writes src (w x h pixels, stride src_stride) reduced to half its size
+ * into dst at (dst_x, dst_y). The last column / row is doubled if w / h
+ * is odd.
+ */
+void feh_pyramid_reduce(DATA32 *dst, int dst_stride, int dst_x, int dst_y,
+		DATA32 *src, int src_stride, int w, int h)
+{
+	DATA32 *row0, *row1, *out, p[4];
+	DATA32 rb, ag;
+	int x, y, i, x1;
+
+	for (y = 0; y < (h + 1) / 2; y++) {
+		row0 = src + 2 * y * src_stride;
+		row1 = (2 * y + 1 < h) ? row0 + src_stride : row0;
+		out = dst + (dst_y + y) * dst_stride + dst_x;
+		for (x = 0; x < (w + 1) / 2; x++) {
+			x1 = (2 * x + 1 < w) ? 2 * x + 1 : 2 * x;
+			p[0] = row0[2 * x];
+			p[1] = row0[x1];
+			p[2] = row1[2 * x];
+			p[3] = row1[x1];
+			/* average all four channels at once, two per word */
+			rb = ag = 0;
+			for (i = 0; i < 4; i++) {
+				rb += p[i] & 0x00ff00ff;
+				ag += (p[i] >> 8) & 0x00ff00ff;
+			}
+			*out++ = (((rb + 0x00020002) >> 2) & 0x00ff00ff)
+				| ((((ag + 0x00020002) >> 2) & 0x00ff00ff) << 8);
+		}
+	}
+}
+
+static Imlib_Image feh_pyramid_get_tile(struct feh_pyramid *p, int level,
+		int col, int row)
+{
+	struct feh_pyramid_level *l = &p->levels[level], *below = &p->levels[level - 1];
+	Imlib_Image *tile = &l->tiles[row * l->cols + col], child;
+	DATA32 *data, *src;
+	int tw, th, i, cx, cy, cw, ch;
+
+	if (*tile)
+		return(*tile);
+
+	tw = MIN(FEH_TILE_SIZE, l->w - col * FEH_TILE_SIZE);
+	th = MIN(FEH_TILE_SIZE, l->h - row * FEH_TILE_SIZE);
+	if (!(*tile = imlib_create_image(tw, th)))
+		return(NULL);
+	imlib_context_set_image(*tile);
+	imlib_image_set_has_alpha(p->has_alpha);
+	data = imlib_image_get_data();
+
+	if (level == 1) {
+		imlib_context_set_image(p->im);
+		src = imlib_image_get_data_for_reading_only();
+		cx = 2 * col * FEH_TILE_SIZE;
+		cy = 2 * row * FEH_TILE_SIZE;
+		feh_pyramid_reduce(data, tw, 0, 0, src + cy * below->w + cx, below->w,
+				MIN(2 * FEH_TILE_SIZE, below->w - cx),
+				MIN(2 * FEH_TILE_SIZE, below->h - cy));
+	} else {
+		/* each tile covers a 2x2 block of tiles on the level below */
+		for (i = 0; i < 4; i++) {
+			cx = 2 * col + (i & 1);
+			cy = 2 * row + (i >> 1);
+			if (cx >= below->cols || cy >= below->rows)
+				continue;
+			if (!(child = feh_pyramid_get_tile(p, level - 1, cx, cy)))
+				continue;
+			imlib_context_set_image(child);
+			cw = imlib_image_get_width();
+			ch = imlib_image_get_height();
+			src = imlib_image_get_data_for_reading_only();
+			feh_pyramid_reduce(data, tw, (i & 1) * FEH_TILE_SIZE / 2,
+					(i >> 1) * FEH_TILE_SIZE / 2, src, cw, cw, ch);
+		}
+	}
+
+	imlib_context_set_image(*tile);
+	imlib_image_put_back_data(data);
+	return(*tile);
+}
+
+static Imlib_Image feh_pyramid_tile_func(void *data, int col, int row)
+{
+	struct feh_pyramid_pos *pos = data;
+
+	return(feh_pyramid_get_tile(pos->p, pos->level, col, row));
+}
+
+static struct feh_pyramid *feh_pyramid_new(Imlib_Image im)
+{
+	struct feh_pyramid *p;
+	struct feh_pyramid_level *l;
+	int w, h, i;
+
+	imlib_context_set_image(im);
+	w = imlib_image_get_width();
+	h = imlib_image_get_height();
+
+	p = emalloc(sizeof(struct feh_pyramid));
+	p->im = im;
+	p->has_alpha = imlib_image_has_alpha();
+
+	/* stop once a level fits into a single tile */
+	for (p->num_levels = 1; (w > FEH_TILE_SIZE) || (h > FEH_TILE_SIZE); p->num_levels++) {
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+
+	p->levels = emalloc(p->num_levels * sizeof(struct feh_pyramid_level));
+	imlib_context_set_image(im);
+	w = imlib_image_get_width();
+	h = imlib_image_get_height();
+	for (i = 0; i < p->num_levels; i++) {
+		l = &p->levels[i];
+		l->w = w;
+		l->h = h;
+		l->cols = (w + FEH_TILE_SIZE - 1) / FEH_TILE_SIZE;
+		l->rows = (h + FEH_TILE_SIZE - 1) / FEH_TILE_SIZE;
+		l->tiles = NULL;
+		if (i) {
+			l->tiles = emalloc(l->cols * l->rows * sizeof(Imlib_Image));
+			memset(l->tiles, 0, l->cols * l->rows * sizeof(Imlib_Image));
+		}
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+
+	D(("pyramid with %d levels for %dx%d image\n", p->num_levels,
+				p->levels[0].w, p->levels[0].h));
+	return(p);
+}
+
+void feh_pyramid_free(winwidget w)
+{
+	struct feh_pyramid *p = w->pyramid;
+	int i, j;
+
+	if (!p)
+		return;
+	for (i = 1; i < p->num_levels; i++) {
+		for (j = 0; j < p->levels[i].cols * p->levels[i].rows; j++) {
+			if (p->levels[i].tiles[j]) {
+				imlib_context_set_image(p->levels[i].tiles[j]);
+				imlib_free_image();
+			}
+		}
+		free(p->levels[i].tiles);
+	}
+	free(p->levels);
+	free(p);
+	w->pyramid = NULL;
+}
+
+/*
+ * Renders the visible part of w->im onto w->bg_pmap from the tile pyramid.
+ * Returns 0 if w should be rendered the usual way instead, e.g. because
+ * the image is too small or the zoom too large.
+ */
+int feh_pyramid_render(winwidget w, int antialias)
+{
+	struct feh_pyramid_pos pos;
+	struct feh_pyramid_level *l;
+	int level;
+
+	if (!opt.pyramid_threshold || (w->type == WIN_TYPE_THUMBNAIL)
+			|| w->has_rotated || (w->zoom >= 0.5) || (w->zoom <= 0)
+			|| ((double)w->im_w * w->im_h < opt.pyramid_threshold * 1e6))
+		return(0);
+
+	if (!w->pyramid)
+		w->pyramid = feh_pyramid_new(w->im);
+	/* e.g. the temporary copies of MODE_BLUR */
+	else if (w->pyramid->im != w->im)
+		return(0);
+
+	for (level = 0; (level + 1 < w->pyramid->num_levels)
+			&& (w->zoom * (1 << (level + 1)) <= 1.0); level++);
+	if (!level)
+		return(0);
+
+	l = &w->pyramid->levels[level];
+	pos.p = w->pyramid;
+	pos.level = level;
+	feh_render_tiles(w, l->w, l->h, w->zoom * (1 << level),
+			feh_pyramid_tile_func, &pos, 0, w->pyramid->has_alpha, antialias);
+	return(1);
+}
+
+/*
+ * Draws the visible part of an image of lw x lh pixels, which is split into
+ * FEH_TILE_SIZE x FEH_TILE_SIZE tiles, onto w->bg_pmap. The image is shown
+ * at zoom, with its top left corner at w->im_x / w->im_y. get_tile(data,
+ * col, row) returns the tile in column col and row row. If free_tiles is
+ * set, each tile is freed after drawing it.
+ */
+void feh_render_tiles(winwidget w, int lw, int lh, double zoom,
+		feh_tile_func get_tile, void *data, int free_tiles,
+		int has_alpha, int antialias)
+{
+	Imlib_Image tile;
+	int col, row, x0, x1, y0, y1, dx0, dx1, dy0, dy1;
+	int vis_x0, vis_x1, vis_y0, vis_y1;
+
+	/* visible area in tile coordinates */
+	vis_x0 = MAX(0, (int)floor(-w->im_x / zoom));
+	vis_y0 = MAX(0, (int)floor(-w->im_y / zoom));
+	vis_x1 = MIN(lw, (int)ceil((w->w - w->im_x) / zoom));
+	vis_y1 = MIN(lh, (int)ceil((w->h - w->im_y) / zoom));
+
+	D(("%dx%d at zoom %f, visible %d,%d - %d,%d\n", lw, lh, zoom,
+				vis_x0, vis_y0, vis_x1, vis_y1));
+
+	for (row = vis_y0 / FEH_TILE_SIZE; row * FEH_TILE_SIZE < vis_y1; row++) {
+		y0 = MAX(vis_y0, row * FEH_TILE_SIZE);
+		y1 = MIN(vis_y1, (row + 1) * FEH_TILE_SIZE);
+		/* adjacent tiles share their rounded edges, so there are no gaps */
+		dy0 = w->im_y + lround(y0 * zoom);
+		dy1 = w->im_y + lround(y1 * zoom);
+		for (col = vis_x0 / FEH_TILE_SIZE; col * FEH_TILE_SIZE < vis_x1; col++) {
+			x0 = MAX(vis_x0, col * FEH_TILE_SIZE);
+			x1 = MIN(vis_x1, (col + 1) * FEH_TILE_SIZE);
+			dx0 = w->im_x + lround(x0 * zoom);
+			dx1 = w->im_x + lround(x1 * zoom);
+			if ((dx1 <= dx0) || (dy1 <= dy0))
+				continue;
+			if (!(tile = get_tile(data, col, row)))
+				continue;
+			gib_imlib_render_image_part_on_drawable_at_size(w->bg_pmap, tile,
+					x0 - col * FEH_TILE_SIZE, y0 - row * FEH_TILE_SIZE,
+					x1 - x0, y1 - y0, dx0, dy0, dx1 - dx0, dy1 - dy0,
+					1, has_alpha, antialias);
+			if (free_tiles)
+				gib_imlib_free_image(tile);
+		}
+	}
+}
@@ -27,8 +27,9 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "filelist.h"
 #include "winwidget.h"
 #include "options.h"
+#include "signals.h"
+#include "loop.h"
 
-void feh_handle_signal(int);
 volatile int sig_exit = 0;
 
 void setup_signal_handlers()
@@ -39,7 +40,6 @@ void setup_signal_handlers()
 		(sigemptyset(&feh_ss) == -1) ||
 		(sigaddset(&feh_ss, SIGUSR1) == -1) ||
 		(sigaddset(&feh_ss, SIGUSR2) == -1) ||
-		(sigaddset(&feh_ss, SIGALRM) == -1) ||
 		(sigaddset(&feh_ss, SIGTERM) == -1) ||
 		(sigaddset(&feh_ss, SIGQUIT) == -1) ||
 		(sigaddset(&feh_ss, SIGINT) == -1) ||
@@ -56,7 +56,6 @@ void setup_signal_handlers()
 	if (
 		(sigaction(SIGUSR1, &feh_sh, NULL) == -1) ||
 		(sigaction(SIGUSR2, &feh_sh, NULL) == -1) ||
-		(sigaction(SIGALRM, &feh_sh, NULL) == -1) ||
 		(sigaction(SIGTERM, &feh_sh, NULL) == -1) ||
 		(sigaction(SIGQUIT, &feh_sh, NULL) == -1) ||
 		(sigaction(SIGINT, &feh_sh, NULL) == -1) ||
@@ -75,10 +74,6 @@ void feh_handle_signal(int signo)
 	int i;
 
 	switch (signo) {
-		case SIGALRM:
-			if (childpid)
-				killpg(childpid, SIGINT);
-			return;
 		case SIGTTIN:
 			// we were probably backgrounded while we were running
 			control_via_stdin = 0;
@@ -89,6 +84,8 @@ void feh_handle_signal(int signo)
 			if (childpid)
 				killpg(childpid, SIGINT);
 			sig_exit = 128 + signo;
+			/* in case it arrived just before the main loop went to sleep */
+			feh_loop_wakeup();
 			return;
 	}
 
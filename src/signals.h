@@ -27,5 +27,6 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define SIGNALS_H
 
 void setup_signal_handlers();
+void feh_handle_signal(int signo);
 extern volatile int sig_exit;
 #endif
@@ -30,6 +30,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "winwidget.h"
 #include "options.h"
 #include "signals.h"
+#include "worker.h"
+#include "loop.h"
 
 void init_slideshow_mode(void)
 {
@@ -113,6 +115,7 @@ void init_slideshow_mode(void)
 				feh_add_timer(cb_slide_timer, w, opt.slideshow_delay, "SLIDE_CHANGE");
 			if (opt.reload > 0)
 				feh_add_unique_timer(cb_reload_timer, w, opt.reload);
+			slideshow_prefetch(current_file);
 			break;
 		} else {
 			last = l;
@@ -132,9 +135,6 @@ void cb_slide_timer(void *data)
 
 void cb_reload_timer(void *data)
 {
-	gib_list *l;
-	char *current_filename;
-
 	winwidget w = (winwidget) data;
 
 	/*
@@ -143,46 +143,8 @@ void cb_reload_timer(void *data)
 	 * So don't reload filelists in multi-window mode.
 	 */
 	if (current_file != NULL) {
-		/* save the current filename for refinding it in new list */
-		current_filename = estrdup(FEH_FILE(current_file->data)->filename);
-
-		for (l = filelist; l; l = l->next) {
-			feh_file_free(l->data);
-			l->data = NULL;
-		}
-		gib_list_free_and_data(filelist);
-		filelist = NULL;
-		filelist_len = 0;
-		current_file = NULL;
-
-		/* rebuild filelist from original_file_items */
-		if (gib_list_length(original_file_items) > 0)
-			for (l = gib_list_last(original_file_items); l; l = l->prev)
-				add_file_to_filelist_recursively(l->data, FILELIST_FIRST);
-		else if (!opt.filelistfile && !opt.bgmode)
-			add_file_to_filelist_recursively(".", FILELIST_FIRST);
-
-		if (opt.filelistfile) {
-			filelist = gib_list_cat(filelist, feh_read_filelist(opt.filelistfile));
-		}
-		
-		if (!(filelist_len = gib_list_length(filelist))) {
-			eprintf("No files found to reload.");
-		}
-
-		feh_prepare_filelist();
-
-		/* find the previously current file */
-		for (l = filelist; l; l = l->next)
-			if (strcmp(FEH_FILE(l->data)->filename, current_filename) == 0) {
-				current_file = l;
-				break;
-			}
-
-		free(current_filename);
-
-		if (!current_file)
-			current_file = filelist;
+		slideshow_prefetch_clear();
+		current_file = feh_reload_filelist(current_file);
 		w->file = current_file;
 	}
 
@@ -215,7 +177,7 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 	   find the correct one. Otherwise SLIDE_LAST would try the last file, *
 	   then loop forward to find a loadable one. */
 	if (change == SLIDE_FIRST) {
-		current_file = gib_list_last(filelist);
+		current_file = feh_filelist_nth(feh_filelist_length() - 1);
 		change = SLIDE_NEXT;
 		previous_file = NULL;
 	} else if (change == SLIDE_LAST) {
@@ -227,6 +189,8 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 	/* The for loop prevents us looping infinitely */
 	for (i = 0; i < our_filelist_len; i++) {
 		winwidget_free_image(winwid);
+		/* a tile cache takes up gigabytes of disk space, see tilecache.c */
+		feh_tile_cache_release(FEH_FILE(winwid->file->data));
 #ifdef HAVE_LIBEXIF
 		/*
 		 * An EXIF data chunk requires up to 50 kB of space. For large and
@@ -362,6 +326,7 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 	if (filelist_len == 0)
 		eprintf("No more slides in show");
 
+	slideshow_prefetch(current_file);
 	return;
 }
 
@@ -380,13 +345,27 @@ void feh_action_run(feh_file * file, char *action, winwidget winwid)
 {
 	if (action) {
 		char *sys;
+		pid_t pid;
+
 		D(("Running action %s\n", action));
 		sys = feh_printf(action, file, winwid);
 
 		if (opt.verbose && !opt.list && !opt.customlist)
 			fprintf(stderr, "Running action -->%s<--\n", sys);
-		if (system(sys) == -1)
-			perror("running action via system() failed");
+		/*
+		 * Not system(): the shell has to start with the signal mask
+		 * feh was started with, see feh_loop_child_sigmask.
+		 */
+		if ((pid = fork()) < 0)
+			perror("running action failed: fork");
+		else if (pid == 0) {
+			feh_loop_child_sigmask();
+			execl("/bin/sh", "sh", "-c", sys, NULL);
+			_exit(127);
+		}
+		else
+			while ((waitpid(pid, NULL, 0) == -1) && (errno == EINTR))
+				;
 	}
 	return;
 }
@@ -448,7 +427,7 @@ char *feh_printf(char *str, feh_file * file, winwidget winwid)
 				}
 				break;
 			case 'l':
-				snprintf(buf, sizeof(buf), "%d", gib_list_length(filelist));
+				snprintf(buf, sizeof(buf), "%d", feh_filelist_length());
 				strncat(ret, buf, sizeof(ret) - strlen(ret) - 1);
 				break;
 			case 'L':
@@ -513,7 +492,7 @@ char *feh_printf(char *str, feh_file * file, winwidget winwid)
 				break;
 			case 'u':
 				f = current_file ? current_file : gib_list_find_by_data(filelist, file);
-				snprintf(buf, sizeof(buf), "%d", f ? gib_list_num(filelist, f) + 1 : 0);
+				snprintf(buf, sizeof(buf), "%d", feh_filelist_num(f) + 1);
 				strncat(ret, buf, sizeof(ret) - strlen(ret) - 1);
 				break;
 			case 'v':
@@ -649,38 +628,218 @@ void slideshow_save_image(winwidget win)
 
 gib_list *feh_list_jump(gib_list * root, gib_list * l, int direction, int num)
 {
-	int i;
-	gib_list *ret = NULL;
+	int pos, len;
 
 	if (!root)
 		return (NULL);
-	if (!l)
+	if (!l || ((pos = feh_filelist_num(l)) == -1))
 		return (root);
 
-	ret = l;
+	len = feh_filelist_length();
 
-	for (i = 0; i < num; i++) {
-		if (direction == FORWARD) {
-			if (ret->next) {
-				ret = ret->next;
-			} else {
-				if (opt.on_last_slide == ON_LAST_SLIDE_QUIT) {
-					exit(0);
-				}
-				if (opt.randomize) {
-					/* Randomize the filename order */
-					filelist = gib_list_randomize(filelist);
-					ret = filelist;
-				} else {
-					ret = root;
-				}
+	if (direction == FORWARD) {
+		pos += num;
+		if (pos >= len) {
+			if (opt.on_last_slide == ON_LAST_SLIDE_QUIT) {
+				exit(0);
 			}
-		} else {
-			if (ret->prev)
-				ret = ret->prev;
-			else
-				ret = gib_list_last(ret);
+			if (opt.randomize) {
+				/* Randomize the filename order */
+				filelist = gib_list_randomize(filelist);
+				feh_filelist_changed();
+			}
+			pos %= len;
+		}
+	} else {
+		pos = ((pos - num) % len + len) % len;
+	}
+	return (feh_filelist_nth(pos));
+}
+
+/*
+ * Decode-ahead: while an image is being viewed, the next opt.prefetch_ahead
+ * and previous opt.prefetch_behind filelist entries are decoded by worker
+ * processes (see worker.c), so that navigating to them does not have to wait
+ * for the decoder.
+ */
+static gib_list *prefetch_jobs = NULL;
+
+static feh_job *slideshow_prefetch_find(feh_file * file)
+{
+	gib_list *l;
+
+	for (l = prefetch_jobs; l; l = l->next)
+		if (((feh_job *) l->data)->file == file)
+			return(l->data);
+	return(NULL);
+}
+
+static void slideshow_prefetch_drop(feh_job * job)
+{
+	prefetch_jobs = gib_list_remove(prefetch_jobs,
+			gib_list_find_by_data(prefetch_jobs, job));
+	feh_job_free(job);
+}
+
+/*
+ * Like feh_list_jump, but never quits or reshuffles the filelist. Returns
+ * NULL when a slide change in this direction would not wrap around.
+ */
+static gib_list *slideshow_prefetch_step(gib_list * l, int direction)
+{
+	if (direction == FORWARD) {
+		if (l->next)
+			return(l->next);
+		if (opt.on_last_slide == ON_LAST_SLIDE_RESUME && !opt.randomize)
+			return(filelist);
+	} else {
+		if (l->prev)
+			return(l->prev);
+		if (opt.on_last_slide != ON_LAST_SLIDE_HOLD)
+			return(feh_filelist_nth(feh_filelist_length() - 1));
+	}
+	return(NULL);
+}
+
+static int slideshow_prefetch_load(feh_file * file, Imlib_Image * im, int *orig_w, int *orig_h)
+{
+	/* errors are reported when the image is actually shown */
+	opt.quiet = 1;
+	/* the tile cache would be lost with the worker, the parent builds it */
+	feh_tile_cache_disable();
+	return(feh_job_load_image(file, im, orig_w, orig_h));
+}
+
+/*
+ * Returns the memory file will take up once decoded, from its worker's
+ * result, its file info or its file header. Returns 0 if that is not known.
+ */
+static size_t slideshow_prefetch_estimate(feh_file * file, feh_job * job)
+{
+	feh_file_info info;
+	size_t size = 0;
+
+	if (job && (job->header_read == sizeof(job->header)))
+		return((size_t)job->header.w * job->header.h * sizeof(DATA32));
+	if (file->info)
+		return((size_t)file->info->width * file->info->height * sizeof(DATA32));
+	/* stdin images have no file to look at */
+	if (file->data)
+		return(0);
+
+	memset(&info, 0, sizeof(info));
+	if (feh_file_info_probe(file, &info)) {
+		size = (size_t)info.width * info.height * sizeof(DATA32);
+		free(info.format);
+	}
+	return(size);
+}
+
+void slideshow_prefetch(gib_list * current)
+{
+	gib_list *wanted = NULL, *fwd = current, *back = current, *l, *next;
+	feh_file *file;
+	feh_job *job;
+	size_t mem = 0, size;
+	size_t max_mem = (size_t)opt.prefetch_memory * 1024 * 1024;
+	int i;
+
+	if (!current || (!opt.prefetch_ahead && !opt.prefetch_behind))
+		return;
+
+	/* nearest entries first, alternating between both directions */
+	for (i = 0; i < opt.prefetch_ahead || i < opt.prefetch_behind; i++) {
+		if (fwd && i < opt.prefetch_ahead) {
+			fwd = slideshow_prefetch_step(fwd, FORWARD);
+			if (fwd == current)
+				fwd = NULL;
+			else if (fwd && !gib_list_find_by_data(wanted, fwd->data))
+				wanted = gib_list_add_end(wanted, fwd->data);
+		}
+		if (back && i < opt.prefetch_behind) {
+			back = slideshow_prefetch_step(back, BACK);
+			if (back == current)
+				back = NULL;
+			else if (back && !gib_list_find_by_data(wanted, back->data))
+				wanted = gib_list_add_end(wanted, back->data);
 		}
 	}
-	return (ret);
+
+	for (l = prefetch_jobs; l; l = next) {
+		next = l->next;
+		if (!gib_list_find_by_data(wanted, ((feh_job *) l->data)->file))
+			slideshow_prefetch_drop(l->data);
+	}
+
+	/*
+	 * Jobs are budgeted before they are started, nearest images first. Once
+	 * the next image would exceed the limit, it and all images further away
+	 * are dropped. An image whose size is not known in advance uses up the
+	 * remaining budget.
+	 */
+	for (l = wanted; l; l = l->next) {
+		file = FEH_FILE(l->data);
+		job = slideshow_prefetch_find(file);
+		size = (mem < max_mem) ? slideshow_prefetch_estimate(file, job) : 0;
+		if ((mem >= max_mem) || (size > max_mem - mem)) {
+			mem = max_mem;
+			if (job)
+				slideshow_prefetch_drop(job);
+			continue;
+		}
+		mem = size ? mem + size : max_mem;
+		if (!job) {
+			job = feh_job_start(file, slideshow_prefetch_load);
+			prefetch_jobs = gib_list_add_end(prefetch_jobs, job);
+		}
+	}
+
+	gib_list_free(wanted);
+	return;
+}
+
+/*
+ * Moves a prefetched image for file into *im. Returns 0 if there is none,
+ * in which case the caller should load it itself.
+ */
+int slideshow_prefetch_take(Imlib_Image * im, feh_file * file)
+{
+	feh_job *job;
+
+	if (!(job = slideshow_prefetch_find(file)))
+		return(0);
+
+	feh_job_wait(job);
+	*im = feh_job_take_image(job, NULL, NULL);
+	slideshow_prefetch_drop(job);
+
+#ifdef HAVE_LIBEXIF
+	/*
+	 * The worker already applied any EXIF orientation, but file->ed is needed
+	 * for --draw-exif and the info commands.
+	 */
+	if (*im) {
+		if (file->ed)
+			exif_data_unref(file->ed);
+		file->ed = exif_data_new_from_file(file->filename);
+	}
+#endif
+
+	return(*im != NULL);
+}
+
+void slideshow_prefetch_forget(feh_file * file)
+{
+	feh_job *job;
+
+	if ((job = slideshow_prefetch_find(file)))
+		slideshow_prefetch_drop(job);
+	return;
+}
+
+void slideshow_prefetch_clear(void)
+{
+	while (prefetch_jobs)
+		slideshow_prefetch_drop(prefetch_jobs->data);
+	return;
 }
@@ -0,0 +1,328 @@
+/* stream.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+
+/*
+ * Image streams on stdin (--stdin-stream).
+ *
+ * Each image replaces the previous one as soon as it has been received
+ * completely. JPEG, PNG and PAM / PNM images are self-delimiting, so they
+ * can simply be concatenated (as written by e.g. ffmpeg -f image2pipe). Any
+ * other image must be preceded by its length as a 32 bit big-endian number.
+ * If images arrive faster than they can be shown, all but the most recent
+ * one are skipped.
+ */
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include "winwidget.h"
+#include "loop.h"
+#include <fcntl.h>
+
+#define STREAM_INVALID ((size_t)-1)
+
+/* anything larger than this is most likely garbage */
+#define STREAM_MAX_IMAGE_SIZE ((size_t)1 << 30)
+
+static feh_file *stream_file = NULL;
+static int stream_reading = 0;
+static int stream_watched = 0;
+
+static void feh_stream_handle(void *data);
+static unsigned char *stream_buf = NULL;
+static size_t stream_buf_size = 0;
+static size_t stream_buf_used = 0;
+
+static size_t stream_be32(unsigned char *p)
+{
+	return(((size_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+/*
+ * The following functions return the size of the image at the start of
+ * data, which may be larger than len, 0 if it is not known yet, or
+ * STREAM_INVALID if data is not an image of the respective format.
+ */
+
+static size_t stream_jpeg_size(unsigned char *data, size_t len)
+{
+	size_t pos = 2;
+	int in_scan = 0;
+	unsigned char marker;
+
+	while (pos + 1 < len) {
+		/* entropy-coded data only contains stuffed bytes and restart markers */
+		if (in_scan) {
+			if (data[pos] != 0xff) {
+				pos++;
+				continue;
+			}
+			marker = data[pos + 1];
+			if (marker == 0x00 || (marker >= 0xd0 && marker <= 0xd7)) {
+				pos += 2;
+				continue;
+			} else if (marker == 0xff) {
+				pos++;
+				continue;
+			}
+			in_scan = 0;
+		}
+
+		if (data[pos] != 0xff)
+			return(STREAM_INVALID);
+		marker = data[pos + 1];
+		if (marker == 0xff)
+			pos++;
+		else if (marker == 0xd9)
+			return(pos + 2);
+		else if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+			pos += 2;
+		else if (pos + 3 < len) {
+			if (((data[pos + 2] << 8) | data[pos + 3]) < 2)
+				return(STREAM_INVALID);
+			pos += 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+			if (marker == 0xda)
+				in_scan = 1;
+		} else
+			break;
+	}
+	return(0);
+}
+
+static size_t stream_png_size(unsigned char *data, size_t len)
+{
+	size_t pos = 8, chunk_len;
+
+	while (pos + 8 <= len) {
+		if ((chunk_len = stream_be32(data + pos)) > STREAM_MAX_IMAGE_SIZE)
+			return(STREAM_INVALID);
+		if (!memcmp(data + pos + 4, "IEND", 4))
+			return(pos + 12 + chunk_len);
+		pos += 12 + chunk_len;
+	}
+	return(0);
+}
+
+static size_t stream_pnm_size(unsigned char *data, size_t len)
+{
+	size_t size;
+
+	if ((size = feh_pnm_size(data, len)))
+		return(size);
+	/* no header is anywhere near this long */
+	return((len < 4096) ? 0 : STREAM_INVALID);
+}
+
+/*
+ * Locates the first image in data: it occupies size bytes starting at
+ * offset start. Returns 1 if it is complete, 0 if more data is needed and
+ * -1 if data does not start with an image.
+ */
+static int feh_stream_find_image(unsigned char *data, size_t len,
+		size_t *start, size_t *size)
+{
+	*start = 0;
+
+	if (len < 8)
+		*size = 0;
+	else if (data[0] == 0xff && data[1] == 0xd8)
+		*size = stream_jpeg_size(data, len);
+	else if (!memcmp(data, "\x89PNG\r\n\x1a\n", 8))
+		*size = stream_png_size(data, len);
+	else if (data[0] == 'P' && (data[1] == '5' || data[1] == '6' || data[1] == '7'))
+		*size = stream_pnm_size(data, len);
+	else {
+		*start = 4;
+		*size = stream_be32(data);
+		if (!*size || *size > STREAM_MAX_IMAGE_SIZE)
+			*size = STREAM_INVALID;
+	}
+
+	if (*size == STREAM_INVALID)
+		return(-1);
+	return(*size && *start + *size <= len);
+}
+
+static void feh_stream_close(void)
+{
+	if (stream_watched)
+		feh_loop_unwatch(STDIN_FILENO);
+	stream_watched = 0;
+	stream_reading = 0;
+	free(stream_buf);
+	stream_buf = NULL;
+	stream_buf_size = stream_buf_used = 0;
+}
+
+/*
+ * Takes the most recent complete image out of the buffer and drops all
+ * older ones. Returns 1 and stores a copy of the image (free it please) in
+ * data / len if there was one.
+ */
+static int feh_stream_next(unsigned char **data, size_t *len)
+{
+	size_t pos = 0, start, size, image_start = 0, image_size = 0;
+	int ret;
+
+	while ((ret = feh_stream_find_image(stream_buf + pos, stream_buf_used - pos,
+					&start, &size)) == 1) {
+		image_start = pos + start;
+		image_size = size;
+		pos += start + size;
+	}
+
+	if (image_size) {
+		*data = emalloc(image_size);
+		memcpy(*data, stream_buf + image_start, image_size);
+		*len = image_size;
+	}
+
+	if (ret == -1) {
+		weprintf("stdin: unrecognized image data, ignoring the rest of the stream");
+		feh_stream_close();
+	} else if (pos) {
+		memmove(stream_buf, stream_buf + pos, stream_buf_used - pos);
+		stream_buf_used -= pos;
+	}
+	return(image_size != 0);
+}
+
+/*
+ * Reads once from stdin into the buffer. Returns the number of bytes read,
+ * 0 on EOF or -1 on error (with errno set).
+ */
+static ssize_t feh_stream_read(void)
+{
+	ssize_t n;
+
+	if (stream_buf_size - stream_buf_used < 65536) {
+		stream_buf_size = stream_buf_size ? stream_buf_size * 2 : 262144;
+		stream_buf = erealloc(stream_buf, stream_buf_size);
+	}
+	if ((n = read(STDIN_FILENO, stream_buf + stream_buf_used,
+					stream_buf_size - stream_buf_used)) > 0)
+		stream_buf_used += n;
+	return(n);
+}
+
+/*
+ * Waits for the first image on stdin and returns a file for it, whose data
+ * is replaced by each following image.
+ */
+feh_file *feh_stream_open(void)
+{
+	unsigned char *data;
+	size_t len;
+	ssize_t n;
+	int flags;
+
+	if (stream_file) {
+		weprintf("stdin can only be read once");
+		return(NULL);
+	}
+
+	stream_reading = 1;
+	while (!feh_stream_next(&data, &len)) {
+		if (!stream_reading)
+			return(NULL);
+		if ((n = feh_stream_read()) == 0) {
+			weprintf("stdin: stream ended before the first image was complete");
+			feh_stream_close();
+			return(NULL);
+		} else if (n < 0 && errno != EINTR) {
+			weprintf("cannot read from stdin:");
+			feh_stream_close();
+			return(NULL);
+		}
+	}
+
+	/* the main loop must not block on the rest of the stream */
+	if ((flags = fcntl(STDIN_FILENO, F_GETFL)) != -1)
+		fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+
+	stream_file = feh_file_new("/dev/stdin");
+	stream_file->data = data;
+	stream_file->data_len = len;
+	feh_loop_watch(STDIN_FILENO, feh_stream_handle, NULL);
+	stream_watched = 1;
+	return(stream_file);
+}
+
+/* Called by feh_file_free */
+void feh_stream_forget(feh_file * file)
+{
+	if (file && file == stream_file) {
+		stream_file = NULL;
+		feh_stream_close();
+	}
+}
+
+/*
+ * Reads everything currently available on stdin and shows the most recent
+ * complete image in all windows which display the stream.
+ */
+static void feh_stream_handle(void *unused __attribute__((unused)))
+{
+	unsigned char *data;
+	size_t len;
+	ssize_t n;
+	char *title;
+	int i, done;
+
+	if (!stream_file || !stream_reading)
+		return;
+
+	while ((n = feh_stream_read()) > 0)
+		;
+	done = (n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR));
+	if (n == -1 && done)
+		weprintf("cannot read from stdin:");
+
+	if (feh_stream_next(&data, &len)) {
+		free(stream_file->data);
+		stream_file->data = data;
+		stream_file->data_len = len;
+		feh_file_info_free(stream_file->info);
+		stream_file->info = NULL;
+		slideshow_prefetch_forget(stream_file);
+
+		for (i = 0; i < window_num; i++) {
+			if (!windows[i]->file || (windows[i]->type == WIN_TYPE_THUMBNAIL)
+					|| (FEH_FILE(windows[i]->file->data) != stream_file))
+				continue;
+			/* feh_reload_image prepends "Reloading: " to the title */
+			title = estrdup(windows[i]->name ? windows[i]->name : "");
+			feh_reload_image(windows[i], 0, 0);
+			if (!opt.title)
+				winwidget_rename(windows[i], title);
+			free(title);
+		}
+	}
+
+	/* on EOF, the last image remains */
+	if (done)
+		feh_stream_close();
+}
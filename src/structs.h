@@ -37,4 +37,6 @@ typedef struct __fehoptions fehoptions;
 typedef struct __fehkey fehkey;
 typedef struct __fehkb fehkb;
 
+struct feh_tile_cache;
+
 #endif
@@ -33,11 +33,75 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "feh_png.h"
 #include "index.h"
 #include "signals.h"
+#include "worker.h"
 
 static gib_list *thumbnails = NULL;
 
 static thumbmode_data td;
 
+/*
+ * Loads (or fetches from the cache) and scales a single thumbnail. Runs in
+ * a worker process when --jobs is not 1.
+ */
+static int feh_thumbnail_job(feh_file * file, Imlib_Image * im, int *orig_w, int *orig_h)
+{
+	Imlib_Image im_temp;
+	int ww, hh, www, hhh;
+
+	D(("About to load image %s\n", file->filename));
+	if (feh_thumbnail_get_thumbnail(&im_temp, file, orig_w, orig_h) == 0)
+		return(0);
+
+	www = opt.thumb_w;
+	hhh = opt.thumb_h;
+	ww = gib_imlib_image_get_width(im_temp);
+	hh = gib_imlib_image_get_height(im_temp);
+
+	if (!*orig_w) {
+		*orig_w = ww;
+		*orig_h = hh;
+	}
+
+	if (gib_imlib_image_has_alpha(im_temp))
+		imlib_context_set_blend(1);
+	else
+		imlib_context_set_blend(0);
+
+	if (opt.aspect) {
+		double ratio = 0.0;
+
+		/* Keep the aspect ratio for the thumbnail */
+		ratio = ((double) ww / hh) / ((double) www / hhh);
+
+		if (ratio > 1.0)
+			hhh = opt.thumb_h / ratio;
+		else if (ratio != 1.0)
+			www = opt.thumb_w * ratio;
+	}
+
+	if ((!opt.stretch) && ((www > ww) || (hhh > hh))) {
+		/* Don't make the image larger unless stretch is specified */
+		www = ww;
+		hhh = hh;
+	}
+
+	*im = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0,
+			ww, hh, www, hhh, 1);
+	gib_imlib_free_image_and_decache(im_temp);
+
+	if (opt.alpha) {
+		DATA8 atab[256];
+
+		D(("Applying alpha options\n"));
+		gib_imlib_image_set_has_alpha(*im, 1);
+		memset(atab, opt.alpha_level, sizeof(atab));
+		gib_imlib_apply_color_modifier_to_rectangle
+		    (*im, 0, 0, www, hhh, NULL, NULL, NULL, atab);
+	}
+
+	return(*im != NULL);
+}
+
 /* TODO Break this up a bit ;) */
 /* TODO s/bit/lot */
 void init_thumbnail_mode(void)
@@ -56,9 +120,7 @@ void init_thumbnail_mode(void)
 	 */
 
 	Imlib_Load_Error err;
-	Imlib_Image im_temp;
-	int ww = 0, hh = 0, www, hhh, xxx, yyy;
-	int orig_w, orig_h;
+	int www, hhh, xxx, yyy;
 	int x = 0, y = 0;
 	winwidget winwid = NULL;
 	Imlib_Image im_thumb = NULL;
@@ -73,6 +135,8 @@ void init_thumbnail_mode(void)
 	int index_image_width, index_image_height;
 	unsigned int thumb_counter = 0;
 	gib_list *line, *lines;
+	feh_job_queue queue;
+	feh_job *job;
 
 	/* initialize thumbnail mode data */
 	td.im_main = NULL;
@@ -206,66 +270,29 @@ void init_thumbnail_mode(void)
 		feh_thumbnail_setup_thumbnail_dir();
 	}
 
-	for (l = filelist; l; l = l->next) {
+	/*
+	 * Thumbnails are loaded, scaled and cached by up to --jobs workers.
+	 * They are still placed in filelist order, so the layout does not
+	 * depend on which worker finishes first.
+	 */
+	feh_job_queue_init(&queue, filelist, feh_thumbnail_job, 1);
+	while ((job = feh_job_queue_next(&queue))) {
+		l = job->node;
 		file = FEH_FILE(l->data);
 		if (last) {
 			filelist = feh_file_remove_from_list(filelist, last);
 			last = NULL;
 		}
-		D(("About to load image %s\n", file->filename));
-		/*      if (feh_load_image(&im_temp, file) != 0) */
-		if (feh_thumbnail_get_thumbnail(&im_temp, file, &orig_w, &orig_h)
-				!= 0) {
+		im_thumb = feh_job_take_image(job, NULL, NULL);
+		feh_job_free(job);
+		if (im_thumb) {
 			if (opt.verbose)
 				feh_display_status('.');
 			D(("Successfully loaded %s\n", file->filename));
-			www = opt.thumb_w;
-			hhh = opt.thumb_h;
-			ww = gib_imlib_image_get_width(im_temp);
-			hh = gib_imlib_image_get_height(im_temp);
-
-			if (!orig_w) {
-				orig_w = ww;
-				orig_h = hh;
-			}
+			www = gib_imlib_image_get_width(im_thumb);
+			hhh = gib_imlib_image_get_height(im_thumb);
 
 			thumbnailcount++;
-			if (gib_imlib_image_has_alpha(im_temp))
-				imlib_context_set_blend(1);
-			else
-				imlib_context_set_blend(0);
-
-			if (opt.aspect) {
-				double ratio = 0.0;
-
-				/* Keep the aspect ratio for the thumbnail */
-				ratio = ((double) ww / hh) / ((double) www / hhh);
-
-				if (ratio > 1.0)
-					hhh = opt.thumb_h / ratio;
-				else if (ratio != 1.0)
-					www = opt.thumb_w * ratio;
-			}
-
-			if ((!opt.stretch) && ((www > ww) || (hhh > hh))) {
-				/* Don't make the image larger unless stretch is specified */
-				www = ww;
-				hhh = hh;
-			}
-
-			im_thumb = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0,
-					ww, hh, www, hhh, 1);
-			gib_imlib_free_image_and_decache(im_temp);
-
-			if (opt.alpha) {
-				DATA8 atab[256];
-
-				D(("Applying alpha options\n"));
-				gib_imlib_image_set_has_alpha(im_thumb, 1);
-				memset(atab, opt.alpha_level, sizeof(atab));
-				gib_imlib_apply_color_modifier_to_rectangle
-				    (im_thumb, 0, 0, www, hhh, NULL, NULL, NULL, atab);
-			}
 
 			td.text_area_w = opt.thumb_w;
 			/* Now draw on the info text */
@@ -289,15 +316,21 @@ void init_thumbnail_mode(void)
 					x += td.max_column_w;
 					td.max_column_w = 0;
 				}
-				if (x > td.w - td.text_area_w)
+				if (x > td.w - td.text_area_w) {
+					gib_imlib_free_image_and_decache(im_thumb);
+					feh_job_queue_cancel(&queue);
 					break;
+				}
 			} else {
 				if (x > td.w - td.text_area_w) {
 					x = 0;
 					y += td.thumb_tot_h;
 				}
-				if (y > td.h - td.thumb_tot_h)
+				if (y > td.h - td.thumb_tot_h) {
+					gib_imlib_free_image_and_decache(im_thumb);
+					feh_job_queue_cancel(&queue);
 					break;
+				}
 			}
 
 			/* center image relative to the text below it (if any) */
@@ -568,13 +601,15 @@ int feh_thumbnail_get_thumbnail(Imlib_Image * image, feh_file * file,
 	if (!file || !file->filename)
 		return (0);
 
-	if (td.cache_thumbnails) {
+	/* stdin has no name the thumbnail could be cached under */
+	if (td.cache_thumbnails && !file->data) {
 		uri = feh_thumbnail_get_name_uri(file->filename);
 		thumb_file = feh_thumbnail_get_name(uri);
 
 		if (thumb_file == NULL) {
 			free(uri);
-			return feh_load_image(image, file);
+			return feh_load_image_scaled(image, file, opt.thumb_w,
+					opt.thumb_h, orig_w, orig_h);
 		}
 
 		status = feh_thumbnail_get_generated(image, file, thumb_file,
@@ -588,7 +623,8 @@ int feh_thumbnail_get_thumbnail(Imlib_Image * image, feh_file * file,
 		free(uri);
 		free(thumb_file);
 	} else
-		status = feh_load_image(image, file);
+		status = feh_load_image_scaled(image, file, opt.thumb_w, opt.thumb_h,
+				orig_w, orig_h);
 
 	return status;
 }
@@ -687,9 +723,10 @@ int feh_thumbnail_generate(Imlib_Image * image, feh_file * file,
 	char *tmp_thumb_file, *prefix;
 	int tmp_fd;
 
-	if (feh_load_image(&im_temp, file) != 0) {
-		*orig_w = w = gib_imlib_image_get_width(im_temp);
-		*orig_h = h = gib_imlib_image_get_height(im_temp);
+	if (feh_load_image_scaled(&im_temp, file, td.cache_dim, td.cache_dim,
+				orig_w, orig_h) != 0) {
+		w = gib_imlib_image_get_width(im_temp);
+		h = gib_imlib_image_get_height(im_temp);
 		thumb_w = td.cache_dim;
 		thumb_h = td.cache_dim;
 
@@ -707,8 +744,8 @@ int feh_thumbnail_generate(Imlib_Image * image, feh_file * file,
 		if (!stat(file->filename, &sb)) {
 			char c_mtime[128];
 			sprintf(c_mtime, "%d", (int)sb.st_mtime);
-			snprintf(c_width, 8, "%d", w);
-			snprintf(c_height, 8, "%d", h);
+			snprintf(c_width, 8, "%d", *orig_w);
+			snprintf(c_height, 8, "%d", *orig_h);
 			prefix = feh_thumbnail_get_prefix();
 			if (prefix == NULL) {
 				gib_imlib_free_image_and_decache(im_temp);
@@ -745,9 +782,12 @@ int feh_thumbnail_get_generated(Imlib_Image * image, feh_file * file,
 	char *c_width, *c_height;
 	time_t mtime = 0;
 	gib_hash *hash;
+	struct feh_mapped_file mf;
+	Imlib_Load_Error err;
 
-	if (!stat(file->filename, &sb)) {
-		hash = feh_png_read_comments(thumb_file);
+	/* the thumbnail's metadata and pixels come from a single read */
+	if (!stat(file->filename, &sb) && feh_map_file(thumb_file, &mf)) {
+		hash = feh_png_read_comments_mem(mf.data, mf.size);
 		if (hash != NULL) {
 			c_mtime  = (char *) gib_hash_get(hash, "Thumb::MTime");
 			c_width  = (char *) gib_hash_get(hash, "Thumb::Image::Width");
@@ -763,10 +803,13 @@ int feh_thumbnail_get_generated(Imlib_Image * image, feh_file * file,
 
 		/* FIXME: should we bother about Thumb::URI? */
 		if (mtime == sb.st_mtime) {
-			feh_load_image_char(image, thumb_file);
+			if (!(*image = feh_imlib_load(thumb_file, &mf, &err)))
+				feh_load_image_char(image, thumb_file);
+			feh_unmap_file(&mf);
 
 			return (1);
 		}
+		feh_unmap_file(&mf);
 	}
 
 	return (0);
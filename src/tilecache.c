@@ -0,0 +1,384 @@
+/* tilecache.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+
+/*
+ * On-disk tile cache for images larger than memory (--out-of-core).
+ *
+ * PNG and PNM images are decoded one row at a time straight into a cache
+ * file, which holds the image and each of its reductions to 1/2^n of its
+ * size (built with feh_pyramid_reduce) as FEH_TILE_SIZE x FEH_TILE_SIZE
+ * tiles of raw ARGB pixels. The file is unlinked as soon as it has been
+ * created and stays mmap()ed while the image is shown, see
+ * feh_tile_cache_release.
+ *
+ * The window gets a small reduction of the image as its w->im. Whenever it
+ * is zoomed in beyond that, feh_tile_cache_render draws the visible tiles
+ * of the matching level directly from the mapping, so only their pages are
+ * ever read back from disk.
+ */
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include "winwidget.h"
+#include "feh_png.h"
+#include <sys/mman.h>
+
+/* maximum size of the reduction shown as w->im */
+#define TILE_CACHE_PREVIEW_SIZE 4096
+
+#define TILE_BYTES ((size_t)FEH_TILE_SIZE * FEH_TILE_SIZE * sizeof(DATA32))
+
+struct feh_tile_cache_level {
+	int w, h;
+	int cols, rows;
+	size_t offset;		/* of the first tile in the cache file */
+};
+
+struct feh_tile_cache {
+	unsigned char *map;
+	size_t size;
+	int has_alpha;
+	int num_levels;		/* including level 0, the image itself */
+	int preview_level;
+	struct feh_tile_cache_level *levels;
+	Imlib_Image preview;	/* last image returned by feh_tile_cache_load */
+	time_t mtime;		/* of the image file, to notice changes on reload */
+	off_t file_size;
+};
+
+struct feh_tile_cache_sink {
+	struct feh_row_sink sink;
+	struct feh_tile_cache *tiles;
+	int deferred;		/* the image qualifies, but we may not build it */
+};
+
+struct feh_tile_cache_pos {
+	struct feh_tile_cache *tiles;
+	int level;
+};
+
+/* set in prefetch workers, which cannot pass the cache on to the parent */
+static int tile_cache_disabled = 0;
+
+static DATA32 *feh_tile_cache_tile(struct feh_tile_cache *tiles, int level,
+		int col, int row)
+{
+	struct feh_tile_cache_level *l = &tiles->levels[level];
+
+	return((DATA32 *)(tiles->map + l->offset
+				+ (row * l->cols + col) * TILE_BYTES));
+}
+
+static struct feh_tile_cache *feh_tile_cache_new(int w, int h, int has_alpha)
+{
+	struct feh_tile_cache *tiles;
+	struct feh_tile_cache_level *l;
+	char *dir, *path;
+	size_t size = 0;
+	int fd, i, lw, lh;
+
+	tiles = emalloc(sizeof(struct feh_tile_cache));
+	tiles->has_alpha = has_alpha;
+	tiles->preview = NULL;
+
+	/* stop once a level fits into a single tile */
+	for (tiles->num_levels = 1, lw = w, lh = h;
+			(lw > FEH_TILE_SIZE) || (lh > FEH_TILE_SIZE); tiles->num_levels++) {
+		lw = (lw + 1) / 2;
+		lh = (lh + 1) / 2;
+	}
+
+	tiles->levels = emalloc(tiles->num_levels * sizeof(struct feh_tile_cache_level));
+	tiles->preview_level = -1;
+	for (i = 0, lw = w, lh = h; i < tiles->num_levels; i++) {
+		l = &tiles->levels[i];
+		l->w = lw;
+		l->h = lh;
+		l->cols = (lw + FEH_TILE_SIZE - 1) / FEH_TILE_SIZE;
+		l->rows = (lh + FEH_TILE_SIZE - 1) / FEH_TILE_SIZE;
+		l->offset = size;
+		size += (size_t)l->cols * l->rows * TILE_BYTES;
+		if ((tiles->preview_level < 0) && (lw <= TILE_CACHE_PREVIEW_SIZE)
+				&& (lh <= TILE_CACHE_PREVIEW_SIZE))
+			tiles->preview_level = i;
+		lw = (lw + 1) / 2;
+		lh = (lh + 1) / 2;
+	}
+	tiles->size = size;
+	tiles->map = MAP_FAILED;
+
+	/*
+	 * Not $TMPDIR: it is often a tmpfs, which would defeat the purpose.
+	 */
+	if ((dir = feh_cache_dir())) {
+		path = estrjoin("/", dir, "tiles_XXXXXX", NULL);
+		free(dir);
+		if ((fd = mkstemp(path)) != -1) {
+			unlink(path);
+			/*
+			 * A sparse file would raise SIGBUS on the first write into
+			 * the mapping which finds the file system full.
+			 */
+			if ((errno = posix_fallocate(fd, 0, size)) == 0)
+				tiles->map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+						MAP_SHARED, fd, 0);
+			close(fd);
+		}
+		if (tiles->map == MAP_FAILED)
+			weprintf("unable to create tile cache %s:", path);
+		free(path);
+	}
+
+	if (tiles->map == MAP_FAILED) {
+		free(tiles->levels);
+		free(tiles);
+		return(NULL);
+	}
+
+	D(("%d level tile cache for %dx%d image, %zu bytes\n", tiles->num_levels,
+				w, h, size));
+	return(tiles);
+}
+
+void feh_tile_cache_free(struct feh_tile_cache *tiles)
+{
+	munmap(tiles->map, tiles->size);
+	free(tiles->levels);
+	free(tiles);
+}
+
+/* stops rendering file's current preview from the cache, e.g. once it is edited */
+void feh_tile_cache_detach(feh_file * file)
+{
+	if (file->tiles)
+		file->tiles->preview = NULL;
+}
+
+/*
+ * Frees file's tile cache, along with its disk space. Called once file is
+ * no longer shown, the next feh_tile_cache_load builds it again.
+ */
+void feh_tile_cache_release(feh_file * file)
+{
+	if (file->tiles) {
+		feh_tile_cache_free(file->tiles);
+		file->tiles = NULL;
+	}
+}
+
+void feh_tile_cache_disable(void)
+{
+	tile_cache_disabled = 1;
+}
+
+static int feh_tile_cache_start(struct feh_row_sink *sink, int w, int h,
+		int has_alpha)
+{
+	struct feh_tile_cache_sink *s = (struct feh_tile_cache_sink *)sink;
+
+	if ((double)w * h < opt.out_of_core * 1e6)
+		return(0);
+	if (tile_cache_disabled) {
+		s->deferred = 1;
+		return(0);
+	}
+	return((s->tiles = feh_tile_cache_new(w, h, has_alpha)) != NULL);
+}
+
+static void feh_tile_cache_row(struct feh_row_sink *sink, int y, DATA32 *pixels)
+{
+	struct feh_tile_cache *tiles = ((struct feh_tile_cache_sink *)sink)->tiles;
+	struct feh_tile_cache_level *l = &tiles->levels[0];
+	int col, row = y / FEH_TILE_SIZE, ty = y % FEH_TILE_SIZE;
+
+	for (col = 0; col < l->cols; col++)
+		memcpy(feh_tile_cache_tile(tiles, 0, col, row) + ty * FEH_TILE_SIZE,
+				pixels + col * FEH_TILE_SIZE,
+				MIN(FEH_TILE_SIZE, l->w - col * FEH_TILE_SIZE) * sizeof(DATA32));
+}
+
+/* builds levels 1 and up, each tile from the 2x2 tiles below it */
+static void feh_tile_cache_reduce(struct feh_tile_cache *tiles)
+{
+	struct feh_tile_cache_level *l, *below;
+	int level, col, row, i, cx, cy;
+
+	for (level = 1; level < tiles->num_levels; level++) {
+		l = &tiles->levels[level];
+		below = &tiles->levels[level - 1];
+		for (row = 0; row < l->rows; row++) {
+			for (col = 0; col < l->cols; col++) {
+				for (i = 0; i < 4; i++) {
+					cx = 2 * col + (i & 1);
+					cy = 2 * row + (i >> 1);
+					if (cx >= below->cols || cy >= below->rows)
+						continue;
+					feh_pyramid_reduce(feh_tile_cache_tile(tiles, level, col, row),
+							FEH_TILE_SIZE, (i & 1) * FEH_TILE_SIZE / 2,
+							(i >> 1) * FEH_TILE_SIZE / 2,
+							feh_tile_cache_tile(tiles, level - 1, cx, cy),
+							FEH_TILE_SIZE,
+							MIN(FEH_TILE_SIZE, below->w - cx * FEH_TILE_SIZE),
+							MIN(FEH_TILE_SIZE, below->h - cy * FEH_TILE_SIZE));
+				}
+			}
+		}
+		/* the level below is only needed again once the user zooms in */
+		posix_madvise(tiles->map + below->offset, l->offset - below->offset,
+				POSIX_MADV_DONTNEED);
+	}
+	posix_madvise(tiles->map, tiles->size, POSIX_MADV_RANDOM);
+}
+
+/* copies the preview level into a regular image */
+static Imlib_Image feh_tile_cache_preview(struct feh_tile_cache *tiles)
+{
+	struct feh_tile_cache_level *l = &tiles->levels[tiles->preview_level];
+	Imlib_Image im;
+	DATA32 *data;
+	int y, col, tw;
+
+	if (!(im = imlib_create_image(l->w, l->h)))
+		return(NULL);
+	imlib_context_set_image(im);
+	imlib_image_set_has_alpha(tiles->has_alpha);
+	data = imlib_image_get_data();
+	for (y = 0; y < l->h; y++) {
+		for (col = 0; col < l->cols; col++) {
+			tw = MIN(FEH_TILE_SIZE, l->w - col * FEH_TILE_SIZE);
+			memcpy(data + y * l->w + col * FEH_TILE_SIZE,
+					feh_tile_cache_tile(tiles, tiles->preview_level, col,
+						y / FEH_TILE_SIZE) + (y % FEH_TILE_SIZE) * FEH_TILE_SIZE,
+					tw * sizeof(DATA32));
+		}
+	}
+	imlib_image_put_back_data(data);
+	return(tiles->preview = im);
+}
+
+/*
+ * Loads file (whose contents have been read into mf) through the tile cache
+ * if it is a PNG or PNM image of at least --out-of-core megapixels. Returns 0 if
+ * it is not, and the caller should load it as usual. Otherwise, *im is set
+ * to a preview of the image, or to NULL if the cache could not be built.
+ * After feh_tile_cache_disable, -1 is returned for such images instead.
+ */
+int feh_tile_cache_load(feh_file * file, struct feh_mapped_file *mf, Imlib_Image * im)
+{
+	struct feh_tile_cache_sink s;
+	struct stat st;
+	FILE *fp;
+	int ok = 0;
+
+	if (stat(file->filename, &st))
+		return(0);
+
+	if (file->tiles && ((file->tiles->mtime != st.st_mtime)
+				|| (file->tiles->file_size != st.st_size))) {
+		feh_tile_cache_free(file->tiles);
+		file->tiles = NULL;
+	}
+	if (file->tiles) {
+		*im = feh_tile_cache_preview(file->tiles);
+		return(1);
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.sink.start = feh_tile_cache_start;
+	s.sink.row = feh_tile_cache_row;
+
+	if (feh_pnm_size(mf->data, mf->size))
+		ok = feh_pnm_decode_rows(mf->data, mf->size, &s.sink);
+	else if ((fp = fmemopen(mf->data, mf->size, "rb"))) {
+		ok = feh_png_decode_rows(fp, &s.sink);
+		fclose(fp);
+	}
+
+	if (s.deferred)
+		return(-1);
+	if (!s.tiles)
+		return(0);
+
+	*im = NULL;
+	if (!ok) {
+		feh_tile_cache_free(s.tiles);
+		return(1);
+	}
+
+	feh_tile_cache_reduce(s.tiles);
+	s.tiles->mtime = st.st_mtime;
+	s.tiles->file_size = st.st_size;
+	file->tiles = s.tiles;
+	*im = feh_tile_cache_preview(file->tiles);
+	return(1);
+}
+
+static Imlib_Image feh_tile_cache_tile_func(void *data, int col, int row)
+{
+	struct feh_tile_cache_pos *pos = data;
+	Imlib_Image tile;
+
+	tile = imlib_create_image_using_data(FEH_TILE_SIZE, FEH_TILE_SIZE,
+			feh_tile_cache_tile(pos->tiles, pos->level, col, row));
+	if (tile) {
+		imlib_context_set_image(tile);
+		imlib_image_set_has_alpha(pos->tiles->has_alpha);
+	}
+	return(tile);
+}
+
+/*
+ * Renders the visible part of w's image onto w->bg_pmap from the tile
+ * cache. Returns 0 if w should be rendered the usual way instead, e.g.
+ * because the preview already has enough detail for the current zoom.
+ */
+int feh_tile_cache_render(winwidget w, int antialias)
+{
+	struct feh_tile_cache *tiles;
+	struct feh_tile_cache_pos pos;
+	double scale;
+	int level;
+
+	if (!w->file || (w->type == WIN_TYPE_THUMBNAIL) || w->has_rotated
+			|| !(tiles = FEH_FILE(w->file->data)->tiles)
+			|| (tiles->preview != w->im) || (w->zoom <= 1.0))
+		return(0);
+
+	/* zoom relative to the full image, and the level closest to it */
+	scale = w->zoom * w->im_w / tiles->levels[0].w;
+	for (level = tiles->preview_level; (level > 0) && (scale * (1 << level) > 1.0);
+			level--);
+	if (level == tiles->preview_level)
+		return(0);
+
+	pos.tiles = tiles;
+	pos.level = level;
+	feh_render_tiles(w, tiles->levels[level].w, tiles->levels[level].h,
+			scale * (1 << level), feh_tile_cache_tile_func, &pos, 1,
+			tiles->has_alpha, antialias);
+	return(1);
+}
@@ -24,96 +24,162 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 */
 
+/*
+ * Timers are kept in a binary min-heap ordered by their absolute deadline
+ * on the monotonic clock, so that the next one is always timers[0]. Each
+ * timer knows its own heap position, and timer_names maps names to timers,
+ * which makes replacing a named timer O(log n) instead of a list walk.
+ */
+
 #include "feh.h"
 #include "options.h"
 #include "timers.h"
 
-fehtimer first_timer = NULL;
+static fehtimer *timers = NULL;
+static unsigned int timer_count = 0;
+static unsigned int timer_size = 0;
+static gib_hash *timer_names = NULL;
+
+/* while non-zero, the time at which timers stopped counting down */
+static double suspended_at = 0.0;
+
+static void feh_timer_swap(unsigned int a, unsigned int b)
+{
+	fehtimer ft = timers[a];
+
+	timers[a] = timers[b];
+	timers[b] = ft;
+	timers[a]->pos = a;
+	timers[b]->pos = b;
+}
+
+static void feh_timer_sift_up(unsigned int i)
+{
+	while (i && (timers[(i - 1) / 2]->when > timers[i]->when)) {
+		feh_timer_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void feh_timer_sift_down(unsigned int i)
+{
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < timer_count) {
+		if ((child + 1 < timer_count)
+				&& (timers[child + 1]->when < timers[child]->when))
+			child++;
+		if (timers[i]->when <= timers[child]->when)
+			break;
+		feh_timer_swap(i, child);
+		i = child;
+	}
+}
+
+/* takes ft out of the queue. The caller frees it */
+static void feh_timer_unlink(fehtimer ft)
+{
+	unsigned int i = ft->pos;
+
+	gib_hash_remove(timer_names, ft->name);
+	timer_count--;
+	if (i != timer_count) {
+		timers[i] = timers[timer_count];
+		timers[i]->pos = i;
+		feh_timer_sift_down(i);
+		feh_timer_sift_up(i);
+	}
+}
+
+static void feh_timer_free(fehtimer ft)
+{
+	free(ft->name);
+	free(ft);
+}
+
+/* Returns the timer which is due next, or NULL if there are none */
+fehtimer feh_next_timer(void)
+{
+	return(timer_count ? timers[0] : NULL);
+}
 
 void feh_handle_timer(void)
 {
 	fehtimer ft;
 
-	if (!first_timer) {
+	if (!timer_count) {
 		D(("No timer to handle, returning\n"));
 		return;
 	}
-	ft = first_timer;
-	first_timer = first_timer->next;
+	ft = timers[0];
+	feh_timer_unlink(ft);
 	D(("Executing timer function now\n"));
 	(*(ft->func)) (ft->data);
 	D(("Freeing the timer\n"));
-	if (ft && ft->name)
-		free(ft->name);
-	if (ft)
-		free(ft);
+	feh_timer_free(ft);
 	return;
 }
 
 double feh_get_time(void)
 {
-	struct timeval timev;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((double) ts.tv_sec + (((double) ts.tv_nsec) / 1000000000));
+}
+
+/*
+ * Timers do not count down while zooming, panning or paused. Suspending
+ * remembers when that started, and resuming moves all deadlines back by the
+ * time spent in between, which keeps the heap order intact.
+ */
+void feh_suspend_timers(void)
+{
+	if (suspended_at == 0.0)
+		suspended_at = feh_get_time();
+}
+
+void feh_resume_timers(void)
+{
+	double delta;
+	unsigned int i;
 
-	gettimeofday(&timev, NULL);
-	return((double) timev.tv_sec + (((double) timev.tv_usec) / 1000000));
+	if (suspended_at == 0.0)
+		return;
+	delta = feh_get_time() - suspended_at;
+	suspended_at = 0.0;
+	for (i = 0; i < timer_count; i++)
+		timers[i]->when += delta;
 }
 
 void feh_remove_timer_by_data(void *data)
 {
-	fehtimer ft, ptr, pptr;
-
-	D(("removing timer for %p\n", data));
-	pptr = NULL;
-	ptr = first_timer;
-	while (ptr) {
-		D(("Stepping through event list\n"));
-		ft = ptr;
+	unsigned int i = 0;
+	fehtimer ft;
+
+	D(("removing timers for %p\n", data));
+	while (i < timer_count) {
+		ft = timers[i];
 		if (ft->data == data) {
-			D(("Found it. Removing\n"));
-			if (pptr)
-				pptr->next = ft->next;
-			else
-				first_timer = ft->next;
-			if (ft->next)
-				ft->next->in += ft->in;
-			if (ft->name)
-				free(ft->name);
-			if (ft)
-				free(ft);
-			return;
-		}
-		pptr = ptr;
-		ptr = ptr->next;
+			D(("Found %s. Removing\n", ft->name));
+			feh_timer_unlink(ft);
+			feh_timer_free(ft);
+			/* position i now holds a different timer, check it again */
+			i = 0;
+		} else
+			i++;
 	}
 	return;
 }
 
 static void feh_remove_timer(char *name)
 {
-	fehtimer ft, ptr, pptr;
-
-	D(("removing %s\n", name));
-	pptr = NULL;
-	ptr = first_timer;
-	while (ptr) {
-		D(("Stepping through event list\n"));
-		ft = ptr;
-		if (!strcmp(ft->name, name)) {
-			D(("Found it. Removing\n"));
-			if (pptr)
-				pptr->next = ft->next;
-			else
-				first_timer = ft->next;
-			if (ft->next)
-				ft->next->in += ft->in;
-			if (ft->name)
-				free(ft->name);
-			if (ft)
-				free(ft);
-			return;
-		}
-		pptr = ptr;
-		ptr = ptr->next;
+	fehtimer ft;
+
+	if (timer_names && (ft = gib_hash_get(timer_names, name))) {
+		D(("removing %s\n", name));
+		feh_timer_unlink(ft);
+		feh_timer_free(ft);
 	}
 	return;
 }
@@ -121,54 +187,30 @@ static void feh_remove_timer(char *name)
 
 void feh_add_timer(void (*func) (void *data), void *data, double in, char *name)
 {
-	fehtimer ft, ptr, pptr;
-	double tally;
+	fehtimer ft;
 
 	D(("adding timer %s for %f seconds time\n", name, in));
 	feh_remove_timer(name);
 	ft = emalloc(sizeof(_fehtimer));
-	ft->next = NULL;
 	ft->func = func;
 	ft->data = data;
 	ft->name = estrdup(name);
-	ft->just_added = 1;
-	ft->in = in;
-	D(("ft->in = %f\n", ft->in));
-	if (!first_timer) {
-		D(("No first timer\n"));
-		first_timer = ft;
-	} else {
-		D(("There is a first timer\n"));
-		pptr = NULL;
-		ptr = first_timer;
-		tally = 0.0;
-		while (ptr) {
-			tally += ptr->in;
-			if (tally > in) {
-				tally -= ptr->in;
-				ft->next = ptr;
-				if (pptr)
-					pptr->next = ft;
-				else
-					first_timer = ft;
-				ft->in -= tally;
-				if (ft->next)
-					ft->next->in -= ft->in;
-				return;
-			}
-			pptr = ptr;
-			ptr = ptr->next;
-		}
-		if (pptr)
-			pptr->next = ft;
-		else
-			first_timer = ft;
-		ft->in -= tally;
+	/* while suspended, the countdown only starts on resume */
+	ft->when = (suspended_at != 0.0 ? suspended_at : feh_get_time()) + in;
+
+	if (!timer_names)
+		timer_names = gib_hash_new();
+	gib_hash_set(timer_names, ft->name, ft);
+
+	if (timer_count == timer_size) {
+		timer_size = timer_size ? timer_size * 2 : 16;
+		timers = erealloc(timers, timer_size * sizeof(fehtimer));
 	}
-	D(("ft->in = %f\n", ft->in));
+	ft->pos = timer_count++;
+	timers[ft->pos] = ft;
+	feh_timer_sift_up(ft->pos);
 	return;
 }
-
 void feh_add_unique_timer(void (*func) (void *data), void *data, double in)
 {
 	static long i = 0;
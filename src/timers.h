@@ -30,17 +30,17 @@ struct __fehtimer {
 	char *name;
 	void (*func) (void *data);
 	void *data;
-	double in;
-	char just_added;
-	fehtimer next;
+	double when;	/* deadline, in feh_get_time() seconds */
+	unsigned int pos;	/* index in the timer heap */
 };
 
+fehtimer feh_next_timer(void);
 void feh_handle_timer(void);
 double feh_get_time(void);
+void feh_suspend_timers(void);
+void feh_resume_timers(void);
 void feh_remove_timer_by_data(void *data);
 void feh_add_timer(void (*func) (void *data), void *data, double in, char *name);
 void feh_add_unique_timer(void (*func) (void *data), void *data, double in);
 
-extern fehtimer first_timer;
-
 #endif
@@ -26,6 +26,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "feh.h"
 #include "debug.h"
 #include "options.h"
+#include <fcntl.h>
 
 /* eprintf: print error message and exit */
 void eprintf(char *fmt, ...)
@@ -227,3 +228,118 @@ char *shell_escape(char *input)
 
 	return ret;
 }
+
+/*
+ * Returns feh's own cache directory ($XDG_CACHE_HOME/feh or ~/.cache/feh),
+ * creating it if necessary, or NULL if there is none.
+ * free the result please
+ */
+char *feh_cache_dir(void)
+{
+	char *dir = NULL, *home, *xdg_cache_home, *p, c;
+	struct stat st;
+
+	xdg_cache_home = getenv("XDG_CACHE_HOME");
+	if (xdg_cache_home && xdg_cache_home[0] == '/')
+		dir = estrjoin("/", xdg_cache_home, "feh", NULL);
+	else {
+		home = getenv("HOME");
+		if (home && home[0] == '/')
+			dir = estrjoin("/", home, ".cache/feh", NULL);
+	}
+
+	if (!dir)
+		return(NULL);
+
+	for (p = dir + 1; ; p++) {
+		if (*p && *p != '/')
+			continue;
+		c = *p;
+		*p = '\0';
+		if (stat(dir, &st) != 0 && mkdir(dir, 0700) == -1) {
+			weprintf("unable to create directory %s:", dir);
+			free(dir);
+			return(NULL);
+		}
+		*p = c;
+		if (!c)
+			break;
+	}
+	return(dir);
+}
+
+/*
+ * Reads the regular file path into memory. Returns 1 on success, 0 if the
+ * file cannot be read (e.g. because it is empty or not a regular file).
+ *
+ * This used to be a mapping, but a file truncated by another writer while
+ * it is mapped (rsync --inplace, editors saving in place, NFS) raises
+ * SIGBUS in whatever decodes it. Reading it from the one open descriptor
+ * merely yields a short read, which the decoders report as a load error.
+ */
+int feh_map_file(char *path, struct feh_mapped_file *mf)
+{
+	struct stat st;
+	unsigned char *data;
+	size_t used = 0;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return(0);
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return(0);
+	}
+
+	/* the file may change size while it is read, st_size is a hint */
+	data = emalloc(st.st_size);
+	do {
+		if ((n = read(fd, data + used, st.st_size - used)) > 0)
+			used += n;
+	} while ((used < (size_t)st.st_size) && (n > 0 || (n == -1 && errno == EINTR)));
+	close(fd);
+
+	if (n == -1 || used == 0) {
+		free(data);
+		return(0);
+	}
+
+	mf->data = data;
+	mf->size = used;
+	return(1);
+}
+
+void feh_unmap_file(struct feh_mapped_file *mf)
+{
+	free(mf->data);
+	mf->data = NULL;
+	mf->size = 0;
+}
+
+/*
+ * Reads fd until EOF. Returns its contents (free them please) and stores
+ * their size in len, or returns NULL on read errors.
+ */
+unsigned char *feh_read_fd(int fd, size_t *len)
+{
+	unsigned char *data = NULL;
+	size_t size = 0, used = 0;
+	ssize_t n;
+
+	do {
+		if (used == size) {
+			size = size ? size * 2 : 65536;
+			data = erealloc(data, size);
+		}
+		if ((n = read(fd, data + used, size - used)) > 0)
+			used += n;
+	} while (n > 0 || (n == -1 && errno == EINTR));
+
+	if (n == -1) {
+		free(data);
+		return(NULL);
+	}
+	*len = used;
+	return(erealloc(data, used ? used : 1));
+}
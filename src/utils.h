@@ -47,6 +47,24 @@ char path_is_url(char *path);
 char *feh_unique_filename(char *path, char *basename);
 char *ereadfile(char *path);
 char *shell_escape(char *input);
+char *feh_cache_dir(void);
+
+/* a file read into memory by feh_map_file */
+struct feh_mapped_file {
+	unsigned char *data;
+	size_t size;
+};
+
+int feh_map_file(char *path, struct feh_mapped_file *mf);
+void feh_unmap_file(struct feh_mapped_file *mf);
+unsigned char *feh_read_fd(int fd, size_t *len);
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
 
 #define ESTRAPPEND(a,b) \
   {\
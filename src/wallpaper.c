@@ -90,8 +90,8 @@ static void feh_wm_set_bg_scaled(Pixmap pmap, Imlib_Image im, int use_filelist,
 	if (use_filelist)
 		feh_wm_load_next(&im);
 
-	gib_imlib_render_image_on_drawable_at_size(pmap, im, x, y, w, h,
-			1, 1, !opt.force_aliasing);
+	feh_render_image_part(pmap, im, 0, 0, gib_imlib_image_get_width(im),
+			gib_imlib_image_get_height(im), x, y, w, h, 1, !opt.force_aliasing);
 
 	if (use_filelist)
 		gib_imlib_free_image_and_decache(im);
@@ -123,7 +123,7 @@ static void feh_wm_set_bg_centered(Pixmap pmap, Imlib_Image im, int use_filelist
 	else
 		offset_y = (h - gib_imlib_image_get_height(im)) >> 1;
 
-	gib_imlib_render_image_part_on_drawable_at_size(pmap, im,
+	feh_render_image_part(pmap, im,
 		((offset_x < 0) ? -offset_x : 0),
 		((offset_y < 0) ? -offset_y : 0),
 		w,
@@ -132,7 +132,7 @@ static void feh_wm_set_bg_centered(Pixmap pmap, Imlib_Image im, int use_filelist
 		y + ((offset_y > 0) ? offset_y : 0),
 		w,
 		h,
-		1, 1, 0);
+		1, 0);
 
 	if (use_filelist)
 		gib_imlib_free_image_and_decache(im);
@@ -185,11 +185,11 @@ static void feh_wm_set_bg_filled(Pixmap pmap, Imlib_Image im, int use_filelist,
 		}
 	}
 
-	gib_imlib_render_image_part_on_drawable_at_size(pmap, im,
+	feh_render_image_part(pmap, im,
 		render_x, render_y,
 		render_w, render_h,
 		x, y, w, h,
-		1, 1, !opt.force_aliasing);
+		1, !opt.force_aliasing);
 
 	if (use_filelist)
 		gib_imlib_free_image_and_decache(im);
@@ -234,10 +234,9 @@ static void feh_wm_set_bg_maxed(Pixmap pmap, Imlib_Image im, int use_filelist,
 	render_x = x + (  border_x ? margin_x : 0);
 	render_y = y + ( !border_x ? margin_y : 0);
 
-	gib_imlib_render_image_on_drawable_at_size(pmap, im,
-		render_x, render_y,
-		render_w, render_h,
-		1, 1, !opt.force_aliasing);
+	feh_render_image_part(pmap, im, 0, 0,
+		gib_imlib_image_get_width(im), gib_imlib_image_get_height(im),
+		render_x, render_y, render_w, render_h, 1, !opt.force_aliasing);
 
 	if (use_filelist)
 		gib_imlib_free_image_and_decache(im);
@@ -38,6 +38,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 static void winwidget_unregister(winwidget win);
 static void winwidget_register(winwidget win);
 static winwidget winwidget_allocate(void);
+static GC feh_checks_gc(winwidget win);
 
 
 int window_num = 0;		/* For window list */
@@ -60,6 +61,8 @@ static winwidget winwidget_allocate(void)
 	ret->bg_pmap = 0;
 	ret->bg_pmap_cache = 0;
 	ret->im = NULL;
+	ret->pyramid = NULL;
+	ret->pmap_plain = 0;
 	ret->name = NULL;
 	ret->file = NULL;
 	ret->errstr = NULL;
@@ -457,11 +460,75 @@ void winwidget_setup_pixmaps(winwidget winwid)
 	return;
 }
 
-void winwidget_render_image(winwidget winwid, int resize, int force_alias)
+/*
+ * Draws the visible part of winwid->im onto winwid->bg_pmap. Returns 1 if
+ * every image pixel went to the same place as in a render of any other
+ * part of the window, which is what winwidget_render_area relies on. This
+ * holds at zoom 1 and for the tile renderers, which place their tiles
+ * relative to the image origin. Otherwise, source and destination are
+ * rounded separately for each call.
+ */
+static int winwidget_draw_image(winwidget winwid, int antialias)
 {
 	int sx, sy, sw, sh, dx, dy, dw, dh;
 	int calc_w, calc_h;
-	int antialias = 0;
+
+	/* Now we ensure only to render the area we're looking at */
+	dx = winwid->im_x;
+	dy = winwid->im_y;
+	if (dx < 0)
+		dx = 0;
+	if (dy < 0)
+		dy = 0;
+
+	if (winwid->im_x < 0)
+		sx = 0 - lround(winwid->im_x / winwid->zoom);
+	else
+		sx = 0;
+
+	if (winwid->im_y < 0)
+		sy = 0 - lround(winwid->im_y / winwid->zoom);
+	else
+		sy = 0;
+
+	calc_w = lround(winwid->im_w * winwid->zoom);
+	calc_h = lround(winwid->im_h * winwid->zoom);
+	dw = (winwid->w - winwid->im_x);
+	dh = (winwid->h - winwid->im_y);
+	if (calc_w < dw)
+		dw = calc_w;
+	if (calc_h < dh)
+		dh = calc_h;
+	if (dw > winwid->w)
+		dw = winwid->w;
+	if (dh > winwid->h)
+		dh = winwid->h;
+
+	sw = lround(dw / winwid->zoom);
+	sh = lround(dh / winwid->zoom);
+
+	D(("sx: %d sy: %d sw: %d sh: %d dx: %d dy: %d dw: %d dh: %d zoom: %f\n",
+	   sx, sy, sw, sh, dx, dy, dw, dh, winwid->zoom));
+
+	D(("winwidget_render(): winwid->im_angle = %f\n", winwid->im_angle));
+	if (winwid->has_rotated) {
+		gib_imlib_render_image_part_on_drawable_at_size_with_rotation
+			(winwid->bg_pmap, winwid->im, sx, sy, sw, sh, dx, dy, dw, dh,
+			winwid->im_angle, 1, 1, antialias);
+		return(0);
+	}
+	if (feh_tile_cache_render(winwid, antialias)
+			|| feh_pyramid_render(winwid, antialias))
+		return(1);
+	feh_render_image_part(winwid->bg_pmap, winwid->im,
+			sx, sy, sw, sh, dx, dy, dw, dh,
+			gib_imlib_image_has_alpha(winwid->im), antialias);
+	return(winwid->zoom == 1.0);
+}
+
+void winwidget_render_image(winwidget winwid, int resize, int force_alias)
+{
+	int antialias = 0, exact;
 
 	if (!winwid->full_screen && resize) {
 		if (opt.default_zoom) {
@@ -527,59 +594,10 @@ void winwidget_render_image(winwidget winwid, int resize, int force_alias)
 				     || (winwid->has_rotated)))
 		feh_draw_checks(winwid);
 
-	/* Now we ensure only to render the area we're looking at */
-	dx = winwid->im_x;
-	dy = winwid->im_y;
-	if (dx < 0)
-		dx = 0;
-	if (dy < 0)
-		dy = 0;
-
-	if (winwid->im_x < 0)
-		sx = 0 - lround(winwid->im_x / winwid->zoom);
-	else
-		sx = 0;
-
-	if (winwid->im_y < 0)
-		sy = 0 - lround(winwid->im_y / winwid->zoom);
-	else
-		sy = 0;
-
-	calc_w = lround(winwid->im_w * winwid->zoom);
-	calc_h = lround(winwid->im_h * winwid->zoom);
-	dw = (winwid->w - winwid->im_x);
-	dh = (winwid->h - winwid->im_y);
-	if (calc_w < dw)
-		dw = calc_w;
-	if (calc_h < dh)
-		dh = calc_h;
-	if (dw > winwid->w)
-		dw = winwid->w;
-	if (dh > winwid->h)
-		dh = winwid->h;
-
-	sw = lround(dw / winwid->zoom);
-	sh = lround(dh / winwid->zoom);
-
-	D(("sx: %d sy: %d sw: %d sh: %d dx: %d dy: %d dw: %d dh: %d zoom: %f\n",
-	   sx, sy, sw, sh, dx, dy, dw, dh, winwid->zoom));
-
 	if ((winwid->zoom != 1.0 || winwid->has_rotated) && !force_alias && !winwid->force_aliasing)
 		antialias = 1;
 
-	D(("winwidget_render(): winwid->im_angle = %f\n", winwid->im_angle));
-	if (winwid->has_rotated)
-		gib_imlib_render_image_part_on_drawable_at_size_with_rotation
-			(winwid->bg_pmap, winwid->im, sx, sy, sw, sh, dx, dy, dw, dh,
-			winwid->im_angle, 1, 1, antialias);
-	else
-		gib_imlib_render_image_part_on_drawable_at_size(winwid->bg_pmap,
-								winwid->im,
-								sx, sy, sw,
-								sh, dx, dy,
-								dw, dh, 1,
-								gib_imlib_image_has_alpha(winwid->im),
-								antialias);
+	exact = winwidget_draw_image(winwid, antialias);
 
 	if (opt.mode == MODE_NORMAL) {
 		if (opt.caption_path)
@@ -606,6 +624,93 @@ void winwidget_render_image(winwidget winwid, int resize, int force_alias)
 	} else if ((opt.mode == MODE_ZOOM) && !antialias)
 		feh_draw_zoom(winwid);
 
+	winwid->pmap_plain = (opt.mode == MODE_PAN) && !antialias && exact;
+	winwid->pmap_x = winwid->im_x;
+	winwid->pmap_y = winwid->im_y;
+
+	XSetWindowBackgroundPixmap(disp, winwid->win, winwid->bg_pmap);
+	XClearWindow(disp, winwid->win);
+	return;
+}
+
+/*
+ * Renders the area x, y, w, h of winwid onto its bg_pmap: the whole window
+ * is rendered into a pixmap of that size, with the image moved by -x, -y.
+ * Image offsets stay integers this way, so wherever winwidget_draw_image
+ * places pixels exactly, they end up where a full render would put them.
+ */
+static void winwidget_render_area(winwidget winwid, int x, int y, int w, int h)
+{
+	static GC copy_gc = None;
+	Pixmap bg_pmap = winwid->bg_pmap;
+	int win_w = winwid->w, win_h = winwid->h;
+	GC gc;
+
+	if ((w <= 0) || (h <= 0))
+		return;
+	if (copy_gc == None)
+		copy_gc = XCreateGC(disp, winwid->win, 0, NULL);
+
+	winwid->bg_pmap = XCreatePixmap(disp, winwid->win, w, h, depth);
+	winwid->w = w;
+	winwid->h = h;
+	winwid->im_x -= x;
+	winwid->im_y -= y;
+
+	/* align tiled backgrounds with the rest of the window */
+	gc = winwid->full_screen ? winwid->gc : feh_checks_gc(winwid);
+	XSetTSOrigin(disp, gc, -x, -y);
+	XFillRectangle(disp, winwid->bg_pmap, gc, 0, 0, w, h);
+	XSetTSOrigin(disp, gc, 0, 0);
+
+	winwidget_draw_image(winwid, 0);
+
+	XCopyArea(disp, winwid->bg_pmap, bg_pmap, copy_gc, 0, 0, w, h, x, y);
+	XFreePixmap(disp, winwid->bg_pmap);
+	winwid->bg_pmap = bg_pmap;
+	winwid->w = win_w;
+	winwid->h = win_h;
+	winwid->im_x += x;
+	winwid->im_y += y;
+	return;
+}
+
+/*
+ * Like winwidget_render_image(winwid, 0, 1), but if bg_pmap still holds the
+ * image without any overlays, its contents are shifted by the distance the
+ * image was panned and only the newly exposed strips are rendered. So the
+ * cost of a pan step depends on how far it goes, not on the window size.
+ */
+void winwidget_render_image_pan(winwidget winwid)
+{
+	static GC gc = None;
+	int dx = winwid->im_x - winwid->pmap_x;
+	int dy = winwid->im_y - winwid->pmap_y;
+	int w = winwid->w, h = winwid->h;
+
+	if (!winwid->pmap_plain || (opt.mode != MODE_PAN) || !winwid->bg_pmap
+			|| winwid->had_resize || winwid->has_rotated
+			|| (abs(dx) >= w) || (abs(dy) >= h)) {
+		winwidget_render_image(winwid, 0, 1);
+		return;
+	}
+	if (gc == None)
+		gc = XCreateGC(disp, winwid->win, 0, NULL);
+
+	D(("panning by %d,%d\n", dx, dy));
+
+	XCopyArea(disp, winwid->bg_pmap, winwid->bg_pmap, gc,
+			MAX(0, -dx), MAX(0, -dy), w - abs(dx), h - abs(dy),
+			MAX(0, dx), MAX(0, dy));
+
+	/* the full-height column on the left or right, then the rest of the row */
+	winwidget_render_area(winwid, (dx > 0) ? 0 : w + dx, 0, abs(dx), h);
+	winwidget_render_area(winwid, MAX(0, dx), (dy > 0) ? 0 : h + dy,
+			w - abs(dx), abs(dy));
+
+	winwid->pmap_x = winwid->im_x;
+	winwid->pmap_y = winwid->im_y;
+
 	XSetWindowBackgroundPixmap(disp, winwid->win, winwid->bg_pmap);
 	XClearWindow(disp, winwid->win);
 	return;
@@ -619,6 +724,7 @@ void winwidget_render_image_cached(winwidget winwid)
 		gc = XCreateGC(disp, winwid->win, 0, NULL);
 	}
 	XCopyArea(disp, winwid->bg_pmap_cache, winwid->bg_pmap, gc, 0, 0, winwid->w, winwid->h, 0, 0);
+	winwid->pmap_plain = 0;
 
 	if (opt.caption_path)
 		feh_draw_caption(winwid);
@@ -678,7 +784,7 @@ Pixmap feh_create_checks(void)
 	return(checks_pmap);
 }
 
-void feh_draw_checks(winwidget win)
+static GC feh_checks_gc(winwidget win)
 {
 	static GC gc = None;
 	XGCValues gcval;
@@ -688,7 +794,12 @@ void feh_draw_checks(winwidget win)
 		gcval.fill_style = FillTiled;
 		gc = XCreateGC(disp, win->win, GCTile | GCFillStyle, &gcval);
 	}
-	XFillRectangle(disp, win->bg_pmap, gc, 0, 0, win->w, win->h);
+	return(gc);
+}
+
+void feh_draw_checks(winwidget win)
+{
+	XFillRectangle(disp, win->bg_pmap, feh_checks_gc(win), 0, 0, win->w, win->h);
 	return;
 }
 
@@ -718,8 +829,11 @@ void winwidget_destroy(winwidget winwid)
 		free(winwid->name);
 	if (winwid->gc)
 		XFreeGC(disp, winwid->gc);
+	feh_pyramid_free(winwid);
 	if (winwid->im)
 		gib_imlib_free_image_and_decache(winwid->im);
+	if (winwid->file && (winwid->type != WIN_TYPE_THUMBNAIL))
+		feh_tile_cache_release(FEH_FILE(winwid->file->data));
 	free(winwid);
 	return;
 }
@@ -830,7 +944,8 @@ int winwidget_loadimage(winwidget winwid, feh_file * file)
 #ifdef HAVE_INOTIFY
     winwidget_inotify_remove(winwid);
 #endif
-    int res = feh_load_image(&(winwid->im), file);
+    int res = slideshow_prefetch_take(&(winwid->im), file)
+        || feh_load_image(&(winwid->im), file);
 #ifdef HAVE_INOTIFY
     if (res) {
         winwidget_inotify_add(winwid, file);
@@ -1050,6 +1165,7 @@ void winwidget_rename(winwidget winwid, char *newname)
 
 void winwidget_free_image(winwidget w)
 {
+	feh_pyramid_free(w);
 	if (w->im) {
 		gib_imlib_free_image(w->im);
 	}
@@ -117,6 +117,18 @@ struct __winwidget {
 
 	unsigned char has_rotated;
 
+	/* see pyramid.c, only set for very large images */
+	struct feh_pyramid *pyramid;
+
+	/*
+	 * Set if bg_pmap holds nothing but the image at pmap_x / pmap_y, drawn
+	 * with exact pixel placement, so that panning can shift it instead of
+	 * rendering it again
+	 */
+	unsigned char pmap_plain;
+	int pmap_x;
+	int pmap_y;
+
 #ifdef HAVE_INOTIFY
 	int inotify_wd;
 #endif
@@ -135,6 +147,7 @@ void winwidget_destroy_all(void);
 void winwidget_free_image(winwidget w);
 void winwidget_center_image(winwidget w);
 void winwidget_render_image(winwidget winwid, int resize, int force_alias);
+void winwidget_render_image_pan(winwidget winwid);
 void winwidget_rotate_image(winwidget winid, double angle);
 void winwidget_move(winwidget winwid, int x, int y);
 void winwidget_resize(winwidget winwid, int w, int h, int force_resize);
@@ -163,6 +176,17 @@ void winwidget_reset_image(winwidget winwid);
 void winwidget_sanitise_offsets(winwidget winwid);
 void winwidget_size_to_image(winwidget winwid);
 void winwidget_render_image_cached(winwidget winwid);
+int feh_pyramid_render(winwidget w, int antialias);
+void feh_pyramid_free(winwidget w);
+int feh_tile_cache_render(winwidget w, int antialias);
+
+#define FEH_TILE_SIZE 256
+
+typedef Imlib_Image (*feh_tile_func)(void *data, int col, int row);
+
+void feh_render_tiles(winwidget w, int lw, int lh, double zoom,
+		feh_tile_func get_tile, void *data, int free_tiles,
+		int has_alpha, int antialias);
 
 extern int window_num;		/* For window list */
 extern winwidget *windows;	/* List of windows to loop though */
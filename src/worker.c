@@ -0,0 +1,557 @@
+/* worker.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include "worker.h"
+#include "loop.h"
+#include <fcntl.h>
+#include <sys/select.h>
+
+/* jobs whose child is still running, for feh_job_fill_fdset */
+static gib_list *running_jobs = NULL;
+
+static int feh_job_write_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = write(fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return(0);
+		}
+		p += n;
+		len -= n;
+	}
+	return(1);
+}
+
+static int feh_job_child_run(feh_file * file, feh_job_func func, int fd, int send_image)
+{
+	struct feh_job_header header;
+	Imlib_Image im = NULL;
+
+	memset(&header, 0, sizeof(header));
+	header.ok = func(file, &im, &header.orig_w, &header.orig_h);
+
+	if (header.ok && im && send_image) {
+		header.w = gib_imlib_image_get_width(im);
+		header.h = gib_imlib_image_get_height(im);
+		header.has_alpha = gib_imlib_image_has_alpha(im);
+		if (gib_imlib_image_format(im))
+			strncpy(header.format, gib_imlib_image_format(im),
+					sizeof(header.format) - 1);
+	}
+	if (file->info) {
+		header.has_info = 1;
+		header.info_width = file->info->width;
+		header.info_height = file->info->height;
+		header.info_size = file->info->size;
+		header.info_has_alpha = file->info->has_alpha;
+		if (file->info->format && !header.format[0])
+			strncpy(header.format, file->info->format,
+					sizeof(header.format) - 1);
+	}
+
+	if (!feh_job_write_all(fd, &header, sizeof(header)))
+		return(0);
+	if (header.w) {
+		imlib_context_set_image(im);
+		if (!feh_job_write_all(fd, imlib_image_get_data_for_reading_only(),
+				(size_t)header.w * header.h * sizeof(DATA32)))
+			return(0);
+	}
+	if (header.ok && im)
+		gib_imlib_free_image_and_decache(im);
+	return(1);
+}
+
+/*
+ * Workers are cancelled with SIGTERM. A converter started by the worker
+ * must not outlive it, and its conversion slot has to be returned.
+ */
+static void feh_job_child_terminate(int signo __attribute__((unused)))
+{
+	feh_conversion_abort();
+	_exit(1);
+}
+
+static void feh_job_child(feh_job * job, feh_job_func func, int fd)
+{
+	struct sigaction sa;
+	gib_list *l;
+	int i;
+
+	/*
+	 * The parent handles user signals and owns any files left in the
+	 * conversion cache. Temporary files created here are unlinked right
+	 * after loading.
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGUSR2, &sa, NULL);
+	sa.sa_handler = feh_job_child_terminate;
+	sigaction(SIGTERM, &sa, NULL);
+	opt.use_conversion_cache = 0;
+
+	if (job->results) {
+		for (i = 0, l = job->node; i < job->count && l; i++, l = l->next)
+			if (!feh_job_child_run(FEH_FILE(l->data), func, fd, 0))
+				break;
+	} else
+		feh_job_child_run(job->file, func, fd, 1);
+
+	/*
+	 * _exit: the atexit handler would close the parent's X connection and
+	 * remove its temporary files.
+	 */
+	_exit(0);
+}
+
+/* main loop handler, see feh_loop_watch */
+static void feh_job_handle_fd(void *data)
+{
+	feh_job_poll(data);
+}
+
+static feh_job *feh_job_spawn(feh_job * job, feh_job_func func)
+{
+	int fds[2], slot_fds[2];
+
+	job->fd = -1;
+	job->slot_fd = -1;
+	job->state = JOB_RUNNING;
+
+	if (pipe(fds) == -1) {
+		weprintf("pipe failed:");
+		job->state = JOB_FAILED;
+		return(job);
+	}
+	if (pipe(slot_fds) == -1) {
+		weprintf("pipe failed:");
+		close(fds[0]);
+		close(fds[1]);
+		job->state = JOB_FAILED;
+		return(job);
+	}
+
+	job->pid = fork();
+	if (job->pid == -1) {
+		weprintf("fork failed:");
+		close(fds[0]);
+		close(fds[1]);
+		close(slot_fds[0]);
+		close(slot_fds[1]);
+		job->state = JOB_FAILED;
+		return(job);
+	}
+	if (job->pid == 0) {
+		close(fds[0]);
+		close(slot_fds[0]);
+		fcntl(slot_fds[1], F_SETFD, FD_CLOEXEC);
+		feh_conversion_slot_report(slot_fds[1]);
+		feh_job_child(job, func, fds[1]);
+	}
+
+	close(fds[1]);
+	close(slot_fds[1]);
+	job->fd = fds[0];
+	fcntl(job->fd, F_SETFL, fcntl(job->fd, F_GETFL) | O_NONBLOCK);
+	fcntl(job->fd, F_SETFD, FD_CLOEXEC);
+	job->slot_fd = slot_fds[0];
+	fcntl(job->slot_fd, F_SETFL, fcntl(job->slot_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(job->slot_fd, F_SETFD, FD_CLOEXEC);
+	running_jobs = gib_list_add_front(running_jobs, job);
+	feh_loop_watch(job->fd, feh_job_handle_fd, job);
+
+	return(job);
+}
+
+feh_job *feh_job_start(feh_file * file, feh_job_func func)
+{
+	feh_job *job;
+
+	job = emalloc(sizeof(feh_job));
+	memset(job, 0, sizeof(feh_job));
+	job->file = file;
+	job->count = 1;
+
+	return(feh_job_spawn(job, func));
+}
+
+/*
+ * Runs func for count consecutive list entries starting at node in a single
+ * worker. Only file info is sent back; see feh_job_queue_next.
+ */
+feh_job *feh_job_start_batch(gib_list * node, int count, feh_job_func func)
+{
+	feh_job *job;
+
+	job = emalloc(sizeof(feh_job));
+	memset(job, 0, sizeof(feh_job));
+	job->file = FEH_FILE(node->data);
+	job->node = node;
+	job->count = count;
+	job->results = emalloc(count * sizeof(struct feh_job_header));
+
+	return(feh_job_spawn(job, func));
+}
+
+static void feh_job_apply_info(feh_file * file, struct feh_job_header *header)
+{
+	if (!header->has_info || file->info)
+		return;
+
+	file->info = feh_file_info_new();
+	file->info->width = header->info_width;
+	file->info->height = header->info_height;
+	file->info->pixels = header->info_width * header->info_height;
+	file->info->size = header->info_size;
+	file->info->has_alpha = header->info_has_alpha;
+	file->info->format = estrdup(header->format);
+}
+
+static void feh_job_finish(feh_job * job, enum feh_job_state state)
+{
+	gib_list *l;
+	int status = 0;
+
+	if (job->data) {
+		imlib_context_set_image(job->im);
+		imlib_image_put_back_data(job->data);
+		job->data = NULL;
+	}
+	if ((state == JOB_FAILED) && job->im) {
+		imlib_context_set_image(job->im);
+		imlib_free_image();
+		job->im = NULL;
+	}
+
+	feh_loop_unwatch(job->fd);
+	close(job->fd);
+	job->fd = -1;
+	waitpid(job->pid, &status, 0);
+	feh_conversion_slot_reclaim(job->slot_fd, status);
+	close(job->slot_fd);
+	job->slot_fd = -1;
+	job->state = state;
+
+	if ((l = gib_list_find_by_data(running_jobs, job)))
+		running_jobs = gib_list_remove(running_jobs, l);
+
+	if ((state == JOB_DONE) && !job->results)
+		feh_job_apply_info(job->file, &job->header);
+}
+
+/*
+ * Reads whatever the child has sent so far without blocking. Returns 1 once
+ * the job has finished (successfully or not), 0 while it is still running.
+ */
+int feh_job_poll(feh_job * job)
+{
+	size_t len;
+	ssize_t n;
+
+	while (job->results && (job->state == JOB_RUNNING)) {
+		len = job->count * sizeof(struct feh_job_header);
+		n = read(job->fd, (char *)job->results + job->results_read,
+				len - job->results_read);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return(0);
+		if (n <= 0)
+			feh_job_finish(job, JOB_FAILED);
+		else if ((job->results_read += n) == len)
+			feh_job_finish(job, JOB_DONE);
+	}
+
+	while (job->state == JOB_RUNNING) {
+		if (job->header_read < sizeof(job->header)) {
+			n = read(job->fd, (char *)&job->header + job->header_read,
+					sizeof(job->header) - job->header_read);
+			if (n > 0)
+				job->header_read += n;
+		} else {
+			len = (size_t)job->header.w * job->header.h * sizeof(DATA32);
+			n = read(job->fd, (char *)job->data + job->data_read,
+					len - job->data_read);
+			if (n > 0)
+				job->data_read += n;
+		}
+
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return(0);
+		if (n <= 0) {
+			feh_job_finish(job, JOB_FAILED);
+			break;
+		}
+
+		if (job->header_read < sizeof(job->header))
+			continue;
+
+		if (!job->data) {
+			if (!job->header.ok || !job->header.w || !job->header.h) {
+				feh_job_finish(job, job->header.ok ? JOB_DONE : JOB_FAILED);
+				break;
+			}
+			if (!(job->im = imlib_create_image(job->header.w, job->header.h))) {
+				feh_job_finish(job, JOB_FAILED);
+				break;
+			}
+			imlib_context_set_image(job->im);
+			job->data = imlib_image_get_data();
+		} else if (job->data_read == (size_t)job->header.w * job->header.h * sizeof(DATA32)) {
+			imlib_context_set_image(job->im);
+			imlib_image_set_has_alpha(job->header.has_alpha);
+			if (job->header.format[0])
+				imlib_image_set_format(job->header.format);
+			feh_job_finish(job, JOB_DONE);
+		}
+	}
+	return(1);
+}
+
+static int feh_job_fill_fdset(fd_set * fdset, int fdsize)
+{
+	gib_list *l;
+
+	for (l = running_jobs; l; l = l->next) {
+		FD_SET(((feh_job *) l->data)->fd, fdset);
+		if (((feh_job *) l->data)->fd + 1 > fdsize)
+			fdsize = ((feh_job *) l->data)->fd + 1;
+	}
+	return(fdsize);
+}
+
+static void feh_job_handle_fdset(fd_set * fdset)
+{
+	gib_list *l, *next;
+
+	for (l = running_jobs; l; l = next) {
+		next = l->next;
+		if (FD_ISSET(((feh_job *) l->data)->fd, fdset))
+			feh_job_poll(l->data);
+	}
+}
+
+/*
+ * Blocks until the job has finished. Returns 1 if it was successful.
+ * Output from other running jobs is read in the meantime, so that their
+ * workers do not stall on a full pipe.
+ */
+int feh_job_wait(feh_job * job)
+{
+	fd_set fdset;
+	int fdsize;
+
+	while (!feh_job_poll(job)) {
+		FD_ZERO(&fdset);
+		fdsize = feh_job_fill_fdset(&fdset, 0);
+		if (select(fdsize, &fdset, NULL, NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			weprintf("select failed:");
+			kill(job->pid, SIGTERM);
+			feh_job_finish(job, JOB_FAILED);
+		} else
+			feh_job_handle_fdset(&fdset);
+	}
+	return(job->state == JOB_DONE);
+}
+
+/*
+ * Hands the decoded image over to the caller, who is responsible for freeing
+ * it. The job has to be finished. Returns NULL if it did not produce an image.
+ */
+Imlib_Image feh_job_take_image(feh_job * job, int *orig_w, int *orig_h)
+{
+	Imlib_Image im = job->im;
+
+	if (job->state != JOB_DONE || !im)
+		return(NULL);
+
+	job->im = NULL;
+	if (orig_w)
+		*orig_w = job->header.orig_w;
+	if (orig_h)
+		*orig_h = job->header.orig_h;
+
+	return(im);
+}
+
+void feh_job_free(feh_job * job)
+{
+	if (!job)
+		return;
+
+	if (job->state == JOB_RUNNING) {
+		kill(job->pid, SIGTERM);
+		feh_job_finish(job, JOB_FAILED);
+	}
+	if (job->im) {
+		imlib_context_set_image(job->im);
+		imlib_free_image();
+	}
+	if (job->results)
+		free(job->results);
+	free(job);
+}
+
+int feh_job_load_image(feh_file * file, Imlib_Image * im, int *orig_w, int *orig_h)
+{
+	if (!feh_load_image(im, file))
+		return(0);
+
+	*orig_w = gib_imlib_image_get_width(*im);
+	*orig_h = gib_imlib_image_get_height(*im);
+	return(1);
+}
+
+int feh_job_count(void)
+{
+	long n = 1;
+
+	if (opt.jobs > 0)
+		return(opt.jobs);
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return(n > 0 ? n : 1);
+}
+
+void feh_job_queue_init(feh_job_queue * q, gib_list * start, feh_job_func func, int batch)
+{
+	q->jobs = NULL;
+	q->ready = NULL;
+	q->next = start;
+	q->func = func;
+	q->max = feh_job_count();
+	q->batch = batch > 1 ? batch : 1;
+}
+
+/*
+ * Turns a finished batch job into one finished job per file, in list order.
+ */
+static void feh_job_queue_split(feh_job_queue * q, feh_job * batch)
+{
+	feh_job *job;
+	gib_list *l;
+	int i, done = batch->results_read / sizeof(struct feh_job_header);
+
+	for (i = 0, l = batch->node; i < batch->count && l; i++, l = l->next) {
+		job = emalloc(sizeof(feh_job));
+		memset(job, 0, sizeof(feh_job));
+		job->file = FEH_FILE(l->data);
+		job->node = l;
+		job->fd = -1;
+		job->count = 1;
+		job->state = JOB_FAILED;
+		if (i < done) {
+			job->header = batch->results[i];
+			if (job->header.ok) {
+				job->state = JOB_DONE;
+				feh_job_apply_info(job->file, &job->header);
+			}
+		}
+		q->ready = gib_list_add_end(q->ready, job);
+	}
+	feh_job_free(batch);
+}
+
+feh_job *feh_job_queue_next(feh_job_queue * q)
+{
+	feh_job *job;
+	gib_list *l;
+	int i;
+
+	if (q->max <= 1) {
+		if (!q->next)
+			return(NULL);
+		job = emalloc(sizeof(feh_job));
+		memset(job, 0, sizeof(feh_job));
+		job->file = FEH_FILE(q->next->data);
+		job->node = q->next;
+		job->fd = -1;
+		job->count = 1;
+		q->next = q->next->next;
+		if (q->func(job->file, &job->im, &job->header.orig_w,
+					&job->header.orig_h))
+			job->state = JOB_DONE;
+		else {
+			job->state = JOB_FAILED;
+			job->im = NULL;
+		}
+		return(job);
+	}
+
+	while (!q->ready) {
+		while (q->next && (gib_list_length(q->jobs) < q->max)) {
+			if (q->batch > 1) {
+				for (i = 0, l = q->next; i < q->batch && l; i++)
+					l = l->next;
+				job = feh_job_start_batch(q->next, i, q->func);
+				q->next = l;
+			} else {
+				job = feh_job_start(FEH_FILE(q->next->data), q->func);
+				job->node = q->next;
+				q->next = q->next->next;
+			}
+			q->jobs = gib_list_add_end(q->jobs, job);
+		}
+
+		if (!(l = q->jobs))
+			return(NULL);
+
+		job = l->data;
+		q->jobs = gib_list_remove(q->jobs, l);
+		feh_job_wait(job);
+
+		if (!job->results)
+			return(job);
+		feh_job_queue_split(q, job);
+	}
+
+	job = q->ready->data;
+	q->ready = gib_list_remove(q->ready, q->ready);
+	return(job);
+}
+
+void feh_job_queue_cancel(feh_job_queue * q)
+{
+	gib_list *l;
+
+	for (l = q->jobs; l; l = l->next)
+		feh_job_free(l->data);
+	for (l = q->ready; l; l = l->next)
+		feh_job_free(l->data);
+	gib_list_free(q->jobs);
+	gib_list_free(q->ready);
+	q->jobs = NULL;
+	q->ready = NULL;
+	q->next = NULL;
+}
@@ -0,0 +1,115 @@
+/* worker.h
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef WORKER_H
+#define WORKER_H
+
+/*
+ * Imlib2 keeps its state in a global context and is not thread-safe, so
+ * background decoding is done in forked worker processes. Each job runs
+ * a feh_job_func in its own child, which sends the resulting image (if any)
+ * and file info back through a pipe.
+ */
+
+typedef struct __feh_job feh_job;
+
+/*
+ * Runs in the child process. Returns nonzero on success. *im may be left
+ * NULL if the caller is only interested in file->info.
+ */
+typedef int (*feh_job_func) (feh_file * file, Imlib_Image * im, int *orig_w, int *orig_h);
+
+enum feh_job_state { JOB_RUNNING, JOB_DONE, JOB_FAILED };
+
+struct feh_job_header {
+	int ok;
+	int w;
+	int h;
+	int has_alpha;
+	int orig_w;
+	int orig_h;
+	int has_info;
+	int info_width;
+	int info_height;
+	int info_size;
+	int info_has_alpha;
+	char format[16];	/* image format, also used for file->info */
+};
+
+struct __feh_job {
+	feh_file *file;
+	gib_list *node;		/* filelist entry, if the caller cares */
+	pid_t pid;
+	int fd;
+	int slot_fd;		/* conversion slot notes, see convpool.c */
+	enum feh_job_state state;
+
+	struct feh_job_header header;
+	size_t header_read;
+
+	Imlib_Image im;
+	DATA32 *data;
+	size_t data_read;
+
+	/* batch jobs: one header per file, no image data */
+	int count;
+	struct feh_job_header *results;
+	size_t results_read;
+};
+
+feh_job *feh_job_start(feh_file * file, feh_job_func func);
+feh_job *feh_job_start_batch(gib_list * node, int count, feh_job_func func);
+int feh_job_poll(feh_job * job);
+int feh_job_wait(feh_job * job);
+Imlib_Image feh_job_take_image(feh_job * job, int *orig_w, int *orig_h);
+void feh_job_free(feh_job * job);
+
+/*
+ * Runs func for each filelist entry starting at `next', keeping up to `max'
+ * jobs in flight. feh_job_queue_next returns the finished jobs in filelist
+ * order; job->node is the corresponding filelist entry. With max <= 1, no
+ * workers are forked and func runs in the calling process.
+ *
+ * If `batch' is larger than 1, each worker handles that many consecutive
+ * entries. This is meant for cheap, info-only jobs where forking once per
+ * file would dominate; func must not return an image in this case.
+ */
+typedef struct __feh_job_queue {
+	gib_list *jobs;
+	gib_list *ready;
+	gib_list *next;
+	feh_job_func func;
+	int max;
+	int batch;
+} feh_job_queue;
+
+void feh_job_queue_init(feh_job_queue * q, gib_list * start, feh_job_func func, int batch);
+feh_job *feh_job_queue_next(feh_job_queue * q);
+void feh_job_queue_cancel(feh_job_queue * q);
+int feh_job_count(void);
+
+int feh_job_load_image(feh_file * file, Imlib_Image * im, int *orig_w, int *orig_h);
+
+#endif
@@ -0,0 +1,206 @@
+/* xshm.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+
+/*
+ * Pixel upload through a MIT-SHM segment.
+ *
+ * Imlib2 converts each rendered image to an XImage of its own and, if it
+ * uses shared memory at all, sets up a new segment for every large render.
+ * On the common 24 bit TrueColor visuals, an XImage has the very same
+ * layout as Imlib2's ARGB data, though. So here, images are scaled straight
+ * into a segment which is kept for the lifetime of feh, and handed to the
+ * X server with XShmPutImage.
+ *
+ * Anything else (remote displays, other visuals, images with alpha) goes
+ * through Imlib2 as before.
+ */
+
+#include "feh.h"
+
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+
+#ifdef WORDS_BIGENDIAN
+#define SHM_BYTE_ORDER MSBFirst
+#else
+#define SHM_BYTE_ORDER LSBFirst
+#endif
+
+static enum { SHM_UNKNOWN, SHM_OK, SHM_UNAVAILABLE } shm_state = SHM_UNKNOWN;
+static XShmSegmentInfo shm_info;
+static size_t shm_size = 0;
+static int shm_error = 0;
+
+static int feh_shm_error_handler(Display * d __attribute__((unused)),
+		XErrorEvent * ev __attribute__((unused)))
+{
+	shm_error = 1;
+	return(0);
+}
+
+static void feh_shm_detach(void)
+{
+	if (!shm_size)
+		return;
+	XShmDetach(disp, &shm_info);
+	XSync(disp, False);
+	shmdt(shm_info.shmaddr);
+	shm_size = 0;
+}
+
+/* makes sure the segment holds at least size bytes. Returns 1 on success */
+static int feh_shm_reserve(size_t size)
+{
+	int (*old_handler)(Display *, XErrorEvent *);
+
+	if (size <= shm_size)
+		return(1);
+	feh_shm_detach();
+
+	if ((shm_info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600)) == -1)
+		return(0);
+	shm_info.shmaddr = shmat(shm_info.shmid, NULL, 0);
+	/* the segment goes away once both feh and the X server detach it */
+	shmctl(shm_info.shmid, IPC_RMID, NULL);
+	if (shm_info.shmaddr == (char *)-1)
+		return(0);
+	shm_info.readOnly = True;
+
+	/* this fails on remote displays, and only the X server can tell */
+	shm_error = 0;
+	old_handler = XSetErrorHandler(feh_shm_error_handler);
+	XShmAttach(disp, &shm_info);
+	XSync(disp, False);
+	XSetErrorHandler(old_handler);
+	if (shm_error) {
+		shmdt(shm_info.shmaddr);
+		return(0);
+	}
+
+	shm_size = size;
+	D(("attached %zu byte MIT-SHM segment\n", size));
+	return(1);
+}
+
+static int feh_shm_usable(void)
+{
+	XImage *xim;
+
+	if (shm_state != SHM_UNKNOWN)
+		return(shm_state == SHM_OK);
+	shm_state = SHM_UNAVAILABLE;
+
+	if (!XShmQueryExtension(disp) || (depth != 24) || (vis->class != TrueColor)
+			|| (vis->red_mask != 0xff0000) || (vis->green_mask != 0xff00)
+			|| (vis->blue_mask != 0xff))
+		return(0);
+
+	/* 32 bits per pixel in host byte order, just like DATA32 */
+	xim = XShmCreateImage(disp, vis, depth, ZPixmap, NULL, &shm_info, 1, 1);
+	if (!xim)
+		return(0);
+	if ((xim->bits_per_pixel == 32) && (xim->byte_order == SHM_BYTE_ORDER))
+		shm_state = SHM_OK;
+	XDestroyImage(xim);
+
+	D(("MIT-SHM upload %s\n", (shm_state == SHM_OK) ? "enabled" : "disabled"));
+	return(shm_state == SHM_OK);
+}
+
+/*
+ * Renders part of im onto d through the shared memory segment. Returns 0 if
+ * that is not possible, in which case nothing has been drawn.
+ */
+static int feh_shm_render(Drawable d, Imlib_Image im, int sx, int sy,
+		int sw, int sh, int dx, int dy, int dw, int dh, int blend, int alias)
+{
+	static GC gc = None;
+	Imlib_Image buf;
+	XImage *xim;
+
+	if (!feh_shm_usable() || (dw <= 0) || (dh <= 0))
+		return(0);
+
+	imlib_context_set_image(im);
+	/* blending needs the drawable's contents, and Imlib2 clips the source */
+	if ((blend && imlib_image_has_alpha()) || (sx < 0) || (sy < 0)
+			|| (sx + sw > imlib_image_get_width())
+			|| (sy + sh > imlib_image_get_height()))
+		return(0);
+
+	if (!feh_shm_reserve((size_t)dw * dh * sizeof(DATA32))) {
+		weprintf("MIT-SHM is not available, falling back to Imlib2 rendering");
+		shm_state = SHM_UNAVAILABLE;
+		return(0);
+	}
+
+	xim = XShmCreateImage(disp, vis, depth, ZPixmap, shm_info.shmaddr,
+			&shm_info, dw, dh);
+	if (!xim)
+		return(0);
+	if (xim->bytes_per_line != dw * (int)sizeof(DATA32)) {
+		xim->data = NULL;
+		XDestroyImage(xim);
+		return(0);
+	}
+
+	buf = imlib_create_image_using_data(dw, dh, (DATA32 *) shm_info.shmaddr);
+	imlib_context_set_image(buf);
+	imlib_context_set_anti_alias(alias);
+	imlib_context_set_blend(0);
+	imlib_context_set_angle(0);
+	imlib_blend_image_onto_image(im, 0, sx, sy, sw, sh, 0, 0, dw, dh);
+	imlib_free_image();
+
+	if (gc == None)
+		gc = XCreateGC(disp, d, 0, NULL);
+	XShmPutImage(disp, d, gc, xim, 0, 0, dx, dy, dw, dh, False);
+	/* the next render reuses the segment, so the server has to be done */
+	XSync(disp, False);
+
+	/* the image data belongs to the segment */
+	xim->data = NULL;
+	XDestroyImage(xim);
+	return(1);
+}
+#endif				/* HAVE_XSHM */
+
+/*
+ * Like gib_imlib_render_image_part_on_drawable_at_size with dithering
+ * enabled, but uploads the pixels through MIT-SHM if possible.
+ */
+void feh_render_image_part(Drawable d, Imlib_Image im, int sx, int sy,
+		int sw, int sh, int dx, int dy, int dw, int dh, int blend, int alias)
+{
+#ifdef HAVE_XSHM
+	if (feh_shm_render(d, im, sx, sy, sw, sh, dx, dy, dw, dh, blend, alias))
+		return;
+#endif
+	gib_imlib_render_image_part_on_drawable_at_size(d, im, sx, sy, sw, sh,
+			dx, dy, dw, dh, 1, blend, alias);
+}
@@ -0,0 +1,129 @@
+/* hashbench.c
+
+Copyright (C) 2021 Daniel Friesel.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+
+/*
+ * Micro-benchmark for gib_hash, run with "make bench". Fills tables of
+ * increasing size with file name keys and reports the time per insertion,
+ * successful lookup, failed lookup and removal.
+ */
+
+#include <time.h>
+#include "../src/gib_hash.h"
+#include "../src/utils.h"
+
+/* gib_hash.c only needs these two from utils.c */
+void *_emalloc(size_t n)
+{
+	void *p;
+
+	if (!(p = malloc(n))) {
+		perror("malloc");
+		exit(1);
+	}
+	return(p);
+}
+
+char *_estrdup(char *s)
+{
+	return(strcpy(_emalloc(strlen(s) + 1), s));
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void bench(int n, int nocase)
+{
+	gib_hash *hash = nocase ? gib_hash_new_nocase() : gib_hash_new();
+	char **keys = _emalloc(n * sizeof(char *));
+	char miss[64];
+	double t0, t_set, t_hit, t_miss, t_remove;
+	long found = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(miss, sizeof(miss), "/home/user/pictures/IMG_%07d.JPG", i);
+		keys[i] = _estrdup(miss);
+	}
+
+	t0 = now();
+	for (i = 0; i < n; i++)
+		gib_hash_set(hash, keys[i], keys[i]);
+	t_set = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < n; i++)
+		found += (gib_hash_get(hash, keys[i]) == keys[i]);
+	t_hit = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < n; i++) {
+		snprintf(miss, sizeof(miss), "/home/user/pictures/img_%07d.png", i);
+		found -= (gib_hash_get(hash, miss) != NULL);
+	}
+	t_miss = now() - t0;
+
+	/* every other key first, so that removal has to fill holes in runs */
+	t0 = now();
+	for (i = 0; i < n; i += 2)
+		gib_hash_remove(hash, keys[i]);
+	for (i = 0; i < n; i += 2)
+		found -= (gib_hash_get(hash, keys[i + 1]) == keys[i + 1]);
+	for (i = 1; i < n; i += 2)
+		gib_hash_remove(hash, keys[i]);
+	t_remove = now() - t0;
+
+	if ((found != n / 2) || hash->count) {
+		fprintf(stderr, "hashbench: inconsistent table after %d keys\n", n);
+		exit(1);
+	}
+
+	printf("%8d %-6s %8.1f %8.1f %8.1f %8.1f\n", n, nocase ? "nocase" : "exact",
+			t_set / n * 1e9, t_hit / n * 1e9, t_miss / n * 1e9,
+			t_remove / n * 1e9);
+
+	gib_hash_free(hash);
+	for (i = 0; i < n; i++)
+		free(keys[i]);
+	free(keys);
+}
+
+int main(void)
+{
+	int n;
+
+	printf("%8s %-6s %8s %8s %8s %8s\n", "keys", "mode", "set ns", "hit ns",
+			"miss ns", "rm ns");
+	for (n = 1000; n <= 1000000; n *= 10) {
+		bench(n, 0);
+		bench(n, 1);
+	}
+	return(0);
+}